@@ -0,0 +1,230 @@
+/*
+ * Clock tree: system clock and peripheral bus clocks.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * SYSCLK and PBCLK frequencies are recomputed whenever OSCCON,
+ * SPLLCON (PIC32MZ) or PBxDIV (PIC32MZ) registers are written.
+ * The CPU executes one instruction per SYSCLK cycle, so the cycle
+ * count is also the count of SYSCLK periods.  Peripherals convert
+ * their clock to cycles with clock_ratio().
+ */
+#include <stdio.h>
+#include "globals.h"
+
+#ifdef PIC32MX7
+#   include "pic32mx.h"
+#   define POSC_HZ      8000000         // primary oscillator on MX7 boards
+#endif
+
+#ifdef PIC32MZ
+#   include "pic32mz.h"
+#   define POSC_HZ      24000000        // primary oscillator on MZ boards
+#endif
+
+#define FRC_HZ          8000000         // internal fast RC oscillator
+#define SOSC_HZ         32768           // secondary oscillator
+#define LPRC_HZ         32000           // internal low power RC oscillator
+
+#define NUM_PB          8               // number of peripheral buses
+
+static unsigned sysclk_hz;              // system clock frequency
+static unsigned pb_ratio[NUM_PB+1];     // SYSCLK cycles per PBCLK period
+
+static uint64_t time_cycles;            // cycle count at last clock change
+static uint64_t time_nsec;              // simulated time at last clock change
+
+#ifdef PIC32MX7
+static unsigned pll_input_div;          // PLL input divider from DEVCFG2
+#endif
+
+/*
+ * Frequency of system clock, in Hz.
+ */
+unsigned clock_sysclk()
+{
+    return sysclk_hz;
+}
+
+/*
+ * Frequency of peripheral bus clock, in Hz.
+ * PIC32MX has a single peripheral bus.
+ */
+unsigned clock_pbclk (int bus)
+{
+    return sysclk_hz / clock_ratio (bus);
+}
+
+/*
+ * Number of CPU cycles per one period of peripheral bus clock.
+ */
+unsigned clock_ratio (int bus)
+{
+#ifdef PIC32MX7
+    bus = 1;
+#endif
+    if (bus < 1 || bus > NUM_PB)
+        bus = 1;
+    return pb_ratio[bus];
+}
+
+/*
+ * Simulated time in nanoseconds, accumulated over clock changes.
+ */
+uint64_t clock_nsec()
+{
+    return time_nsec + (cpu_cycles() - time_cycles) * 1000000000ULL / sysclk_hz;
+}
+
+#ifdef PIC32MX7
+/*
+ * Set PLL input divider from configuration word DEVCFG2.
+ */
+void clock_init (unsigned devcfg2)
+{
+    static const unsigned pllidiv[8] = { 1, 2, 3, 4, 5, 6, 10, 12 };
+
+    pll_input_div = pllidiv [devcfg2 & 7];
+}
+
+/*
+ * Compute SYSCLK from OSCCON and DEVCFG2.
+ */
+static unsigned compute_sysclk()
+{
+    static const unsigned pllmult[8] = { 15, 16, 17, 18, 19, 20, 21, 24 };
+    static const unsigned postdiv[8] = { 1, 2, 4, 8, 16, 32, 64, 256 };
+    unsigned osccon = VALUE(OSCCON);
+    unsigned pllin;
+
+    switch ((osccon >> 12) & 7) {       // COSC
+    case 1:                             // FRC with PLL
+        pllin = FRC_HZ;
+        goto pll;
+    case 3:                             // POSC with PLL
+        pllin = POSC_HZ;
+pll:    pllin /= pll_input_div;
+        return pllin * pllmult [(osccon >> 16) & 7] /
+            postdiv [(osccon >> 27) & 7];
+    case 2:                             // POSC
+        return POSC_HZ;
+    case 4:                             // SOSC
+        return SOSC_HZ;
+    case 5:                             // LPRC
+        return LPRC_HZ;
+    case 6:                             // FRC divided by 16
+        return FRC_HZ / 16;
+    case 7:                             // FRC with postscaler
+        return FRC_HZ / postdiv [(osccon >> 24) & 7];
+    default:                            // FRC
+        return FRC_HZ;
+    }
+}
+#endif
+
+#ifdef PIC32MZ
+/*
+ * Compute SYSCLK from OSCCON and SPLLCON.
+ */
+static unsigned compute_sysclk()
+{
+    static const unsigned postdiv[8] = { 1, 2, 4, 8, 16, 32, 64, 256 };
+    unsigned osccon = VALUE(OSCCON);
+    unsigned spllcon = VALUE(SPLLCON);
+    unsigned pllin, odiv;
+
+    switch ((osccon >> 12) & 7) {       // COSC
+    case 1:                             // System PLL
+        pllin = (spllcon & 0x80) ? FRC_HZ : POSC_HZ;
+        pllin /= ((spllcon >> 8) & 7) + 1;
+        odiv = (spllcon >> 24) & 7;
+        if (odiv < 1)
+            odiv = 1;
+        if (odiv > 5)
+            odiv = 5;
+        return (uint64_t) pllin * (((spllcon >> 16) & 0x7f) + 1) >> odiv;
+    case 2:                             // POSC
+        return POSC_HZ;
+    case 4:                             // SOSC
+        return SOSC_HZ;
+    case 5:                             // LPRC
+        return LPRC_HZ;
+    case 7:                             // FRC with postscaler
+        return FRC_HZ / postdiv [(osccon >> 24) & 7];
+    default:                            // FRC
+        return FRC_HZ;
+    }
+}
+#endif
+
+/*
+ * Recompute clock frequencies after a write to clock registers.
+ * Notify peripherals when the frequencies change.
+ */
+void clock_update()
+{
+    unsigned osccon = VALUE(OSCCON);
+    unsigned sysclk, ratio[NUM_PB+1];
+    int bus, changed;
+#ifdef PIC32MZ
+    static const unsigned pbdiv[NUM_PB+1] = { 0,
+        PB1DIV, PB2DIV, PB3DIV, PB4DIV, PB5DIV, 0, PB7DIV, PB8DIV,
+    };
+#endif
+
+    if (osccon & 1) {
+        /* OSWEN: switch to new oscillator. */
+        osccon &= ~(7 << 12 | 1);
+        osccon |= ((osccon >> 8) & 7) << 12;
+    }
+    VALUE(OSCCON) = osccon | (1 << 5);  // SLOCK: PLL is always locked
+
+    sysclk = compute_sysclk();
+    for (bus=1; bus<=NUM_PB; bus++) {
+#ifdef PIC32MX7
+        ratio[bus] = 1 << ((osccon >> 19) & 3);
+#endif
+#ifdef PIC32MZ
+        ratio[bus] = pbdiv[bus] ? (VALUE(pbdiv[bus]) & 0x7f) + 1 : 1;
+#endif
+    }
+
+    changed = (sysclk != sysclk_hz);
+    for (bus=1; bus<=NUM_PB; bus++) {
+        if (ratio[bus] != pb_ratio[bus])
+            changed = 1;
+        pb_ratio[bus] = ratio[bus];
+    }
+    if (! changed)
+        return;
+
+    /* Accumulate simulated time at old frequency. */
+    if (sysclk_hz != 0)
+        time_nsec = clock_nsec();
+    time_cycles = cpu_cycles();
+    sysclk_hz = sysclk;
+    if (trace_flag)
+        printf ("--- SYSCLK = %u Hz, PBCLK = %u Hz\n",
+            sysclk_hz, clock_pbclk (2));
+
+    timer_clock_changed();
+}
@@ -0,0 +1,146 @@
+#!/bin/sh
+#
+# Run performance benchmark of the simulator on demo firmware.
+# See README.txt for details.
+#
+cd `dirname $0`
+TOP=../..
+SIM_MX7=${SIM_MX7:-$TOP/pic32mx7-max32}
+SIM_EXPLORER16=${SIM_EXPLORER16:-$TOP/pic32mx7-explorer16}
+SIM_MZ=${SIM_MZ:-$TOP/pic32mz-wifire}
+RETROBSD_HEX=$TOP/demo/retrobsd/explorer16-860.hex
+RETROBSD_SD=$TOP/demo/retrobsd/sdcard-860.rd
+RESULTS=results.jsonl
+LIMIT=2000000000                        # instruction limit for RetroBSD
+TMP=`mktemp -d /tmp/bench.XXXXXX`
+trap "rm -rf $TMP" 0
+
+ALL="boot-mx7 boot-mz wifire retrobsd-boot retrobsd-echo retrobsd-sdseq retrobsd-sdrand retrobsd-storm"
+[ $# -gt 0 ] && ALL="$*"
+
+#
+# Run the simulator for a workload, append the summary to results file.
+# Usage: run name simulator uart-number options...
+#
+run()
+{
+    name=$1; sim=$2; uart=$3; shift 3
+    if [ ! -x $sim ]; then
+        echo "$name: skipped, no simulator $sim"
+        return
+    fi
+    echo "$name: running..."
+    rm -f $TMP/summary.json
+    $sim -u $uart:file:$TMP/$name.log --summary=$TMP/summary.json "$@" \
+        < /dev/null > $TMP/$name.out 2>&1
+    if [ ! -f $TMP/summary.json ]; then
+        echo "$name: failed, see output:"
+        tail -5 $TMP/$name.out
+        return
+    fi
+    sed "s/^{/{\"workload\": \"$name\", \"date\": \"`date +%Y-%m-%dT%H:%M:%S`\", /" \
+        $TMP/summary.json >> $RESULTS
+    sed "s/^{/{\"workload\": \"$name\", /" $TMP/summary.json >> $TMP/results
+}
+
+#
+# Run a RetroBSD workload: login and a given script.
+#
+retrobsd()
+{
+    name=$1; shift
+    if [ ! -f $RETROBSD_HEX -o ! -f $RETROBSD_SD ]; then
+        echo "$name: skipped, no RetroBSD images in demo/retrobsd"
+        return
+    fi
+    cp $RETROBSD_SD $TMP/sdcard.rd
+    cat "$@" > $TMP/$name.script
+    run $name $SIM_EXPLORER16 2 -l $LIMIT -d $TMP/sdcard.rd \
+        --script=$TMP/$name.script $RETROBSD_HEX
+}
+
+#
+# Script for UART echo: 256 lines of 64 bytes, echoed by cat.
+#
+echo_script()
+{
+    echo 'send "cat\r"'
+    i=0
+    while [ $i -lt 256 ]; do
+        echo "send \"line $i 0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdef\\r\""
+        echo "expect \"line $i 0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdef\""
+        i=`expr $i + 1`
+    done
+    echo 'send "\x04"'
+    echo 'expect "# "'
+    echo 'exit 0'
+}
+
+#
+# Script for interrupt storm: 64 kbytes of input, dropped by cat.
+#
+storm_script()
+{
+    echo 'send "cat > /dev/null\r"'
+    echo 'sleep 1000000'
+    line=0123456789abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopq
+    i=0
+    while [ $i -lt 64 ]; do
+        echo "send \"$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r$line\\r\""
+        echo 'sleep 10000000'
+        i=`expr $i + 1`
+    done
+    echo 'send "\x04"'
+    echo 'expect "# "'
+    echo 'exit 0'
+}
+
+for w in $ALL; do
+    case $w in
+    boot-mx7)
+        run $w $SIM_MX7 1 -m -l 20000000 $TOP/demo/boot/boot-test.hex ;;
+    boot-mz)
+        run $w $SIM_MZ 4 -m -l 20000000 $TOP/demo/boot/boot-test.hex ;;
+    wifire)
+        run $w $SIM_MZ 4 -m -l 200000000 $TOP/demo/wifire/boot.hex \
+            $TOP/demo/wifire/uart.hex ;;
+    retrobsd-boot)
+        retrobsd $w boot.script ;;
+    retrobsd-echo)
+        echo_script > $TMP/echo.script
+        retrobsd $w login.script $TMP/echo.script ;;
+    retrobsd-sdseq)
+        retrobsd $w login.script sdseq.script ;;
+    retrobsd-sdrand)
+        retrobsd $w login.script sdrandom.script ;;
+    retrobsd-storm)
+        storm_script > $TMP/storm.script
+        retrobsd $w login.script $TMP/storm.script ;;
+    *)
+        echo "$w: unknown workload" ;;
+    esac
+done
+
+#
+# Print a table of results.
+#
+[ -f $TMP/results ] || exit 1
+echo ""
+printf "%-16s %5s %12s %10s %9s %12s\n" Workload Exit Instructions "Wall, sec" MIPS "Callbacks/s"
+sed 's/[{}",]//g' $TMP/results | while read line; do
+    set -- $line
+    workload=; exit_code=; instructions=; wall_time=; mips=; callbacks_per_sec=
+    while [ $# -gt 1 ]; do
+        case $1 in
+        workload:)          workload=$2 ;;
+        exit_code:)         exit_code=$2 ;;
+        instructions:)      instructions=$2 ;;
+        wall_time:)         wall_time=$2 ;;
+        mips:)              mips=$2 ;;
+        callbacks_per_sec:) callbacks_per_sec=$2 ;;
+        esac
+        shift
+    done
+    printf "%-16s %5s %12s %10s %9s %12s\n" $workload $exit_code \
+        $instructions $wall_time $mips $callbacks_per_sec
+done
@@ -0,0 +1,112 @@
+/*
+ * Scheduler of timed events for peripheral models.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * Every peripheral has a fixed set of event slots, listed in globals.h.
+ * An event is scheduled for a given cycle count; the main loop
+ * shortens the simulation quantum to stop at the nearest event,
+ * and calls event_run() after the quantum.  When no events are
+ * pending, the cost is a single comparison per quantum.
+ */
+#include <stdio.h>
+#include "globals.h"
+
+typedef struct {
+    uint64_t when;                      /* cycle count of the event */
+    void (*func) (int);                 /* handler */
+    int arg;                            /* argument for handler */
+    int active;                         /* event is scheduled */
+} event_t;
+
+static event_t event [EVENT_MAX];
+
+uint64_t event_next = EVENT_NEVER;      /* cycle count of nearest event */
+
+/*
+ * Recompute the nearest event.
+ */
+static void event_update()
+{
+    int id;
+
+    event_next = EVENT_NEVER;
+    for (id=0; id<EVENT_MAX; id++) {
+        if (event[id].active && event[id].when < event_next)
+            event_next = event[id].when;
+    }
+}
+
+/*
+ * Schedule the event at a given cycle count.
+ * Previous instance of the same event is cancelled.
+ */
+void event_schedule (int id, uint64_t when, void (*func) (int), int arg)
+{
+    event_t *e = &event[id];
+    int was_next = e->active && e->when == event_next;
+
+    e->when = when;
+    e->func = func;
+    e->arg = arg;
+    e->active = 1;
+    if (when < event_next)
+        event_next = when;
+    else if (was_next)
+        event_update();
+}
+
+/*
+ * Cancel the event.
+ */
+void event_cancel (int id)
+{
+    event_t *e = &event[id];
+
+    if (! e->active)
+        return;
+    e->active = 0;
+    if (e->when == event_next)
+        event_update();
+}
+
+/*
+ * Call handlers of all expired events.
+ * A handler may schedule the same event again.
+ */
+void event_run()
+{
+    uint64_t now = cpu_cycles();
+    event_t *e;
+    int id;
+
+    while (event_next <= now) {
+        for (id=0; id<EVENT_MAX; id++) {
+            e = &event[id];
+            if (e->active && e->when <= now) {
+                e->active = 0;
+                e->func (e->arg);
+            }
+        }
+        event_update();
+    }
+}
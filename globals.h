@@ -59,8 +59,31 @@ extern char *progname;          // base name of current program
 extern int trace_flag;          // trace enable
 extern int stop_on_reset;       // terminate simulation on software reset
 
+/*
+ * Exit codes of simulator.
+ */
+enum {
+    SIM_PASS        = 0,    // test passed
+    SIM_ERROR       = 1,    // bad options or input files
+    SIM_TIMEOUT     = 2,    // timeout waiting for console output
+    SIM_FAIL        = 3,    // test failed
+    SIM_LIMIT       = 4,    // instruction limit reached
+    SIM_HALT        = 5,    // WAIT with interrupts disabled
+    SIM_RESET       = 6,    // software reset, with -s option
+    SIM_UNSUPPORTED = 7,    // access to unsupported peripheral register
+    SIM_MCHECK      = 8,    // machine check exception
+    SIM_KILLED      = 9,    // killed by signal
+    SIM_FINISHED    = 10,   // simulation finished by the model
+    SIM_INTERRUPTED = 11,   // simulation interrupted, e.g. by debugger
+};
+void sim_exit (int code, const char *reason, ...);
+
 int load_file(void *progmem, void *bootmem, const char *filename);
 void dump_regs(const char *message);
+uint64_t cpu_cycles(void);
+char *host_pointer (unsigned vaddr, unsigned len, int write);
+int cpu_write_mem (unsigned vaddr, const void *data, unsigned nbytes);
+void cpu_flash_write (unsigned paddr, const void *data, unsigned nbytes);
 
 void io_init (void *bootp, unsigned devcfg0, unsigned devcfg1,
     unsigned devcfg2, unsigned devcfg3, unsigned devid, unsigned osccon);
@@ -76,11 +99,58 @@ void uart_update_mode (int unit);
 void uart_update_status (int unit);
 void uart_poll (void);
 int uart_active (void);
+void uart_capture_open (const char *filename);
+extern int uart_infinite_baud;      // transfer bytes instantly
+
+void timer_reset (void);
+void timer_update (int unit, int tmr_written);
+unsigned timer_read (int unit);
+void timer_clock_changed (void);
+
+/*
+ * Clock tree.  The CPU executes one instruction per SYSCLK cycle.
+ * Peripheral buses (PIC32MZ numbering; PIC32MX has only one):
+ */
+#define PBCLK_UART      2           // UART and SPI are clocked by PBCLK2
+#define PBCLK_SPI       2
+#define PBCLK_TIMER     3           // timers are clocked by PBCLK3
+
+void clock_init (unsigned devcfg2);
+void clock_update (void);
+unsigned clock_sysclk (void);
+unsigned clock_pbclk (int bus);
+unsigned clock_ratio (int bus);
+uint64_t clock_nsec (void);
+
+/*
+ * Slots of scheduled events.
+ */
+enum {
+    EVENT_TIMER,                    // Timer1...Timer9
+    EVENT_UART_RX = EVENT_TIMER + 9, // UART1...UART6 receivers
+    EVENT_UART_TX = EVENT_UART_RX + 6, // UART1...UART6 transmitters
+    EVENT_SPI = EVENT_UART_TX + 6,  // SPI1...SPI6
+    EVENT_SDCARD = EVENT_SPI + 6,   // SD cards 0 and 1
+    EVENT_FLASH = EVENT_SDCARD + 2, // SPI flash
+    EVENT_NVM = EVENT_FLASH + 1,    // flash controller
+    EVENT_MAX = EVENT_NVM + 1,
+};
+#define EVENT_NEVER     (~0ULL)
+
+extern uint64_t event_next;         // cycle count of nearest event
+void event_schedule (int id, uint64_t when, void (*func) (int), int arg);
+void event_cancel (int id);
+void event_run (void);
 
 void spi_reset (void);
 void spi_control (int unit);
 unsigned spi_readbuf (int unit);
+void spi_poll_status (int unit);
 void spi_writebuf (int unit, unsigned val);
+void spi_config (const char *arg);
+int spi_attach (const char *name, int unit, int cs_port, int cs_pin,
+    void (*select) (int, int), unsigned (*io) (int, unsigned), int arg);
+void spi_chip_select (int port, unsigned lat_value);
 
 void soft_reset (void);
 void irq_raise (int irq);
@@ -88,17 +158,32 @@ void irq_clear (int irq);
 void eic_level_vector (int ripl, int vector);
 
 extern unsigned sdcard_spi_port;    // SPI port number of SD card
-extern unsigned sdcard_gpio_port0;  // GPIO port number of CS0 signal
-extern unsigned sdcard_gpio_port1;  // GPIO port number of CS1 signal
-extern unsigned sdcard_gpio_cs0;    // GPIO pin mask of CS0 signal
-extern unsigned sdcard_gpio_cs1;    // GPIO pin mask of CS1 signal
+
+enum {
+    SDCARD_SYNC_NONE,               // no fsync of SD image
+    SDCARD_SYNC_EXIT,               // fsync at exit
+    SDCARD_SYNC_FSYNC,              // fsync after every write
+};
 
 void sdcard_init (int unit, const char *name, const char *filename, int cs_port, int cs_pin);
+void sdcard_sync_mode (const char *mode);
+void sdcard_profile (const char *arg);
+void sdcard_stats_print (FILE *out);
+void sdcard_stats_json (FILE *out);
+
 void sdcard_reset (void);
 void sdcard_select (int unit, int on);
-unsigned sdcard_io (unsigned data);
+unsigned sdcard_io (int unit, unsigned data);
+
+void spiflash_init (const char *filename);
+void spiflash_reset (void);
+
+void *nvm_image (const char *filename);
+void nvm_reset (void);
+void nvm_unlock (unsigned key);
+void nvm_control (void);
 
-void vtty_create (unsigned unit, char *name, int tcp_port);
+void vtty_create (unsigned unit, char *name, const char *backend);
 void vtty_delete (unsigned unit);
 int vtty_get_char (unsigned unit);
 void vtty_put_char (unsigned unit, char ch);
@@ -106,3 +191,64 @@ int vtty_is_char_avail (unsigned unit);
 int vtty_is_full (unsigned unit);
 void vtty_init (void);
 int vtty_wait (fd_set *rfdp);
+void vtty_send (unsigned unit, const char *data, unsigned len);
+
+extern int script_enabled;          // script is running
+void script_load (const char *filename);
+void script_output (unsigned unit, int ch);
+void script_poll (void);
+void script_pattern (const char *regex, int fail);
+
+extern int record_enabled;          // recording input
+extern int replay_enabled;          // replaying input
+void record_open (const char *filename);
+void replay_open (const char *filename);
+void record_sdcard (unsigned unit, const char *filename);
+void record_input (unsigned unit, unsigned byte);
+int replay_input (unsigned unit);
+
+extern int intercept_enabled;       // library routines are intercepted
+extern int intercept_check;         // compare interception with simulation
+void intercept_add (const char *names);
+void intercept_symbols (const char *filename);
+void intercept_setup (void);
+unsigned intercept_breakpoint (void);
+
+extern int semihost_enabled;        // semihosting calls are enabled
+void semihost_open (const char *dirname);
+void semihost_setup (void);
+int semihost_breakpoint (unsigned *cycles);
+
+#define STAT_NIRQ   256             // number of interrupt counters
+extern uint64_t stat_io_read [3];   // I/O reads by size: byte, halfword, word
+extern uint64_t stat_io_write [3];  // I/O writes by size
+extern uint64_t stat_irq [STAT_NIRQ]; // interrupts raised
+extern uint64_t stat_quanta;        // simulation quanta
+extern uint64_t stat_idle_nsec;     // wall time waiting for console input
+extern uint64_t stat_vtty_in;       // bytes received from console
+extern uint64_t stat_vtty_out;      // bytes sent to console
+void stats_open (const char *filename);
+void stats_start (void);
+void stats_poll (void);
+void stats_finish (void);
+
+enum {
+    MMIO_READ,                      // read access
+    MMIO_WRITE,                     // write access
+    MMIO_SYNC,                      // end of simulation quantum
+    MMIO_INPUT,                     // UART input byte
+};
+typedef struct {
+    int type;                       // record type
+    unsigned size;                  // access size in bytes
+    unsigned addr;                  // physical address, or UART number
+    unsigned value;                 // value read or written, or input byte
+    uint64_t cycles;                // cycle count
+} mmio_t;
+extern int mmio_recording;          // recording I/O accesses
+void mmio_record_open (const char *filename);
+void mmio_record (int type, unsigned addr, unsigned size, unsigned value);
+void mmio_record_input (unsigned unit, unsigned byte);
+void mmio_record_sync (void);
+void mmio_replay_open (const char *filename);
+int mmio_replay_next (mmio_t *rec);
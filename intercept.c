@@ -0,0 +1,345 @@
+/*
+ * Interception of library routines: memcpy, memset and friends.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * Addresses of routines are taken from a symbol table in nm format:
+ *
+ *      9d0012a0 T memcpy
+ *
+ * A breakpoint is set at the entry of every intercepted routine.
+ * When it is hit, the operation is performed on the host side,
+ * the result is placed in v0, and execution continues at the return
+ * address.  The cost of the routine is estimated and added to the
+ * cycle count.  Calls with arguments outside of RAM and flash are
+ * simulated as usual.
+ *
+ * The result is written to RAM by cpu_write_mem(), so translated
+ * code of the destination range is discarded: routines which load
+ * executable code, like bcopy() in exec, are safe to intercept.
+ *
+ * In check mode, the result is computed on the side, and the routine
+ * is simulated: at the return address the memory is compared
+ * with the expected result, and the cost of the routine is measured.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "icm/icmCpuManager.h"
+#include "globals.h"
+
+extern icmProcessorP processor;
+Uns64 read_reg (const char *name);
+void write_reg (const char *name, Uns64 value);
+
+enum {
+    OP_COPY,                            /* copy memory, overlap allowed */
+    OP_SET,                             /* fill memory with a byte */
+    OP_ZERO,                            /* clear memory */
+};
+
+typedef struct {
+    const char *name;                   /* routine name */
+    int op;                             /* operation */
+    int dst, src, len;                  /* argument numbers */
+    int ret;                            /* returns the destination */
+    unsigned cost;                      /* cycles per call */
+    unsigned bytes;                     /* bytes per cycle */
+    int enabled;                        /* interception requested */
+    Uns32 addr;                         /* entry address */
+    unsigned long long ncalls;          /* statistics */
+    unsigned long long nbytes;
+    unsigned long long ncycles;         /* measured in check mode */
+} routine_t;
+
+/*
+ * Rough cost of newlib routines for word-aligned data.
+ */
+static routine_t routine[] = {
+    { "memcpy",  OP_COPY, 0, 1, 2, 1, 16, 1 },
+    { "memmove", OP_COPY, 0, 1, 2, 1, 20, 1 },
+    { "bcopy",   OP_COPY, 1, 0, 2, 0, 20, 1 },
+    { "memset",  OP_SET,  0, 1, 2, 1, 16, 2 },
+    { "bzero",   OP_ZERO, 0, 0, 1, 0, 16, 2 },
+    { 0 },
+};
+
+int intercept_enabled;                  /* some routines are intercepted */
+int intercept_check;                    /* compare with simulation */
+
+static const char *symbols_file;        /* nm output of firmware */
+
+static struct {                         /* routine being checked */
+    routine_t *r;
+    Uns32 ra, sp;                       /* return address and stack */
+    Uns32 addr;                         /* destination address */
+    char *dst;                          /* host pointer to destination */
+    unsigned len;
+    char *expected;                     /* expected contents */
+    Uns64 icount;                       /* instruction count at entry */
+} check;
+
+static struct {                         /* result of the operation */
+    char *buf;
+    unsigned size;
+} result;
+
+/*
+ * Enable interception of routines, given a comma-separated list.
+ */
+void intercept_add (const char *names)
+{
+    routine_t *r;
+    const char *p;
+    int len;
+
+    for (p=names; *p; p+=len) {
+        if (*p == ',') {
+            len = 1;
+            continue;
+        }
+        len = strcspn (p, ",");
+        for (r=routine; r->name; r++) {
+            if (strncmp (r->name, p, len) == 0 && r->name[len] == 0)
+                break;
+        }
+        if (! r->name) {
+            fprintf (stderr, "Cannot intercept '%.*s': unknown routine\n",
+                len, p);
+            exit (1);
+        }
+        r->enabled = 1;
+        intercept_enabled = 1;
+    }
+}
+
+/*
+ * Set the name of symbol table file.
+ */
+void intercept_symbols (const char *filename)
+{
+    symbols_file = filename;
+}
+
+/*
+ * Print statistics at exit.
+ */
+static void intercept_report()
+{
+    routine_t *r;
+
+    for (r=routine; r->name; r++) {
+        if (! r->enabled || r->ncalls == 0)
+            continue;
+        fprintf (stderr, "Intercept: %s: %llu calls, %llu bytes",
+            r->name, r->ncalls, r->nbytes);
+        if (intercept_check)
+            fprintf (stderr, ", %llu instructions simulated", r->ncycles);
+        fprintf (stderr, "\n");
+    }
+}
+
+/*
+ * Find addresses of routines in the symbol table,
+ * and set breakpoints.
+ */
+void intercept_setup()
+{
+    FILE *fd;
+    char line [256], name [256], type;
+    unsigned addr;
+    routine_t *r;
+
+    if (! intercept_enabled)
+        return;
+    if (! symbols_file) {
+        fprintf (stderr, "Symbol table is required for interception, use --symbols\n");
+        exit (1);
+    }
+    fd = fopen (symbols_file, "r");
+    if (! fd) {
+        perror (symbols_file);
+        exit (1);
+    }
+    while (fgets (line, sizeof(line), fd)) {
+        if (sscanf (line, "%x %c %255s", &addr, &type, name) != 3)
+            continue;
+        for (r=routine; r->name; r++) {
+            if (r->enabled && strcmp (r->name, name) == 0)
+                r->addr = addr & ~1;
+        }
+    }
+    fclose (fd);
+
+    for (r=routine; r->name; r++) {
+        if (! r->enabled)
+            continue;
+        if (r->addr == 0) {
+            fprintf (stderr, "%s: symbol '%s' not found\n",
+                symbols_file, r->name);
+            exit (1);
+        }
+        if (! icmSetAddressBreakpoint (processor, r->addr)) {
+            fprintf (stderr, "Cannot set breakpoint at %s = %08x\n",
+                r->name, r->addr);
+            exit (1);
+        }
+        icmPrintf("Intercept: %s at %08x\n", r->name, r->addr);
+    }
+    atexit (intercept_report);
+}
+
+/*
+ * Perform the operation on host memory.
+ */
+static void perform (routine_t *r, char *dst, char *src, int c, unsigned len)
+{
+    switch (r->op) {
+    case OP_COPY:
+        memmove (dst, src, len);
+        break;
+    case OP_SET:
+        memset (dst, c, len);
+        break;
+    case OP_ZERO:
+        memset (dst, 0, len);
+        break;
+    }
+}
+
+/*
+ * Make sure the result buffer can hold len bytes.
+ */
+static int result_buffer (unsigned len)
+{
+    char *buf;
+
+    if (len <= result.size)
+        return 1;
+    buf = realloc (result.buf, len);
+    if (! buf)
+        return 0;
+    result.buf = buf;
+    result.size = len;
+    return 1;
+}
+
+/*
+ * Execute the instruction at breakpoint, leaving the breakpoint in place.
+ * Return the number of cycles.
+ */
+static unsigned step_over (Uns32 addr)
+{
+    icmClearAddressBreakpoint (processor, addr);
+    icmSimulate (processor, 1);
+    icmSetAddressBreakpoint (processor, addr);
+    return 1;
+}
+
+/*
+ * Return address of the checked routine is reached:
+ * compare the memory with expected contents.
+ */
+static unsigned check_done()
+{
+    routine_t *r = check.r;
+    unsigned i;
+
+    r->ncycles += icmGetProcessorICount (processor) - check.icount;
+    if (memcmp (check.dst, check.expected, check.len) != 0) {
+        for (i=0; check.dst[i] == check.expected[i]; i++)
+            continue;
+        fprintf (stderr, "Intercept: %s of %u bytes to %08x differs from simulation at offset %u\n",
+            r->name, check.len, check.addr, i);
+    }
+    free (check.expected);
+    check.r = 0;
+    icmClearAddressBreakpoint (processor, check.ra);
+    return 0;
+}
+
+/*
+ * Breakpoint reached: perform intercepted routine.
+ * Return the number of cycles to account.
+ */
+unsigned intercept_breakpoint()
+{
+    static const char *argreg[3] = { "a0", "a1", "a2" };
+    Uns32 pc = icmGetPC (processor);
+    Uns32 arg[3], ra;
+    char *dst, *src = 0;
+    routine_t *r;
+
+    if (check.r && pc == check.ra &&
+        (Uns32) read_reg ("sp") == check.sp)
+        return check_done();
+
+    for (r=routine; r->name; r++) {
+        if (r->enabled && r->addr == pc)
+            break;
+    }
+    if (! r->name)
+        return step_over (pc);
+
+    arg[0] = read_reg (argreg[0]);
+    arg[1] = read_reg (argreg[1]);
+    arg[2] = read_reg (argreg[2]);
+    dst = host_pointer (arg[r->dst], arg[r->len], 1);
+    if (r->op == OP_COPY)
+        src = host_pointer (arg[r->src], arg[r->len], 0);
+    if (! dst || (r->op == OP_COPY && ! src)) {
+        /* Outside of memory: simulate the routine. */
+        return step_over (pc);
+    }
+    r->ncalls++;
+    r->nbytes += arg[r->len];
+
+    if (intercept_check && ! check.r) {
+        /* Compute the expected result, and simulate the routine. */
+        check.expected = malloc (arg[r->len] + 1);
+        if (! check.expected) {
+            fprintf (stderr, "Intercept: out of memory\n");
+            exit (1);
+        }
+        memcpy (check.expected, dst, arg[r->len]);
+        perform (r, check.expected, src, arg[r->src], arg[r->len]);
+        check.r = r;
+        check.ra = read_reg ("ra") & ~1;
+        check.sp = read_reg ("sp");
+        check.addr = arg[r->dst];
+        check.dst = dst;
+        check.len = arg[r->len];
+        check.icount = icmGetProcessorICount (processor);
+        icmSetAddressBreakpoint (processor, check.ra);
+        return step_over (pc);
+    }
+
+    if (! result_buffer (arg[r->len]))
+        return step_over (pc);
+    perform (r, result.buf, src, arg[r->src], arg[r->len]);
+    if (! cpu_write_mem (arg[r->dst], result.buf, arg[r->len]))
+        return step_over (pc);
+    if (r->ret)
+        write_reg ("v0", arg[r->dst]);
+    ra = read_reg ("ra");
+    icmSetPC (processor, ra);
+    return r->cost + arg[r->len] / r->bytes;
+}
@@ -0,0 +1,1242 @@
+/*
+ * Benchmark and test of peripheral models, without OVPsim.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * Peripheral models are linked with a stub CPU: the cycle counter
+ * advances by a fixed number of cycles per I/O access, and expired
+ * events are run after every access, like at the end of a simulation
+ * quantum.  A workload is a stream of I/O accesses, built once and
+ * then replayed through io_read32() and io_write32(), the same way
+ * as mem_read() and mem_write() call them from the simulator.
+ * Streams model typical firmware drivers: polling loops are encoded
+ * as a single POLL access, which repeats until the value matches.
+ * Every read with known result is checked, so the benchmark also
+ * serves as a test of peripheral models.
+ *
+ * With -r option, a stream of I/O accesses recorded by the simulator
+ * (option --mmio-record) is replayed instead, at cycle counts from
+ * the recording, and values of reads are compared with recorded ones.
+ * Use the SD card image in the state it had at the start of recording.
+ *
+ * Usage:
+ *      iobench [-n count] [-c cycles] [-s] [workload...]
+ *      iobench -r file [-d sd.img] [-s]
+ *
+ * Option -s prints statistics of SD card access at the end.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include "globals.h"
+
+#ifdef PIC32MX7
+#   include "pic32mx.h"
+#   define GPIO_STRIDE  0x40            // distance between GPIO ports
+#   define NVM_ROW      512             // flash row and page size
+#   define NVM_PAGE     4096
+#   define NVMDATA0     NVMDATA
+#endif
+
+#ifdef PIC32MZ
+#   include "pic32mz.h"
+#   define GPIO_STRIDE  0x100
+#   define NVM_ROW      2048
+#   define NVM_PAGE     16384
+#endif
+
+#define SD_BLOCKS       2048            // size of SD card image, in blocks
+#define SD_MULTI        16              // blocks per read-multiple sequence
+#define SDHC_GBYTES     64              // size of sparse SDXC image
+#define POLL_MAX        1000000         // max iterations of polling loop
+#define FLASH_KBYTES    1024            // size of SPI flash image
+#define NVM_WORDS       16              // words programmed one by one
+
+enum {
+    ACC_READ,                           // read, ignore the value
+    ACC_WRITE,                          // write a value
+    ACC_CHECK,                          // read and compare with a value
+    ACC_POLL,                           // read until value matches
+    ACC_LOOP,                           // repeat previous accesses until
+                                        // last read value matches
+};
+
+typedef struct {
+    unsigned op;                        // type of access
+    unsigned addr;                      // physical address
+    unsigned data;                      // written or expected value
+    unsigned mask;                      // mask for check and poll
+} access_t;
+
+static access_t *stream;                // current workload
+static unsigned stream_len;
+static unsigned stream_max;
+
+static unsigned cycles_per_access = 10; // CPU cycles between I/O accesses
+static uint64_t cycles;                 // CPU cycle counter
+static uint64_t naccess;                // number of I/O accesses done
+static unsigned nerrors;                // number of failed checks
+
+static const unsigned spi_con[] = {     // SPIxCON address
+    SPI1CON, SPI2CON, SPI3CON, SPI4CON,
+#ifdef PIC32MZ
+    SPI5CON, SPI6CON,
+#endif
+};
+static unsigned sd_con, sd_stat, sd_buf;// SPI registers of SD card
+static unsigned sd_latclr, sd_latset;   // GPIO registers of chip select
+static unsigned sd_cs;                  // chip select pin mask
+static int sd_port, sd_pin;             // chip select port and pin number
+static char sd_file[] = "/tmp/iobench-sd.XXXXXX";
+static int sd_created;                  // image file created by iobench
+static char sdhc_file[] = "/tmp/iobench-sdhc.XXXXXX";
+static int sdhc_created;
+static unsigned sdhc_block;             // last block written
+static unsigned fl_cs;                  // chip select pin mask of SPI flash
+static char fl_file[] = "/tmp/iobench-flash.XXXXXX";
+static int fl_created;
+static unsigned nvm_page;               // last page of program flash used
+static uint64_t nvm_written;            // bytes of flash modified
+
+static uint32_t progmem [PROGRAM_FLASH_SIZE/4];
+static uint32_t bootmem [BOOT_FLASH_SIZE/4];
+static char datamem [DATA_MEM_SIZE];
+
+/*
+ * Stubs of simulator functions.
+ */
+uint32_t iomem [IO_MEM_SIZE/4];
+char *progname = "iobench";
+int trace_flag;
+int stop_on_reset;
+uint64_t stat_io_read [3];
+uint64_t stat_io_write [3];
+uint64_t stat_irq [STAT_NIRQ];
+uint64_t stat_quanta;
+uint64_t stat_idle_nsec;
+uint64_t stat_vtty_in;
+uint64_t stat_vtty_out;
+
+uint64_t cpu_cycles()
+{
+    return cycles;
+}
+
+char *host_pointer (unsigned vaddr, unsigned len, int write)
+{
+    unsigned paddr = vaddr & 0x1fffffff;
+
+    if (paddr >= DATA_MEM_START &&
+        paddr + (uint64_t) len <= DATA_MEM_START + DATA_MEM_SIZE)
+        return datamem + paddr - DATA_MEM_START;
+    if (write)
+        return 0;
+    if (IN_PROGRAM_MEM(paddr) &&
+        paddr + (uint64_t) len <= PROGRAM_FLASH_START + PROGRAM_FLASH_SIZE)
+        return (char*) progmem + paddr - PROGRAM_FLASH_START;
+    if (IN_BOOT_MEM(paddr) &&
+        paddr + (uint64_t) len <= BOOT_FLASH_START + BOOT_FLASH_SIZE)
+        return (char*) bootmem + paddr - BOOT_FLASH_START;
+    return 0;
+}
+
+void cpu_flash_write (unsigned paddr, const void *data, unsigned nbytes)
+{
+    memcpy (host_pointer (paddr, nbytes, 0), data, nbytes);
+    nvm_written += nbytes;
+}
+
+void eic_level_vector (int ripl, int vector)
+{
+}
+
+void soft_reset()
+{
+}
+
+void dump_regs (const char *message)
+{
+}
+
+void sim_exit (int code, const char *reason, ...)
+{
+    fprintf (stderr, "Simulation stopped: %s\n", reason);
+    exit (code);
+}
+
+/*
+ * Append an access to the stream.
+ */
+static void emit (unsigned op, unsigned addr, unsigned data, unsigned mask)
+{
+    access_t *a;
+
+    if (stream_len >= stream_max) {
+        stream_max = stream_max ? stream_max * 2 : 1024;
+        stream = realloc (stream, stream_max * sizeof (access_t));
+        if (! stream) {
+            fprintf (stderr, "iobench: out of memory\n");
+            exit (1);
+        }
+    }
+    a = &stream[stream_len++];
+    a->op = op;
+    a->addr = addr & 0x1fffffff;
+    a->data = data;
+    a->mask = mask;
+}
+
+/*
+ * Perform one I/O access, and advance the time.
+ */
+static unsigned io_access (int write, unsigned addr, unsigned data)
+{
+    unsigned *bufp = &iomem[(addr & 0xfffff) >> 2];
+    const char *name;
+
+    cycles += cycles_per_access;
+    naccess++;
+    if (write)
+        io_write32 (addr, bufp, data, &name);
+    else
+        data = io_read32 (addr, bufp, &name);
+    if (cycles >= event_next)
+        event_run();
+    return data;
+}
+
+/*
+ * Replay the stream.
+ */
+static void replay()
+{
+    access_t *a, *end = stream + stream_len;
+    unsigned value = 0, n, loops = 0;
+
+    for (a=stream; a<end; a++) {
+        switch (a->op) {
+        case ACC_READ:
+            value = io_access (0, a->addr, 0);
+            break;
+        case ACC_WRITE:
+            io_access (1, a->addr, a->data);
+            break;
+        case ACC_CHECK:
+            value = io_access (0, a->addr, 0);
+            if ((value & a->mask) != a->data) {
+                if (nerrors++ < 10)
+                    fprintf (stderr, "Access %u: read %08x from %08x, expected %08x\n",
+                        (unsigned) (a - stream), value & a->mask, a->addr, a->data);
+            }
+            break;
+        case ACC_POLL:
+            for (n=0; ; n++) {
+                value = io_access (0, a->addr, 0);
+                if ((value & a->mask) == a->data)
+                    break;
+                if (n >= POLL_MAX) {
+                    if (nerrors++ < 10)
+                        fprintf (stderr, "Access %u: timeout polling %08x for %08x\n",
+                            (unsigned) (a - stream), a->addr, a->data);
+                    break;
+                }
+            }
+            break;
+        case ACC_LOOP:
+            /* Number of accesses to repeat is in addr field. */
+            if ((value & a->mask) == a->data) {
+                loops = 0;
+                break;
+            }
+            if (loops++ >= POLL_MAX) {
+                if (nerrors++ < 10)
+                    fprintf (stderr, "Access %u: timeout waiting for %08x\n",
+                        (unsigned) (a - stream), a->data);
+                loops = 0;
+                break;
+            }
+            a -= a->addr + 1;
+            break;
+        }
+    }
+}
+
+/*
+ * GPIO: toggle a pin and read the port.
+ */
+static void gpio_workload (unsigned count)
+{
+    unsigned i;
+
+    emit (ACC_WRITE, TRISA, 0, 0);
+    emit (ACC_WRITE, LATA, 0, 0);
+    for (i=0; i<count; i++) {
+        emit (ACC_WRITE, LATAINV, 1, 0);
+        emit (ACC_CHECK, LATA, ~i & 1, 1);
+    }
+}
+
+/*
+ * Timer: wait for period match by polling the interrupt flag.
+ */
+static void timer_workload (unsigned count)
+{
+    unsigned mask = 1 << (PIC32_IRQ_T2 & 31);
+    unsigned i;
+
+    emit (ACC_WRITE, T2CON, 0, 0);
+    emit (ACC_WRITE, TMR2, 0, 0);
+    emit (ACC_WRITE, PR2, 100, 0);
+    emit (ACC_WRITE, T2CON, PIC32_TCON_ON, 0);
+    for (i=0; i<count; i++) {
+        emit (ACC_WRITE, IFSCLR(PIC32_IRQ_T2 >> 5), mask, 0);
+        emit (ACC_POLL, IFS(PIC32_IRQ_T2 >> 5), mask, mask);
+        emit (ACC_READ, TMR2, 0, 0);
+    }
+    emit (ACC_WRITE, T2CON, 0, 0);
+}
+
+/*
+ * Check that set/clear/invert operations on a timer counter
+ * apply to the current count, not to the last written value,
+ * and that a write to one half of a 32-bit counter keeps the other.
+ */
+static void timer_done (unsigned count)
+{
+    unsigned i, value;
+
+    io_access (1, T3CON, 0);
+    io_access (1, TMR3, 0);
+    io_access (1, PR3, 0xffff);
+    io_access (1, T3CON, PIC32_TCON_ON);
+    for (i=0; i<1000; i++)
+        io_access (0, T3CON, 0);
+    io_access (1, T3CON, 0);
+
+    /* Counter is not read before the operation: the stored
+     * value is still zero, and the count must be kept. */
+    io_access (1, TMR3SET, 0x8000);
+    value = io_access (0, TMR3, 0);
+    if (value == 0x8000 || ! (value & 0x8000)) {
+        fprintf (stderr, "timer: TMR3SET gives %04x, expected count | 8000\n",
+            value);
+        nerrors++;
+    }
+
+    /* 32-bit pairs: T2/T3 gets the high half written while running,
+     * T4/T5 is the reference.  The low half must keep counting. */
+    io_access (1, T2CON, 0);
+    io_access (1, T3CON, 0);
+    io_access (1, T4CON, 0);
+    io_access (1, T5CON, 0);
+    io_access (1, TMR2, 0);
+    io_access (1, TMR3, 0x55);
+    io_access (1, TMR4, 0);
+    io_access (1, TMR5, 0);
+    io_access (1, PR2, 0xffff);
+    io_access (1, PR3, 0xffff);
+    io_access (1, PR4, 0xffff);
+    io_access (1, PR5, 0xffff);
+    io_access (1, T2CON, PIC32_TCON_ON | PIC32_TCON_T32);
+    io_access (1, T4CON, PIC32_TCON_ON | PIC32_TCON_T32);
+    value = io_access (0, TMR3, 0);
+    if (value != 0x55) {
+        fprintf (stderr, "timer: TMR3 is %04x after T32 is set, expected 0055\n",
+            value);
+        nerrors++;
+    }
+    for (i=0; i<1000; i++)
+        io_access (0, T2CON, 0);
+    io_access (1, TMR3, 0x1234);
+    value = io_access (0, TMR2, 0);
+    if (value < io_access (0, TMR4, 0) / 2 ||
+        io_access (0, TMR3, 0) != 0x1234) {
+        fprintf (stderr, "timer: TMR2 is %04x after TMR3 write, expected current count\n",
+            value);
+        nerrors++;
+    }
+    io_access (1, T2CON, 0);
+    io_access (1, T4CON, 0);
+}
+
+/*
+ * UART: transmit bytes, polling for free space in the buffer.
+ */
+static void uart_workload (unsigned count)
+{
+    unsigned i;
+
+    emit (ACC_WRITE, U1BRG, 0, 0);
+    emit (ACC_WRITE, U1MODE, PIC32_UMODE_ON, 0);
+    emit (ACC_WRITE, U1STA, PIC32_USTA_UTXEN, 0);
+    for (i=0; i<count; i++) {
+        emit (ACC_POLL, U1STA, 0, PIC32_USTA_UTXBF);
+        emit (ACC_WRITE, U1TXREG, 'a' + i % 26, 0);
+    }
+    emit (ACC_POLL, U1STA, PIC32_USTA_TRMT, PIC32_USTA_TRMT);
+    emit (ACC_WRITE, U1MODE, 0, 0);
+}
+
+/*
+ * Check that all bytes reached the console.
+ */
+static void uart_done (unsigned count)
+{
+    if (stat_vtty_out != count) {
+        fprintf (stderr, "uart: %llu bytes transmitted, expected %u\n",
+            (unsigned long long) stat_vtty_out, count);
+        nerrors++;
+    }
+}
+
+/*
+ * Contents of SD card image at a given offset.
+ */
+static unsigned sd_pattern (unsigned offset)
+{
+    return (offset ^ offset >> 9 ^ offset >> 17) & 0xff;
+}
+
+/*
+ * Send a byte to SD card, and check the reply.
+ */
+static void sd_byte (unsigned data, int check, unsigned reply)
+{
+    emit (ACC_WRITE, sd_buf, data, 0);
+    emit (ACC_POLL, sd_stat, PIC32_SPISTAT_SPIRBF, PIC32_SPISTAT_SPIRBF);
+    emit (check ? ACC_CHECK : ACC_READ, sd_buf, reply, 0xff);
+}
+
+/*
+ * Send a command to SD card, with chip select.
+ */
+static void sd_command (unsigned cmd, unsigned arg)
+{
+    emit (ACC_WRITE, sd_latclr, sd_cs, 0);
+    sd_byte (cmd, 1, 0xff);
+    sd_byte (arg >> 24, 1, 0xff);
+    sd_byte (arg >> 16, 1, 0xff);
+    sd_byte (arg >> 8, 1, 0xff);
+    sd_byte (arg, 1, 0xff);
+    sd_byte (0x95, 1, 0xff);
+}
+
+/*
+ * Send FF bytes until the card replies with a given value.
+ */
+static void sd_wait (unsigned reply)
+{
+    sd_byte (0xff, 0, 0);
+    emit (ACC_LOOP, 3, reply, 0xff);
+}
+
+/*
+ * Enable SPI port of SD card, in 8-bit master mode.
+ */
+static void sd_enable()
+{
+    emit (ACC_WRITE, sd_latset, sd_cs | fl_cs, 0);
+    emit (ACC_WRITE, sd_con, 0, 0);
+    emit (ACC_WRITE, sd_con + 0x30, 0, 0);
+    emit (ACC_WRITE, sd_con, PIC32_SPICON_ON | PIC32_SPICON_MSTEN | PIC32_SPICON_CKE, 0);
+}
+
+/*
+ * SD card: read and write single blocks, through SPI port.
+ * Blocks are visited in pseudo-random order.
+ */
+static void sdcard_workload (unsigned count)
+{
+    unsigned i, k, block = 1, offset;
+
+    sd_enable();
+    for (i=0; i<count; i++) {
+        block = (block * 1103515245 + 12345) % SD_BLOCKS;
+        offset = block * 512;
+        if (i & 3) {
+            /* Read block. */
+            sd_command (0x40+17, offset);
+            sd_byte (0xff, 1, 0);
+            sd_byte (0xff, 1, 0xfe);
+            for (k=0; k<512; k++)
+                sd_byte (0xff, 1, sd_pattern (offset + k));
+            sd_byte (0xff, 0, 0);
+            sd_byte (0xff, 0, 0);
+        } else {
+            /* Write the same contents back. */
+            sd_command (0x40+24, offset);
+            sd_byte (0xff, 1, 0);
+            sd_byte (0xfe, 0, 0);
+            for (k=0; k<512; k++)
+                sd_byte (sd_pattern (offset + k), 0, 0);
+            sd_byte (0xff, 0, 0);
+            sd_byte (0xff, 0, 0);
+            sd_byte (0xff, 1, 0x05);
+        }
+        emit (ACC_WRITE, sd_latset, sd_cs, 0);
+    }
+    emit (ACC_WRITE, sd_con, 0, 0);
+}
+
+/*
+ * SD card: read sequences of blocks by READ_MULTIPLE command,
+ * stopped by STOP_TRANSMISSION.  Blocks come from the read-ahead ring.
+ */
+static void sdmulti_workload (unsigned count)
+{
+    unsigned i, n, k, block = 1, offset;
+
+    sd_enable();
+    for (i=0; i<count; i++) {
+        block = (block * 1103515245 + 12345) % (SD_BLOCKS - SD_MULTI);
+        offset = block * 512;
+        sd_command (0x40+18, offset);
+        for (n=0; n<SD_MULTI; n++) {
+            sd_byte (0xff, 1, 0);
+            sd_byte (0xff, 1, 0xfe);
+            for (k=0; k<512; k++)
+                sd_byte (0xff, 1, sd_pattern (offset + n*512 + k));
+            sd_byte (0xff, 0, 0);
+            sd_byte (0xff, 0, 0);
+        }
+        emit (ACC_WRITE, sd_latset, sd_cs, 0);
+
+        /* Stop: reply comes on the second byte. */
+        emit (ACC_WRITE, sd_latclr, sd_cs, 0);
+        sd_byte (0x40+12, 1, 0xff);
+        for (k=0; k<5; k++)
+            sd_byte (0, 1, 0);
+        emit (ACC_WRITE, sd_latset, sd_cs, 0);
+    }
+    emit (ACC_WRITE, sd_con, 0, 0);
+}
+
+/*
+ * Write a sequence of blocks by WRITE_MULTIPLE command,
+ * with contents of the pattern xored with a mask.
+ */
+static void sd_write_multiple (unsigned offset, unsigned mask)
+{
+    unsigned n, k;
+
+    sd_command (0x40+25, offset);
+    sd_byte (0xff, 1, 0);
+    for (n=0; n<SD_MULTI; n++) {
+        sd_byte (0xff, 0, 0);
+        sd_byte (0xfc, 0, 0);
+        for (k=0; k<512; k++)
+            sd_byte (sd_pattern (offset + n*512 + k) ^ mask, 0, 0);
+        sd_byte (0xff, 0, 0);
+        sd_byte (0xff, 0, 0);
+        sd_byte (0xff, 1, 0x05);
+    }
+    sd_byte (0xfd, 0, 0);
+    sd_byte (0xff, 0, 0);
+    emit (ACC_WRITE, sd_latset, sd_cs, 0);
+}
+
+/*
+ * SD card: write sequences of blocks with inverted contents,
+ * read them back by single block reads, and restore.
+ */
+static void sdwrite_workload (unsigned count)
+{
+    unsigned i, n, k, block = 1, offset;
+
+    sd_enable();
+    for (i=0; i<count; i++) {
+        block = (block * 1103515245 + 12345) % (SD_BLOCKS - SD_MULTI);
+        offset = block * 512;
+        sd_write_multiple (offset, 0xff);
+        for (n=0; n<SD_MULTI; n++) {
+            sd_command (0x40+17, offset + n*512);
+            sd_byte (0xff, 1, 0);
+            sd_byte (0xff, 1, 0xfe);
+            for (k=0; k<512; k++)
+                sd_byte (0xff, 1, sd_pattern (offset + n*512 + k) ^ 0xff);
+            sd_byte (0xff, 0, 0);
+            sd_byte (0xff, 0, 0);
+            emit (ACC_WRITE, sd_latset, sd_cs, 0);
+        }
+        sd_write_multiple (offset, 0);
+    }
+    emit (ACC_WRITE, sd_con, 0, 0);
+}
+
+/*
+ * SD card with timing profile of class 10: wait for data token
+ * on reads, and for end of busy state on writes.
+ */
+static void sdbusy_workload (unsigned count)
+{
+    unsigned i, k, block = 1, offset;
+
+    sdcard_profile ("0:class10");
+    sd_enable();
+    for (i=0; i<count; i++) {
+        block = (block * 1103515245 + 12345) % SD_BLOCKS;
+        offset = block * 512;
+        sd_command (0x40+17, offset);
+        sd_byte (0xff, 1, 0);
+        sd_wait (0xfe);
+        for (k=0; k<512; k++)
+            sd_byte (0xff, 1, sd_pattern (offset + k));
+        sd_byte (0xff, 0, 0);
+        sd_byte (0xff, 0, 0);
+        emit (ACC_WRITE, sd_latset, sd_cs, 0);
+
+        sd_command (0x40+24, offset);
+        sd_byte (0xff, 1, 0);
+        sd_byte (0xfe, 0, 0);
+        for (k=0; k<512; k++)
+            sd_byte (sd_pattern (offset + k), 0, 0);
+        sd_byte (0xff, 0, 0);
+        sd_byte (0xff, 0, 0);
+        sd_byte (0xff, 1, 0x05);
+        sd_byte (0xff, 1, 0);
+        sd_wait (0xff);
+        emit (ACC_WRITE, sd_latset, sd_cs, 0);
+    }
+    emit (ACC_WRITE, sd_con, 0, 0);
+}
+
+/*
+ * Check that busy periods took simulated time, and restore
+ * the card timing for other workloads.
+ */
+static void sdbusy_done (unsigned count)
+{
+    uint64_t busy = (uint64_t) count * (400 + 50 + 2500) * (clock_sysclk() / 1000000);
+
+    if (cycles < busy) {
+        fprintf (stderr, "sdbusy: %llu cycles, expected at least %llu\n",
+            (unsigned long long) cycles, (unsigned long long) busy);
+        nerrors++;
+    }
+    sdcard_profile ("0:none");
+}
+
+/*
+ * Send a command to SPI flash, with optional 3-byte address.
+ * Chip select remains active.
+ */
+static void fl_command (unsigned cmd, int addr)
+{
+    emit (ACC_WRITE, sd_latclr, fl_cs, 0);
+    sd_byte (cmd, 0, 0);
+    if (addr >= 0) {
+        sd_byte (addr >> 16, 0, 0);
+        sd_byte (addr >> 8, 0, 0);
+        sd_byte (addr, 0, 0);
+    }
+}
+
+/*
+ * Enable write to SPI flash, start the command, and wait
+ * until the flash is not busy.
+ */
+static void fl_write (unsigned cmd, unsigned addr, unsigned nbytes)
+{
+    unsigned k;
+
+    fl_command (0x06, -1);                      /* write enable */
+    emit (ACC_WRITE, sd_latset, fl_cs, 0);
+    fl_command (cmd, addr);
+    for (k=0; k<nbytes; k++)
+        sd_byte (sd_pattern (addr + k), 0, 0);
+    emit (ACC_WRITE, sd_latset, fl_cs, 0);
+
+    fl_command (0x05, -1);                      /* read status: busy, WEL */
+    sd_byte (0xff, 1, 0x03);
+    sd_wait (0x00);
+    emit (ACC_WRITE, sd_latset, fl_cs, 0);
+}
+
+/*
+ * SPI flash at the SD card port: check identification,
+ * erase a sector, program it page by page and read back.
+ */
+static void spiflash_workload (unsigned count)
+{
+    static unsigned char buf [4096];
+    unsigned i, k, sector = 1, addr;
+    char config [32];
+    int fd;
+
+    if (! fl_created) {
+        fd = mkstemp (fl_file);
+        if (fd < 0) {
+            perror (fl_file);
+            exit (1);
+        }
+        fl_created = 1;
+        for (addr=0; addr<FLASH_KBYTES*1024; addr+=sizeof(buf)) {
+            for (k=0; k<sizeof(buf); k++)
+                buf[k] = sd_pattern (addr + k);
+            if (write (fd, buf, sizeof(buf)) != sizeof(buf)) {
+                perror (fl_file);
+                exit (1);
+            }
+        }
+        close (fd);
+        sprintf (config, "flash:%u:%c%u", sdcard_spi_port + 1,
+            'A' + sd_port, sd_pin + 1);
+        spi_config (config);
+        spiflash_init (fl_file);
+    }
+    sd_enable();
+    for (i=0; i<count; i++) {
+        sector = (sector * 1103515245 + 12345) % (FLASH_KBYTES / 4);
+        addr = sector * 4096;
+
+        fl_command (0x9f, -1);                  /* JEDEC ID */
+        sd_byte (0xff, 1, 0xef);
+        sd_byte (0xff, 1, 0x40);
+        sd_byte (0xff, 1, 0x14);
+        emit (ACC_WRITE, sd_latset, fl_cs, 0);
+
+        fl_command (0x94, 0);                   /* quad manufacturer/device ID */
+        for (k=0; k<3; k++)
+            sd_byte (0xff, 0, 0);
+        sd_byte (0xff, 1, 0xef);
+        sd_byte (0xff, 1, 0x13);
+        emit (ACC_WRITE, sd_latset, fl_cs, 0);
+
+        fl_write (0x20, addr, 0);               /* sector erase */
+        fl_command (0x03, addr);                /* read */
+        for (k=0; k<256; k++)
+            sd_byte (0xff, 1, 0xff);
+        emit (ACC_WRITE, sd_latset, fl_cs, 0);
+
+        for (k=0; k<4096; k+=256)
+            fl_write (0x02, addr + k, 256);     /* page program */
+
+        fl_command (0x0b, addr);                /* fast read */
+        sd_byte (0xff, 0, 0);
+        for (k=0; k<4096; k++)
+            sd_byte (0xff, 1, sd_pattern (addr + k));
+        emit (ACC_WRITE, sd_latset, fl_cs, 0);
+    }
+    emit (ACC_WRITE, sd_con, 0, 0);
+}
+
+/*
+ * Start a flash operation with the unlock sequence,
+ * and wait until it's finished.
+ */
+static void nvm_operation (unsigned op, unsigned addr, int error)
+{
+    emit (ACC_WRITE, NVMCON, PIC32_NVMCON_WREN | op, 0);
+    emit (ACC_WRITE, NVMADDR, addr, 0);
+    emit (ACC_WRITE, NVMKEY, 0xaa996655, 0);
+    emit (ACC_WRITE, NVMKEY, 0x556699aa, 0);
+    emit (ACC_WRITE, NVMCONSET, PIC32_NVMCON_WR, 0);
+    emit (ACC_POLL, NVMCON, 0, PIC32_NVMCON_WR);
+    emit (ACC_CHECK, NVMCON, error ? PIC32_NVMCON_WRERR : 0,
+        PIC32_NVMCON_WRERR);
+}
+
+/*
+ * Flash controller: erase a page of program flash, program
+ * words and a row from RAM.  Check that WR cannot be set
+ * without the unlock sequence, and that a bad address fails.
+ */
+static void nvm_workload (unsigned count)
+{
+    unsigned i, k, addr, src = DATA_MEM_START + 0x1000;
+
+    for (k=0; k<NVM_ROW; k++)
+        datamem[src - DATA_MEM_START + k] = sd_pattern (k);
+    for (i=0; i<count; i++) {
+        nvm_page = (nvm_page * 1103515245 + 12345) % (PROGRAM_FLASH_SIZE / NVM_PAGE);
+        addr = PROGRAM_FLASH_START + nvm_page * NVM_PAGE;
+
+        emit (ACC_WRITE, NVMCON, PIC32_NVMCON_WREN | PIC32_NVMCON_PAGE_ERASE, 0);
+        emit (ACC_WRITE, NVMADDR, addr, 0);
+        emit (ACC_WRITE, NVMCONSET, PIC32_NVMCON_WR, 0);
+        emit (ACC_CHECK, NVMCON, 0, PIC32_NVMCON_WR);
+
+        nvm_operation (PIC32_NVMCON_PAGE_ERASE, addr, 0);
+        for (k=0; k<NVM_WORDS; k++) {
+            emit (ACC_WRITE, NVMDATA0, ~(addr + k*4), 0);
+            nvm_operation (PIC32_NVMCON_WORD_PGM, addr + k*4, 0);
+        }
+        emit (ACC_WRITE, NVMDATA0, 0xffff0000, 0);     /* only clears bits */
+        nvm_operation (PIC32_NVMCON_WORD_PGM, addr, 0);
+        emit (ACC_WRITE, NVMSRCADDR, src, 0);
+        nvm_operation (PIC32_NVMCON_ROW_PGM, addr + NVM_ROW, 0);
+
+        nvm_operation (PIC32_NVMCON_WORD_PGM, DATA_MEM_START, 1);
+        nvm_operation (PIC32_NVMCON_NOP, 0, 0);
+    }
+    emit (ACC_WRITE, NVMCON, 0, 0);
+}
+
+/*
+ * Check contents of the last page, and that only
+ * the modified ranges were written.
+ */
+static void nvm_done (unsigned count)
+{
+    unsigned char *page = (unsigned char*) progmem + nvm_page * NVM_PAGE;
+    unsigned addr = PROGRAM_FLASH_START + nvm_page * NVM_PAGE;
+    unsigned k, expect;
+
+    for (k=0; k<NVM_PAGE; k++) {
+        if (k < 4)
+            expect = (~addr & 0xffff0000) >> k * 8;
+        else if (k < NVM_WORDS*4)
+            expect = ~(addr + (k & ~3)) >> (k & 3) * 8;
+        else if (k >= NVM_ROW && k < 2*NVM_ROW)
+            expect = sd_pattern (k - NVM_ROW);
+        else
+            expect = 0xff;
+        if (page[k] != (expect & 0xff)) {
+            fprintf (stderr, "nvm: byte %02x at %08x, expected %02x\n",
+                page[k], addr + k, expect & 0xff);
+            nerrors++;
+            break;
+        }
+    }
+    if (nvm_written != (uint64_t) count * (NVM_PAGE + NVM_WORDS*4 + 4 + NVM_ROW)) {
+        fprintf (stderr, "nvm: %llu bytes of flash written, expected %llu\n",
+            (unsigned long long) nvm_written,
+            (unsigned long long) count * (NVM_PAGE + NVM_WORDS*4 + 4 + NVM_ROW));
+        nerrors++;
+    }
+    nvm_written = 0;
+}
+
+/*
+ * SDXC card: check the card type, write and read back blocks
+ * above 4 Gbytes.  Sparse image file is used.
+ */
+static void sdhc_workload (unsigned count)
+{
+    unsigned i, k, block, seed = 1;
+    int fd;
+
+    if (! sdhc_created) {
+        fd = mkstemp (sdhc_file);
+        if (fd < 0 || ftruncate (fd, (off_t) SDHC_GBYTES << 30) < 0) {
+            perror (sdhc_file);
+            exit (1);
+        }
+        close (fd);
+        sdhc_created = 1;
+    }
+    sdcard_init (0, "sd0", sdhc_file, sd_port, sd_pin);
+
+    sd_enable();
+    sd_command (0x40+8, 0x1aa);         /* CMD8: version 2 card */
+    sd_byte (0xff, 1, 0x01);
+    sd_byte (0xff, 1, 0x00);
+    sd_byte (0xff, 1, 0x00);
+    sd_byte (0xff, 1, 0x01);
+    sd_byte (0xff, 1, 0xaa);
+    emit (ACC_WRITE, sd_latset, sd_cs, 0);
+    sd_command (0x40+58, 0);            /* CMD58: OCR with CCS bit */
+    sd_byte (0xff, 1, 0x00);
+    sd_byte (0xff, 1, 0xc0);
+    sd_byte (0xff, 1, 0xff);
+    sd_byte (0xff, 1, 0x80);
+    sd_byte (0xff, 1, 0x00);
+    emit (ACC_WRITE, sd_latset, sd_cs, 0);
+    for (i=0; i<count; i++) {
+        seed = seed * 1103515245 + 12345;
+        block = (4u << 21) + seed % ((SDHC_GBYTES - 4) << 21);
+        sdhc_block = block;
+
+        /* Write block, addressed by number. */
+        sd_command (0x40+24, block);
+        sd_byte (0xff, 1, 0);
+        sd_byte (0xfe, 0, 0);
+        for (k=0; k<512; k++)
+            sd_byte (sd_pattern (block*512 + k), 0, 0);
+        sd_byte (0xff, 0, 0);
+        sd_byte (0xff, 0, 0);
+        sd_byte (0xff, 1, 0x05);
+        emit (ACC_WRITE, sd_latset, sd_cs, 0);
+
+        /* Read it back. */
+        sd_command (0x40+17, block);
+        sd_byte (0xff, 1, 0);
+        sd_byte (0xff, 1, 0xfe);
+        for (k=0; k<512; k++)
+            sd_byte (0xff, 1, sd_pattern (block*512 + k));
+        sd_byte (0xff, 0, 0);
+        sd_byte (0xff, 0, 0);
+        emit (ACC_WRITE, sd_latset, sd_cs, 0);
+    }
+    emit (ACC_WRITE, sd_con, 0, 0);
+}
+
+/*
+ * Check the last block in the image file, and return
+ * the standard card for other workloads.
+ */
+static void sdhc_done (unsigned count)
+{
+    unsigned char buf [512];
+    unsigned k;
+    int fd;
+
+    fd = open (sdhc_file, O_RDONLY);
+    if (fd < 0 || pread (fd, buf, 512, (off_t) sdhc_block * 512) != 512) {
+        perror (sdhc_file);
+        exit (1);
+    }
+    close (fd);
+    for (k=0; k<512; k++) {
+        if (buf[k] != sd_pattern (sdhc_block*512 + k)) {
+            fprintf (stderr, "sdhc: bad data in block %u of image file\n", sdhc_block);
+            nerrors++;
+            break;
+        }
+    }
+    sdcard_init (0, "sd0", sd_file, sd_port, sd_pin);
+}
+
+/*
+ * Setup SD card with a given image, or create
+ * an image file with known contents.
+ */
+static void sdcard_setup (const char *image)
+{
+    static unsigned char buf [512];
+    int fd, cs_port, cs_pin;
+    unsigned block, k;
+
+#if defined EXPLORER16
+    sdcard_spi_port = 0;                        // SD card at SPI1,
+    cs_port = 1; cs_pin = 1;                    // select0 at B1
+#elif defined MAX32
+    sdcard_spi_port = 3;                        // SD card at SPI4,
+    cs_port = 3; cs_pin = 3;                    // select0 at D3
+#elif defined MAXIMITE
+    sdcard_spi_port = 3;                        // SD card at SPI4,
+    cs_port = 4; cs_pin = 0;                    // select0 at E0
+#elif defined WIFIRE
+    sdcard_spi_port = 2;                        // SD card at SPI3,
+    cs_port = 2; cs_pin = 3;                    // select0 at C3
+#elif defined MEBII
+    sdcard_spi_port = 1;                        // SD card at SPI2,
+    cs_port = 1; cs_pin = 14;                   // select0 at B14
+#else
+#error Unknown board type.
+#endif
+    if (! image) {
+        fd = mkstemp (sd_file);
+        if (fd < 0) {
+            perror (sd_file);
+            exit (1);
+        }
+        sd_created = 1;
+        for (block=0; block<SD_BLOCKS; block++) {
+            for (k=0; k<512; k++)
+                buf[k] = sd_pattern (block*512 + k);
+            if (write (fd, buf, 512) != 512) {
+                perror (sd_file);
+                exit (1);
+            }
+        }
+        close (fd);
+        image = sd_file;
+    }
+    sdcard_init (0, "sd0", image, cs_port, cs_pin);
+
+    sd_port = cs_port;
+    sd_pin = cs_pin;
+    sd_con = spi_con [sdcard_spi_port];
+    sd_stat = sd_con + 0x10;
+    sd_buf = sd_con + 0x20;
+    sd_latclr = LATACLR + cs_port * GPIO_STRIDE;
+    sd_latset = LATASET + cs_port * GPIO_STRIDE;
+    sd_cs = 1 << cs_pin;
+    fl_cs = 1 << (cs_pin + 1);
+}
+
+static char *uart_name[6] = {
+    "uart1", "uart2", "uart3", "uart4", "uart5", "uart6",
+};
+
+static void sdcard_cleanup()
+{
+    if (sd_created)
+        unlink (sd_file);
+    if (sdhc_created)
+        unlink (sdhc_file);
+    if (fl_created)
+        unlink (fl_file);
+}
+
+/*
+ * Reset all peripherals, as on simulator startup.
+ */
+static void reset()
+{
+    cycles = 0;
+#if defined PIC32MX7
+    io_init (bootmem, 0xffffff7f, 0x5bfd6aff, 0xd979f8f9, 0xffff0722,
+        0x04307053, 0x01453320);
+#elif defined WIFIRE
+    io_init (bootmem, 0xfffffff7, 0x7f743cb9, 0xfff9b11a, 0xbeffffff,
+        0x4510e053, 0x00001120);
+#elif defined MEBII
+    io_init (bootmem, 0x7fffffdb, 0x0000fc81, 0x3ff8b11a, 0x86ffffff,
+        0x45127053, 0x00001120);
+#else
+    io_init (bootmem, 0x7fffffdb, 0x0000fc81, 0x3ff8b11a, 0x86ffffff,
+        0x35113053, 0x00001120);
+#endif
+}
+
+static const struct {
+    const char *name;
+    void (*build) (unsigned count);
+    void (*done) (unsigned count);      // final check, or 0
+    unsigned count;                     // default number of iterations
+} workload[] = {
+    { "gpio",   gpio_workload,   0,         100000 },
+    { "timer",  timer_workload,  timer_done, 20000 },
+    { "uart",   uart_workload,   uart_done, 20000 },
+    { "sdcard", sdcard_workload, 0,         400 },
+    { "sdmulti", sdmulti_workload, 0,       50 },
+    { "sdwrite", sdwrite_workload, 0,       20 },
+    { "sdbusy", sdbusy_workload, sdbusy_done, 50 },
+    { "spiflash", spiflash_workload, 0,     10 },
+    { "nvm",    nvm_workload,    nvm_done,  20 },
+    { "sdhc",   sdhc_workload,   sdhc_done, 100 },
+    { 0 },
+};
+
+/*
+ * Build and replay a workload, print the results.
+ */
+static void run (int w, unsigned scale)
+{
+    struct timespec t0, t1;
+    uint64_t nsec;
+    unsigned errors = nerrors;
+
+    stream_len = 0;
+    workload[w].build (workload[w].count * scale);
+    reset();
+    naccess = 0;
+    stat_vtty_out = 0;
+
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    replay();
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    nsec = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+
+    if (workload[w].done)
+        workload[w].done (workload[w].count * scale);
+    printf ("%-8s %10llu %10llu %10.1f %10.3f  %s\n", workload[w].name,
+        (unsigned long long) naccess, (unsigned long long) cycles,
+        naccess ? (double) nsec / naccess : 0, nsec / 1e9,
+        nerrors == errors ? "ok" : "FAILED");
+}
+
+/*
+ * Replay I/O accesses recorded by the simulator.
+ * Reads are done the same way as in mem_read().
+ */
+static void replay_file (const char *filename)
+{
+    struct timespec t0, t1;
+    uint64_t nsec, nrec = 0;
+    mmio_t rec;
+    unsigned offset, value, *bufp;
+    const char *name;
+    char ch;
+    int more;
+
+    mmio_replay_open (filename);
+    reset();
+    naccess = 0;
+
+    clock_gettime (CLOCK_MONOTONIC, &t0);
+    more = mmio_replay_next (&rec);
+    while (more) {
+        nrec++;
+        cycles = rec.cycles;
+        offset = rec.addr & 0xfffff;
+        switch (rec.type) {
+        case MMIO_READ:
+            naccess++;
+            switch (rec.size) {
+            case 1:
+                bufp = &iomem[offset >> 2];
+                value = io_read32 (rec.addr, bufp, &name) >> (offset & 3) * 8;
+                value &= 0xff;
+                break;
+            case 2:
+                bufp = (unsigned*) ((char*) iomem + (offset & ~1));
+                value = io_read32 (rec.addr, bufp, &name);
+                if (offset & 1)
+                    value >>= 16;
+                value &= 0xffff;
+                break;
+            default:
+                bufp = &iomem[offset >> 2];
+                value = io_read32 (rec.addr, bufp, &name);
+                break;
+            }
+            if (value != rec.value) {
+                if (nerrors++ < 10)
+                    fprintf (stderr, "Record %llu, cycle %llu: read %0*x from %08x, recorded %0*x\n",
+                        (unsigned long long) nrec, (unsigned long long) cycles,
+                        rec.size * 2, value, rec.addr, rec.size * 2, rec.value);
+            }
+            break;
+        case MMIO_WRITE:
+            naccess++;
+            io_write32 (rec.addr, &iomem[offset >> 2], rec.value, &name);
+            break;
+        case MMIO_SYNC:
+            /* End of quantum: same actions as in the main loop. */
+            if (cycles >= event_next)
+                event_run();
+            while ((more = mmio_replay_next (&rec)) && rec.type == MMIO_INPUT) {
+                nrec++;
+                ch = rec.value;
+                vtty_send (rec.addr, &ch, 1);
+            }
+            uart_poll();
+            continue;
+        case MMIO_INPUT:
+            /* Input in an idle quantum, which has no SYNC record:
+             * deliver the group and poll, as the main loop did. */
+            ch = rec.value;
+            vtty_send (rec.addr, &ch, 1);
+            while ((more = mmio_replay_next (&rec)) && rec.type == MMIO_INPUT) {
+                nrec++;
+                ch = rec.value;
+                vtty_send (rec.addr, &ch, 1);
+            }
+            uart_poll();
+            continue;
+        }
+        more = mmio_replay_next (&rec);
+    }
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    nsec = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+
+    printf ("%-8s %10llu %10llu %10.1f %10.3f  %s\n", "replay",
+        (unsigned long long) naccess, (unsigned long long) cycles,
+        naccess ? (double) nsec / naccess : 0, nsec / 1e9,
+        nerrors == 0 ? "ok" : "DIVERGED");
+}
+
+static void usage()
+{
+    int w;
+
+    fprintf (stderr, "Benchmark and test of peripheral models\n");
+    fprintf (stderr, "Usage:\n");
+    fprintf (stderr, "    iobench [-n count] [-c cycles] [-s] [workload...]\n");
+    fprintf (stderr, "    iobench -r file [-d sd.img] [-s]\n");
+    fprintf (stderr, "Options:\n");
+    fprintf (stderr, "    -n count     multiply number of iterations by count\n");
+    fprintf (stderr, "    -c cycles    CPU cycles between I/O accesses (default %u)\n",
+        cycles_per_access);
+    fprintf (stderr, "    -r file      replay I/O accesses recorded by simulator\n");
+    fprintf (stderr, "    -d sd.img    SD card image for replay\n");
+    fprintf (stderr, "    -s           print statistics of SD card access\n");
+    fprintf (stderr, "Workloads:\n   ");
+    for (w=0; workload[w].name; w++)
+        fprintf (stderr, " %s", workload[w].name);
+    fprintf (stderr, "\n");
+    exit (1);
+}
+
+int main (int argc, char **argv)
+{
+    unsigned scale = 1;
+    const char *replay_name = 0, *sd_image = 0;
+    int w, i, sd_stats = 0;
+
+    for (;;) {
+        switch (getopt (argc, argv, "n:c:r:d:s")) {
+        case EOF:
+            break;
+        case 'n':
+            scale = strtoul (optarg, 0, 0);
+            continue;
+        case 'c':
+            cycles_per_access = strtoul (optarg, 0, 0);
+            continue;
+        case 'r':
+            replay_name = optarg;
+            continue;
+        case 'd':
+            sd_image = optarg;
+            continue;
+        case 's':
+            sd_stats++;
+            continue;
+        default:
+            usage();
+        }
+        break;
+    }
+    argc -= optind;
+    argv += optind;
+    if (scale == 0 || cycles_per_access == 0)
+        usage();
+
+    /* Erased flash, as in the simulator. */
+    memset (progmem, 0xff, sizeof(progmem));
+    memset (bootmem, 0xff, sizeof(bootmem));
+
+    sdcard_setup (sd_image);
+    atexit (sdcard_cleanup);
+    for (i=0; i<6; i++)
+        vtty_create (i, uart_name[i], "none");
+
+    printf ("Workload   Accesses     Cycles  ns/access   Time, sec\n");
+    if (replay_name) {
+        replay_file (replay_name);
+    } else if (argc == 0) {
+        for (w=0; workload[w].name; w++)
+            run (w, scale);
+    } else {
+        for (i=0; i<argc; i++) {
+            for (w=0; workload[w].name; w++)
+                if (strcmp (argv[i], workload[w].name) == 0)
+                    break;
+            if (! workload[w].name)
+                usage();
+            run (w, scale);
+        }
+    }
+    if (sd_stats)
+        sdcard_stats_print (stdout);
+    if (nerrors > 0) {
+        printf ("%u %s\n", nerrors, replay_name ? "reads diverged" : "checks failed");
+        return 1;
+    }
+    return 0;
+}
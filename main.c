@@ -22,16 +22,20 @@
  * this software.
  */
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
 #include "icm/icmCpuManager.h"
 #include "globals.h"
 
 char *progname;                         // base name of current program
 
-static uint32_t progmem [PROGRAM_FLASH_SIZE/4];
+static uint32_t progmem_buf [PROGRAM_FLASH_SIZE/4];
+static uint32_t *progmem = progmem_buf; // program flash, or mapped image
 static uint32_t bootmem [BOOT_FLASH_SIZE/4];
 static char datamem [DATA_MEM_SIZE];    // storage for RAM area
 uint32_t iomem [0x100000/4];            // backing storage for I/O area
@@ -44,6 +48,35 @@ icmProcessorP processor;                // top level processor object
 icmNetP eic_ripl;                       // EIC request priority level
 icmNetP eic_vector;                     // EIC vector number
 
+static Uns64 icount_base;               // instruction count at start of quantum
+static Uns64 cycles_base;               // cpu cycles at start of quantum
+
+static int realtime;                    // real time mode enabled
+static double realtime_mhz;             // pace simulation to this CPU clock
+static struct timespec realtime_start;  // wall time at start of simulation
+static struct timespec realtime_report; // when to report the drift next time
+
+#define SPIN_THRESHOLD  16              // identical reads to detect a busy loop
+#define SPIN_WINDOW     32              // max instructions per loop iteration
+#define FASTFWD_MAX_USEC 1000           // max simulated time skipped at once
+
+static int fastfwd;                     // skip busy-wait loops
+static int spin_detected;               // busy loop found in current quantum
+static unsigned spin_count;             // number of identical I/O reads
+static Uns32 spin_pc;                   // PC of last I/O read
+static Uns32 spin_addr;                 // address of last I/O read
+static Uns32 spin_data;                 // value of last I/O read
+static Uns64 spin_icount;               // instruction count at last I/O read
+static Uns64 fastfwd_cycles;            // total cycles skipped
+
+static int sim_started;                 // simulation is running
+static volatile sig_atomic_t kill_signal; // signal to stop the simulation
+static int exit_code = SIM_ERROR;       // exit status of simulator
+static char exit_reason [256];          // why the simulation stopped
+static const char *summary_file;        // JSON summary at exit
+static int result_reg;                  // test result register enabled
+static Uns32 result_addr;               // address of test result register
+
 static void usage()
 {
 #ifdef PIC32MX7
@@ -63,6 +96,40 @@ static void usage()
     icmPrintf("    -m           enable magic opcodes\n");
     icmPrintf("    -s           stop on software reset\n");
     icmPrintf("    -c           enable cache\n");
+    icmPrintf("    -u N:backend connect UART N to stdio, tcp:port, unix:path,\n");
+    icmPrintf("                 pty, file:path or none (repeat for other UARTs)\n");
+    icmPrintf("    --realtime[=MHz] run in real time, at SYSCLK or given CPU clock\n");
+    icmPrintf("    --script=file   run console script (send, expect, timeout, exit)\n");
+    icmPrintf("    --capture=file  log UART output with cycle counts\n");
+    icmPrintf("    --infinite-baud transfer UART data with no delay\n");
+    icmPrintf("    --record=file   record UART input for deterministic replay\n");
+    icmPrintf("    --replay=file   replay UART input from file\n");
+    icmPrintf("    --fast-forward  skip busy-wait loops to next peripheral event\n");
+    icmPrintf("    --symbols=file  symbol table of firmware, in nm format\n");
+    icmPrintf("    --intercept=memcpy,memmove,bcopy,memset,bzero\n");
+    icmPrintf("                    perform these routines natively\n");
+    icmPrintf("    --intercept-check compare intercepted routines with simulation\n");
+    icmPrintf("    --semihost[=dir] enable file and console I/O via sdbbp instruction\n");
+    icmPrintf("    --result-reg=addr test passes when 0 is written to this I/O address,\n");
+    icmPrintf("                    fails on other value\n");
+    icmPrintf("    --pass=regex    test passes when console output matches\n");
+    icmPrintf("    --fail=regex    test fails when console output matches\n");
+    icmPrintf("    --summary=file  write JSON summary at exit\n");
+    icmPrintf("    --stats[=file]  print statistics at exit and on SIGUSR1,\n");
+    icmPrintf("                    append JSON record to file every second\n");
+    icmPrintf("    --mmio-record=file record all I/O accesses, for replay by iobench\n");
+    icmPrintf("    --sd-sync=mode  flush SD card writes to disk: none, exit or fsync\n");
+    icmPrintf("    --sd-profile=[N:]name SD card timing: none, class4, class10, uhs,\n");
+    icmPrintf("                    or read,write,erase time in usec\n");
+    icmPrintf("    --spi-flash=file SPI flash image, connected by --spi=flash:N:pin\n");
+    icmPrintf("    --spi=dev:N:pin attach SPI device (sd0, sd1, flash) to SPI port N,\n");
+    icmPrintf("                    with chip select at GPIO pin, like C4\n");
+    icmPrintf("    --flash=file    program flash image, persistent across runs\n");
+    icmPrintf("Exit status:\n");
+    icmPrintf("    0 - test passed, 1 - error, 2 - script timeout, 3 - test failed,\n");
+    icmPrintf("    4 - instruction limit, 5 - halted, 6 - software reset,\n");
+    icmPrintf("    7 - unsupported register, 8 - machine check, 9 - killed,\n");
+    icmPrintf("    10 - finished by model, 11 - interrupted\n");
     exit(-1);
 }
 
@@ -85,20 +152,103 @@ static void print_user_attribute (const char *owner, const char *name,
     }
 }
 
+//
+// Write a string to JSON file, with escapes.
+//
+static void json_string (FILE *fd, const char *str)
+{
+    putc ('"', fd);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\')
+            fprintf (fd, "\\%c", *str);
+        else if ((unsigned char) *str < ' ')
+            fprintf (fd, "\\u%04x", (unsigned char) *str);
+        else
+            putc (*str, fd);
+    }
+    putc ('"', fd);
+}
+
+//
+// Write a summary of the run in JSON format.
+//
+static void write_summary()
+{
+    struct timespec now;
+    double wall;
+    Uns64 icount, ncallbacks;
+    FILE *fd;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    wall = (now.tv_sec - realtime_start.tv_sec) +
+           (now.tv_nsec - realtime_start.tv_nsec) / 1e9;
+    icount = sim_started ? icmGetProcessorICount(processor) : 0;
+    ncallbacks = stat_io_read[0] + stat_io_read[1] + stat_io_read[2] +
+                 stat_io_write[0] + stat_io_write[1] + stat_io_write[2];
+
+    fd = fopen (summary_file, "w");
+    if (! fd) {
+        perror (summary_file);
+        return;
+    }
+    fprintf (fd, "{\"exit_code\": %d, \"reason\": ", exit_code);
+    json_string (fd, exit_reason);
+    fprintf (fd, ", \"instructions\": %llu, \"cycles\": %llu",
+        (unsigned long long) icount,
+        (unsigned long long) (sim_started ? cpu_cycles() : 0));
+    fprintf (fd, ", \"wall_time\": %.6f, \"mips\": %.3f",
+        wall, wall > 0 ? icount / wall / 1e6 : 0);
+    fprintf (fd, ", \"io_callbacks\": %llu, \"callbacks_per_sec\": %.0f}\n",
+        (unsigned long long) ncallbacks, wall > 0 ? ncallbacks / wall : 0);
+    fclose (fd);
+}
+
+//
+// Terminate the simulation with a given exit code.
+//
+void sim_exit (int code, const char *reason, ...)
+{
+    va_list args;
+
+    va_start (args, reason);
+    vsnprintf (exit_reason, sizeof(exit_reason), reason, args);
+    va_end (args);
+    exit_code = code;
+    exit (code);
+}
+
 void quit()
 {
+    if (fastfwd)
+        icmPrintf("Fast-forward: %llu cycles skipped\n",
+            (unsigned long long) fastfwd_cycles);
+    if (exit_reason[0])
+        icmPrintf("Exit %d: %s\n", exit_code, exit_reason);
+    if (summary_file)
+        write_summary();
+    if (sim_started)
+        stats_finish();
     icmPrintf("***** Stop *****\n");
     if (trace_flag)
         fprintf(stderr, "***** Stop *****\n");
     icmTerminate();
 }
 
-void killed(int sig)
+//
+// Signal handler: stop the simulation at the end of current quantum,
+// where exit handlers can safely run.  A second signal kills
+// the simulator immediately, in case the main loop is stuck.
+//
+static void killed(int sig)
 {
-    icmPrintf("\n***** Killed *****\n");
-    if (trace_flag)
-        fprintf(stderr, "\n***** Killed *****\n");
-    exit(1);
+    if (kill_signal) {
+        signal(sig, SIG_DFL);
+        raise(sig);
+        return;
+    }
+    kill_signal = sig;
+    if (processor)
+        icmYield(processor);
 }
 
 Uns64 read_reg (const char *name)
@@ -107,7 +257,7 @@ Uns64 read_reg (const char *name)
 
     if (! icmReadReg (processor, name, &value)) {
         fprintf(stderr, "%s: Unable to read register '%s'\n", __func__, name);
-        quit();
+        sim_exit(SIM_ERROR, "unable to read register '%s'", name);
     }
     return value;
 }
@@ -116,7 +266,123 @@ void write_reg (const char *name, Uns64 value)
 {
     if (! icmWriteReg (processor, name, &value)) {
         fprintf(stderr, "%s: Unable to write register '%s'\n", __func__, name);
-        quit();
+        sim_exit(SIM_ERROR, "unable to write register '%s'", name);
+    }
+}
+
+//
+// Convert virtual address range to host pointer.
+// Return 0 when the range is outside of RAM and flash.
+// Flash is not writable.
+//
+char *host_pointer (unsigned vaddr, unsigned len, int write)
+{
+    unsigned paddr;
+
+    if (vaddr >= 0xc0000000)
+        return 0;
+    if (vaddr >= 0x80000000)
+        paddr = vaddr & 0x1fffffff;     // kseg0 or kseg1
+    else
+        paddr = vaddr + 0x40000000;     // user segment, fixed mapping
+
+    if (paddr >= DATA_MEM_START &&
+        paddr + (uint64_t) len <= DATA_MEM_START + DATA_MEM_SIZE)
+        return datamem + paddr - DATA_MEM_START;
+
+#ifdef USER_MEM_START
+    if (paddr >= USER_MEM_START + 0x8000 &&
+        paddr + (uint64_t) len <= USER_MEM_START + DATA_MEM_SIZE)
+        return datamem + paddr - USER_MEM_START;
+#endif
+
+    if (write)
+        return 0;
+
+    if (IN_PROGRAM_MEM(paddr) &&
+        paddr + (uint64_t) len <= PROGRAM_FLASH_START + PROGRAM_FLASH_SIZE)
+        return (char*) progmem + paddr - PROGRAM_FLASH_START;
+
+    if (IN_BOOT_MEM(paddr) &&
+        paddr + (uint64_t) len <= BOOT_FLASH_START + BOOT_FLASH_SIZE)
+        return (char*) bootmem + paddr - BOOT_FLASH_START;
+
+    return 0;
+}
+
+//
+// Write data to simulated memory at a virtual address, on behalf
+// of the simulator (intercepted routines, semihosting, flash).
+// Write through the debug interface of the simulator: it updates
+// the native memory and discards translated code for the modified
+// range only, so the rest of memory keeps running at full speed.
+// Return 0 when the memory cannot be written.
+//
+int cpu_write_mem (unsigned vaddr, const void *data, unsigned nbytes)
+{
+    return icmWriteProcessorMemory (processor, vaddr, data, nbytes);
+}
+
+//
+// Modify contents of program or boot flash.
+//
+void cpu_flash_write (unsigned paddr, const void *data, unsigned nbytes)
+{
+    if (! cpu_write_mem (0xa0000000 | paddr, data, nbytes)) {
+        icmPrintf ("--- Cannot write %u bytes of flash at %#x\n", nbytes, paddr);
+    }
+}
+
+//
+// Number of CPU cycles simulated so far: executed instructions
+// plus the cycles spent halted on WAIT instruction.
+//
+uint64_t cpu_cycles()
+{
+    return cycles_base + icmGetProcessorICount(processor) - icount_base;
+}
+
+//
+// Difference between two time values, in nanoseconds.
+//
+static Int64 timespec_diff (const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec - b->tv_sec) * 1000000000LL + a->tv_nsec - b->tv_nsec;
+}
+
+//
+// Real time mode: keep the simulated CPU clock in pace with wall time.
+// Sleep when the simulation is ahead, report the drift when behind.
+//
+static void realtime_pace()
+{
+    struct timespec now, target;
+    Int64 sim_nsec, ahead;
+
+    if (realtime_mhz > 0)
+        sim_nsec = cpu_cycles() * 1000.0 / realtime_mhz;
+    else
+        sim_nsec = clock_nsec();
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    ahead = sim_nsec - timespec_diff (&now, &realtime_start);
+
+    if (ahead > 1000000) {
+        // More than 1 msec ahead: sleep until the wall time catches up.
+        target.tv_sec = realtime_start.tv_sec + sim_nsec / 1000000000;
+        target.tv_nsec = realtime_start.tv_nsec + sim_nsec % 1000000000;
+        if (target.tv_nsec >= 1000000000) {
+            target.tv_sec++;
+            target.tv_nsec -= 1000000000;
+        }
+        while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &target, 0) == EINTR)
+            continue;
+        return;
+    }
+    if (ahead < -100000000 && timespec_diff (&now, &realtime_report) >= 0) {
+        // More than 100 msec behind: report once per second.
+        fprintf (stderr, "--- Realtime: %.3f sec behind\n", -ahead / 1e9);
+        realtime_report = now;
+        realtime_report.tv_sec++;
     }
 }
 
@@ -131,8 +397,72 @@ static void machine_check()
     if (exc_code == 24) {
         // Machine check!
         dump_regs("MCheck");
-        quit();
+        sim_exit(SIM_MCHECK, "machine check");
+    }
+}
+
+//
+// Detect a busy-wait loop: the same instruction reads the same
+// peripheral register again and again, gets the same value,
+// and there are no writes to peripherals in between.
+// The loop can only exit after some peripheral event,
+// so stop the quantum and skip the time up to that event.
+//
+static void spin_check (icmProcessorP proc, Uns32 paddr, Uns32 data)
+{
+    Uns32 pc = icmGetPC(proc);
+    Uns64 icount = icmGetProcessorICount(proc);
+
+    if (pc != spin_pc || paddr != spin_addr || data != spin_data ||
+        icount - spin_icount > SPIN_WINDOW) {
+        spin_pc = pc;
+        spin_addr = paddr;
+        spin_data = data;
+        spin_count = 0;
+    } else if (++spin_count >= SPIN_THRESHOLD && event_next != EVENT_NEVER) {
+        spin_detected = 1;
+        icmYield(proc);
     }
+    spin_icount = icount;
+}
+
+//
+// Skip the cycles of a busy-wait loop, up to the nearest event.
+// The loop may wait for something else, like console input
+// or a GPIO pin, so no more than FASTFWD_MAX_USEC of simulated
+// time is skipped at once: the loop gets a chance to see
+// the change at least that often.
+// Core timer is advanced by the same amount, but not past
+// the Compare value, to keep the timer interrupt in place.
+// Return the number of skipped cycles.
+//
+static Uns32 fastfwd_skip()
+{
+    Uns64 skip, count, compare, max;
+    Uns32 ticks;
+
+    spin_detected = 0;
+    spin_count = 0;
+    if (event_next == EVENT_NEVER || event_next <= cycles_base)
+        return 0;
+
+    skip = event_next - cycles_base;
+    max = (Uns64) clock_sysclk() * FASTFWD_MAX_USEC / 1000000;
+    if (skip > max)
+        skip = max;
+
+    // Core timer counts at half the CPU clock.
+    if (icmReadReg(processor, "count", &count) &&
+        icmReadReg(processor, "compare", &compare)) {
+        ticks = (Uns32) compare - (Uns32) count;
+        if ((Uns64) ticks * 2 < skip)
+            skip = (Uns64) ticks * 2;
+        count += skip / 2;
+        icmWriteReg(processor, "count", &count);
+    }
+    cycles_base += skip;
+    fastfwd_cycles += skip;
+    return skip;
 }
 
 //
@@ -143,12 +473,12 @@ static void mem_read (icmProcessorP proc, Addr paddr, Uns32 bytes,
 {
     Uns32 offset = paddr & 0xfffff;
     const char *name = "???";
-    Uns32 data;
+    Uns32 data = 0;
 
     if (vaddr >= 0x80000000 && vaddr < IO_MEM_START + 0xa0000000U) {
         icmPrintf("--- I/O Read  %08x: incorrect virtual address %08x\n",
             (Uns32) paddr, (Uns32) vaddr);
-        icmExit(proc);
+        sim_exit(SIM_UNSUPPORTED, "I/O access at incorrect virtual address %08x", (Uns32) vaddr);
     }
 
     switch (bytes) {
@@ -162,6 +492,7 @@ static void mem_read (icmProcessorP proc, Addr paddr, Uns32 bytes,
             icmPrintf("--- I/O Read  %02x from %s\n", data, name);
         }
         *(Uns8*) value = data;
+        stat_io_read[0]++;
         break;
     case 2:
         data = io_read32 (paddr, (Uns32*) (user_data + (offset & ~1)), &name);
@@ -173,6 +504,7 @@ static void mem_read (icmProcessorP proc, Addr paddr, Uns32 bytes,
             icmPrintf("--- I/O Read  %04x from %s\n", data, name);
         }
         *(Uns16*) value = data;
+        stat_io_read[1]++;
         break;
     case 4:
         data = io_read32 (paddr, (Uns32*) (user_data + offset), &name);
@@ -180,12 +512,17 @@ static void mem_read (icmProcessorP proc, Addr paddr, Uns32 bytes,
             icmPrintf("--- I/O Read  %08x from %s\n", data, name);
         }
         *(Uns32*) value = data;
+        stat_io_read[2]++;
         break;
     default:
         icmPrintf("--- I/O Read  %08x: incorrect size %u bytes\n",
             (Uns32) paddr, bytes);
-        icmExit(proc);
+        sim_exit(SIM_UNSUPPORTED, "I/O access of incorrect size %u bytes", bytes);
     }
+    if (mmio_recording)
+        mmio_record (MMIO_READ, paddr, bytes, data);
+    if (fastfwd)
+        spin_check (proc, paddr, data);
     machine_check();
 }
 
@@ -201,7 +538,7 @@ static void mem_write (icmProcessorP proc, Addr paddr, Uns32 bytes,
     if (vaddr >= 0x80000000 && vaddr < IO_MEM_START + 0xa0000000U) {
         icmPrintf("--- I/O Read  %08x: incorrect virtual address %08x\n",
             (Uns32) paddr, (Uns32) vaddr);
-        icmExit(proc);
+        sim_exit(SIM_UNSUPPORTED, "I/O access at incorrect virtual address %08x", (Uns32) vaddr);
     }
 
     // Fetch data and align to word format.
@@ -222,10 +559,20 @@ static void mem_write (icmProcessorP proc, Addr paddr, Uns32 bytes,
     default:
         icmPrintf("--- I/O Write %08x: incorrect size %u bytes\n",
             (Uns32) paddr, bytes);
-        icmExit(proc);
+        sim_exit(SIM_UNSUPPORTED, "I/O access of incorrect size %u bytes", bytes);
+    }
+    stat_io_write[bytes >> 1]++;
+    if (result_reg && paddr == result_addr) {
+        // Test reports the result.
+        if (data == 0)
+            sim_exit(SIM_PASS, "test result register: pass");
+        sim_exit(SIM_FAIL, "test result register: fail, code %#x", data);
     }
+    if (mmio_recording)
+        mmio_record (MMIO_WRITE, paddr, bytes, data);
     io_write32 (paddr, (Uns32*) (user_data + (paddr & 0xffffc)),
         data, &name);
+    spin_count = 0;
     if (trace_flag && name != 0) {
         icmPrintf("--- I/O Write %08x to %s \n", data, name);
     }
@@ -266,6 +613,7 @@ void soft_irq1 (void *arg, Uns32 value)
 static void pause_idle()
 {
     static unsigned idle_timeout;
+    struct timespec t0, t1;
     fd_set rfds;
 
     if (idle_timeout > 0) {
@@ -275,7 +623,10 @@ static void pause_idle()
     idle_timeout = 2000;
 
     /* Wait for incoming data */
+    clock_gettime (CLOCK_MONOTONIC, &t0);
     vtty_wait (&rfds);
+    clock_gettime (CLOCK_MONOTONIC, &t1);
+    stat_idle_nsec += timespec_diff (&t1, &t0);
 }
 
 //
@@ -303,9 +654,41 @@ int main(int argc, char **argv)
     char *trace_filename = 0;
     const char *sd0_file = 0;
     const char *sd1_file = 0;
+    const char *spiflash_file = 0;
+    const char *uart_backend[6] = { 0 };
+    static char *uart_name[6] = {
+        "uart1", "uart2", "uart3", "uart4", "uart5", "uart6",
+    };
+    int unit, console;
+    char *endptr;
 
     for (;;) {
-        switch (getopt (argc, argv, "vmscgt:d:l:")) {
+        static const struct option long_options[] = {
+            { "realtime", optional_argument, 0, 'R' },
+            { "script",   required_argument, 0, 'S' },
+            { "capture",  required_argument, 0, 'C' },
+            { "infinite-baud", no_argument, 0, 'I' },
+            { "record",   required_argument, 0, 'r' },
+            { "replay",   required_argument, 0, 'p' },
+            { "fast-forward", no_argument, 0, 'F' },
+            { "symbols",  required_argument, 0, 'y' },
+            { "intercept", required_argument, 0, 'i' },
+            { "intercept-check", no_argument, 0, 'k' },
+            { "semihost", optional_argument, 0, 'H' },
+            { "result-reg", required_argument, 0, 'e' },
+            { "pass",     required_argument, 0, 'P' },
+            { "fail",     required_argument, 0, 'f' },
+            { "summary",  required_argument, 0, 'j' },
+            { "stats",    optional_argument, 0, 'T' },
+            { "mmio-record", required_argument, 0, 'M' },
+            { "sd-sync",  required_argument, 0, 'D' },
+            { "sd-profile", required_argument, 0, 'Q' },
+            { "spi",      required_argument, 0, 'b' },
+            { "spi-flash", required_argument, 0, 'x' },
+            { "flash",    required_argument, 0, 'N' },
+            { 0 },
+        };
+        switch (getopt_long (argc, argv, "vmscgt:d:l:u:", long_options, 0)) {
         case EOF:
             break;
         case 'v':
@@ -340,6 +723,93 @@ int main(int argc, char **argv)
         case 'l':
             limit_count = strtoull(optarg, 0, 0);
             continue;
+        case 'u':
+            unit = strtoul(optarg, &endptr, 10) - 1;
+            if (unit < 0 || unit >= 6 || *endptr != ':') {
+                icmPrintf("Bad UART backend: %s\n", optarg);
+                return -1;
+            }
+            uart_backend[unit] = endptr + 1;
+            continue;
+        case 'R':
+            realtime++;
+            if (! optarg)
+                continue;
+            realtime_mhz = strtod(optarg, 0);
+            if (realtime_mhz <= 0) {
+                icmPrintf("Bad CPU clock for real time mode: %s\n", optarg);
+                return -1;
+            }
+            continue;
+        case 'S':
+            script_load(optarg);
+            continue;
+        case 'C':
+            uart_capture_open(optarg);
+            continue;
+        case 'I':
+            uart_infinite_baud++;
+            continue;
+        case 'r':
+            record_open(optarg);
+            continue;
+        case 'p':
+            replay_open(optarg);
+            continue;
+        case 'F':
+            fastfwd++;
+            continue;
+        case 'y':
+            intercept_symbols(optarg);
+            continue;
+        case 'i':
+            intercept_add(optarg);
+            continue;
+        case 'k':
+            intercept_check++;
+            continue;
+        case 'H':
+            semihost_open(optarg);
+            continue;
+        case 'e':
+            result_addr = strtoul(optarg, &endptr, 0) & 0x1fffffff;
+            if (*endptr || result_addr < IO_MEM_START ||
+                result_addr >= IO_MEM_START + IO_MEM_SIZE) {
+                icmPrintf("Bad test result register: %s\n", optarg);
+                return -1;
+            }
+            result_reg++;
+            continue;
+        case 'P':
+            script_pattern(optarg, 0);
+            continue;
+        case 'f':
+            script_pattern(optarg, 1);
+            continue;
+        case 'j':
+            summary_file = optarg;
+            continue;
+        case 'T':
+            stats_open(optarg);
+            continue;
+        case 'M':
+            mmio_record_open(optarg);
+            continue;
+        case 'D':
+            sdcard_sync_mode(optarg);
+            continue;
+        case 'Q':
+            sdcard_profile(optarg);
+            continue;
+        case 'b':
+            spi_config(optarg);
+            continue;
+        case 'x':
+            spiflash_file = optarg;
+            continue;
+        case 'N':
+            progmem = nvm_image(optarg);
+            continue;
         default:
             usage ();
         }
@@ -359,7 +829,10 @@ int main(int argc, char **argv)
     atexit(quit);
 
     // Use ^\ to kill the simulation.
+    // Summary, statistics and SD card data are still saved at exit.
     signal(SIGQUIT, killed);
+    signal(SIGTERM, killed);
+    signal(SIGINT, killed);
 
     //
     // Setup the configuration attributes for the MIPS model
@@ -492,6 +965,11 @@ int main(int argc, char **argv)
     icmMapNativeMemory (bus, ICM_PRIV_RWX, USER_MEM_START + 0x8000,
         USER_MEM_START + DATA_MEM_SIZE - 1, datamem + 0x8000);
 #endif
+    // Erased flash reads as all ones, as on the chip: programming
+    // by NVMCON clears bits of the erased state.
+    memset (progmem_buf, 0xff, sizeof(progmem_buf));
+    memset (bootmem, 0xff, sizeof(bootmem));
+
     // Program memory.
     icmMapNativeMemory (bus, ICM_PRIV_RX, PROGRAM_FLASH_START,
         PROGRAM_FLASH_START + PROGRAM_FLASH_SIZE - 1, progmem);
@@ -549,17 +1027,34 @@ int main(int argc, char **argv)
 #endif
     sdcard_init (0, "sd0", sd0_file, cs0_port, cs0_pin);
     sdcard_init (1, "sd1", sd1_file, cs1_port, cs1_pin);
+    record_sdcard (0, sd0_file);
+    record_sdcard (1, sd1_file);
+    if (spiflash_file)
+        spiflash_init (spiflash_file);
 
     //
-    // Create console port.
+    // Create console port, and other UARTs given by -u options.
     //
 #if defined EXPLORER16 && defined PIC32MX7
-    vtty_create (1, "uart2", 0);                // console on UART2
+    console = 1;                                // console on UART2
 #elif defined WIFIRE
-    vtty_create (3, "uart4", 0);                // console on UART4
+    console = 3;                                // console on UART4
 #else
-    vtty_create (0, "uart1", 0);                // console on UART1
+    console = 0;                                // console on UART1
 #endif
+    if (! uart_backend[console]) {
+        // Use the terminal, unless it's taken by another UART.
+        uart_backend[console] = "stdio";
+        for (unit=0; unit<6; unit++) {
+            if (unit != console && uart_backend[unit] &&
+                strcmp(uart_backend[unit], "stdio") == 0)
+                uart_backend[console] = 0;
+        }
+    }
+    for (unit=0; unit<6; unit++) {
+        if (uart_backend[unit])
+            vtty_create (unit, uart_name[unit], uart_backend[unit]);
+    }
     vtty_init();
 
     //
@@ -604,6 +1099,12 @@ int main(int argc, char **argv)
         if (stop_on_reset)
             icmPrintf("Stop: on software reset\n");
     }
+    if (realtime) {
+        if (realtime_mhz > 0)
+            icmPrintf("Real time: %g MHz\n", realtime_mhz);
+        else
+            icmPrintf("Real time: %g MHz\n", clock_sysclk() / 1e6);
+    }
 
     // Limit the simulation to a given number of instructions.
     if (limit_count > 0) {
@@ -627,6 +1128,8 @@ int main(int argc, char **argv)
     //
     // Do a simulation run
     //
+    intercept_setup();
+    semihost_setup();
     icmSetPC(processor, 0xbfc00000);
     icmPrintf("\n***** Start '%s' *****\n", cpu_type);
     if (trace_flag)
@@ -635,37 +1138,113 @@ int main(int argc, char **argv)
     // Run the processor one instruction at a time until finished
     icmStopReason stop_reason;
     Uns32 chunk = 100;
+    clock_gettime (CLOCK_MONOTONIC, &realtime_start);
+    realtime_report = realtime_start;
+    stats_start();
+    sim_started = 1;
     do {
-        // simulate fixed number of instructions
-        stop_reason = icmSimulate(processor, chunk);
+        // simulate fixed number of instructions,
+        // or up to the nearest scheduled event
+        Uns32 quantum = chunk;
+        if (event_next - cycles_base < quantum)
+            quantum = (event_next > cycles_base) ? event_next - cycles_base : 1;
+        if (limit_count > 0 &&
+            (Uns64) limit_count - icmGetProcessorICount(processor) < quantum)
+            quantum = limit_count - icmGetProcessorICount(processor);
+
+        icount_base = icmGetProcessorICount(processor);
+        stop_reason = icmSimulate(processor, quantum);
+
+        // Idle cycles on WAIT are counted up to the end of quantum.
+        if (stop_reason == ICM_SR_HALT)
+            cycles_base += quantum;
+        else
+            cycles_base += icmGetProcessorICount(processor) - icount_base;
+        icount_base = icmGetProcessorICount(processor);
+
+        if (stop_reason == ICM_SR_BP_ADDRESS) {
+            /* Semihosting call, or entry to intercepted routine. */
+            Uns32 cycles;
+
+            if (! semihost_breakpoint(&cycles))
+                cycles = intercept_breakpoint();
+
+            cycles_base += cycles;
+            icount_base = icmGetProcessorICount(processor);
+            stop_reason = ICM_SR_SCHED;
+        }
+
 	if (stop_reason == ICM_SR_HALT) {
 	    /* Suspended on WAIT instruction. */
 	    if (! (read_reg ("status") & 1)) {
 	        /* Interrupts disabled - halt simulation. */
-	        break;
+	        sim_exit(SIM_HALT, "WAIT with interrupts disabled");
             }
 	    stop_reason = ICM_SR_SCHED;
 
-	    if (! uart_active())
+	    if (! uart_active() && ! realtime && ! script_enabled &&
+                ! replay_enabled)
 		pause_idle();
 	}
+        if (stop_reason == ICM_SR_YIELD) {
+            /* Quantum stopped early by busy loop detector, or signal. */
+            stop_reason = ICM_SR_SCHED;
+        }
+        if (kill_signal) {
+            icmPrintf("\n***** Killed *****\n");
+            if (trace_flag)
+                fprintf(stderr, "\n***** Killed *****\n");
+            sim_exit(SIM_KILLED, "killed by signal %d", kill_signal);
+        }
         machine_check();
 
+        // Busy-wait loop detected: skip to the nearest event.
+        if (spin_detected)
+            fastfwd_skip();
+
+        if (mmio_recording)
+            mmio_record_sync();
+
+        if (cycles_base >= event_next)
+            event_run();
+
+        if (realtime)
+            realtime_pace();
+
+        if (script_enabled)
+            script_poll();
+
+        stats_poll();
+
 	// poll uarts
 	uart_poll();
 
-        if (limit_count > 0) {
-            limit_count -= chunk;
-            if (limit_count <= 0) {
-                icmPrintf("\n***** Limit reached *****\n");
-                break;
-            }
+        // Only executed instructions count against the limit:
+        // not idle, skipped or intercepted cycles.
+        if (limit_count > 0 &&
+            icmGetProcessorICount(processor) >= (Uns64) limit_count) {
+            icmPrintf("\n***** Limit reached *****\n");
+            sim_exit(SIM_LIMIT, "instruction limit reached");
         }
     } while (stop_reason == ICM_SR_SCHED);
 
     //
-    // quit() implicitly called on return
+    // quit() implicitly called on exit.
+    // A passed test exits from the test result register or
+    // from semihosting; any other stop is not a pass.
     //
+    switch (stop_reason) {
+    case ICM_SR_EXIT:
+    case ICM_SR_FINISH:
+        sim_exit(SIM_FINISHED, "finished by model");
+        break;
+    case ICM_SR_INTERRUPT:
+        sim_exit(SIM_INTERRUPTED, "interrupted");
+        break;
+    default:
+        sim_exit(SIM_ERROR, "stopped, reason %d", stop_reason);
+        break;
+    }
     return 0;
 }
 
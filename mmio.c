@@ -0,0 +1,216 @@
+/*
+ * Recording of I/O accesses to a file, for offline replay.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * File starts with a text line "pic32sim-mmio 1 mx7" or "pic32sim-mmio 1 mz",
+ * followed by binary records.  First byte of a record has the type
+ * in bits 3:2 and the access size (0 - byte, 1 - halfword, 2 - word)
+ * in bits 1:0.  Numbers are encoded as unsigned LEB128: seven bits
+ * per byte, low bits first, bit 7 set when more bytes follow.
+ *
+ *      READ    - cycles delta, address offset, value read by CPU
+ *      WRITE   - cycles delta, address offset, word passed to io_write32()
+ *      SYNC    - cycles delta: end of simulation quantum,
+ *                when event_run() and uart_poll() are called
+ *      INPUT   - UART number and input byte, delivered by uart_poll()
+ *
+ * Cycle count is given as a difference from the previous record.
+ * Address offset is relative to IO_MEM_START.  Read address is exactly
+ * the one given to mem_read(), and may be unaligned for bytes and
+ * halfwords.  Write address is aligned to a word, and the value
+ * is shifted to the proper byte lanes, as io_write32() gets it.
+ *
+ * SYNC records are written only for quanta with some I/O activity,
+ * with expired events or with busy UARTs: other quanta do not change
+ * the state of peripherals.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "globals.h"
+
+#ifdef PIC32MX7
+#   define MMIO_CPU     "mx7"
+#endif
+#ifdef PIC32MZ
+#   define MMIO_CPU     "mz"
+#endif
+#define MMIO_SIGNATURE  "pic32sim-mmio 1 " MMIO_CPU
+
+int mmio_recording;                     /* recording I/O accesses */
+
+static FILE *mmio_file;                 /* record or replay file */
+static char mmio_buf[256*1024];         /* stdio buffer */
+static uint64_t last_cycles;            /* cycle count of previous record */
+static int active;                      /* records written in current quantum */
+
+static void put_number (uint64_t val)
+{
+    while (val >= 0x80) {
+        putc ((val & 0x7f) | 0x80, mmio_file);
+        val >>= 7;
+    }
+    putc (val, mmio_file);
+}
+
+static int get_number (uint64_t *valp)
+{
+    uint64_t val = 0;
+    int c, shift = 0;
+
+    do {
+        c = getc (mmio_file);
+        if (c < 0)
+            return 0;
+        val |= (uint64_t) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    *valp = val;
+    return 1;
+}
+
+/*
+ * Flush the record file at exit.
+ */
+static void mmio_close()
+{
+    fclose (mmio_file);
+    mmio_file = 0;
+}
+
+/*
+ * Start recording I/O accesses to a file.
+ */
+void mmio_record_open (const char *filename)
+{
+    mmio_file = fopen (filename, "w");
+    if (! mmio_file) {
+        perror (filename);
+        exit (1);
+    }
+    setvbuf (mmio_file, mmio_buf, _IOFBF, sizeof(mmio_buf));
+    fprintf (mmio_file, "%s\n", MMIO_SIGNATURE);
+    mmio_recording = 1;
+    atexit (mmio_close);
+}
+
+/*
+ * Log a read or write access.
+ */
+void mmio_record (int type, unsigned addr, unsigned size, unsigned value)
+{
+    uint64_t now = cpu_cycles();
+
+    putc (type << 2 | (size >> 1), mmio_file);
+    put_number (now - last_cycles);
+    put_number (addr - IO_MEM_START);
+    if (type == MMIO_READ && size < 4)
+        value &= (1 << (size * 8)) - 1;
+    put_number (value);
+    last_cycles = now;
+    active = 1;
+}
+
+/*
+ * Log an input byte delivered to UART.
+ */
+void mmio_record_input (unsigned unit, unsigned byte)
+{
+    putc (MMIO_INPUT << 2, mmio_file);
+    putc (unit, mmio_file);
+    putc (byte, mmio_file);
+}
+
+/*
+ * Log the end of simulation quantum, when needed.
+ */
+void mmio_record_sync()
+{
+    uint64_t now = cpu_cycles();
+
+    if (! active && now < event_next && ! uart_active())
+        return;
+    putc (MMIO_SYNC << 2, mmio_file);
+    put_number (now - last_cycles);
+    last_cycles = now;
+    active = 0;
+}
+
+/*
+ * Open a record file for replay.
+ */
+void mmio_replay_open (const char *filename)
+{
+    char line [64];
+
+    mmio_file = fopen (filename, "r");
+    if (! mmio_file) {
+        perror (filename);
+        exit (1);
+    }
+    setvbuf (mmio_file, mmio_buf, _IOFBF, sizeof(mmio_buf));
+    if (! fgets (line, sizeof(line), mmio_file) ||
+        strncmp (line, MMIO_SIGNATURE "\n", sizeof(MMIO_SIGNATURE)) != 0) {
+        fprintf (stderr, "%s: not an I/O record file for %s processor\n",
+            filename, MMIO_CPU);
+        exit (1);
+    }
+    last_cycles = 0;
+}
+
+/*
+ * Read next record from replay file.
+ * Return 0 at end of file.
+ */
+int mmio_replay_next (mmio_t *rec)
+{
+    int c = getc (mmio_file);
+    uint64_t delta, addr, value;
+
+    if (c < 0)
+        return 0;
+    rec->type = (c >> 2) & 3;
+    rec->size = 1 << (c & 3);
+    switch (rec->type) {
+    case MMIO_INPUT:
+        rec->addr = getc (mmio_file);
+        rec->value = getc (mmio_file);
+        rec->cycles = last_cycles;
+        return (int) rec->value >= 0;
+    case MMIO_SYNC:
+        if (! get_number (&delta))
+            return 0;
+        rec->addr = 0;
+        rec->value = 0;
+        break;
+    default:
+        if (! get_number (&delta) || ! get_number (&addr) ||
+            ! get_number (&value))
+            return 0;
+        rec->addr = IO_MEM_START + addr;
+        rec->value = value;
+        break;
+    }
+    last_cycles += delta;
+    rec->cycles = last_cycles;
+    return 1;
+}
@@ -45,6 +45,13 @@
                       case name+12: *namep = #name"INV"; op_##name: \
                       VALUE(name) &= romask; \
                       VALUE(name) |= write_op (VALUE(name), data, address) & ~(romask)
+#define WRITETMR(name,unit) \
+                      case name: *namep = #name; goto op_##name;\
+                      case name+4: *namep = #name"CLR"; goto op_##name;\
+                      case name+8: *namep = #name"SET"; goto op_##name;\
+                      case name+12: *namep = #name"INV"; op_##name: \
+                      timer_read (unit); \
+                      VALUE(name) = write_op (VALUE(name), data, address)
 
 static uint32_t *bootmem;       // image of boot memory
 
@@ -209,6 +216,7 @@ void irq_raise (int irq)
 {
     if (VALUE(IFS(irq >> 5)) & (1 << (irq & 31)))
         return;
+    stat_irq[irq]++;
 //printf ("-- %s() irq = %d\n", __func__, irq);
     VALUE(IFS(irq >> 5)) |= 1 << (irq & 31);
     update_irq_status();
@@ -228,14 +236,8 @@ void irq_clear (int irq)
 
 static void gpio_write (int gpio_port, unsigned lat_value)
 {
-    /* Control SD card 0 */
-    if (gpio_port == sdcard_gpio_port0 && sdcard_gpio_cs0) {
-        sdcard_select (0, ! (lat_value & sdcard_gpio_cs0));
-    }
-    /* Control SD card 1 */
-    if (gpio_port == sdcard_gpio_port1 && sdcard_gpio_cs1) {
-        sdcard_select (1, ! (lat_value & sdcard_gpio_cs1));
-    }
+    /* Control chip select signals of SPI devices */
+    spi_chip_select (gpio_port, lat_value);
 }
 
 /*
@@ -308,10 +310,25 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (RCON); break;	// Reset Control
     STORAGE (RSWRST);    	// Software Reset
         if ((VALUE(RSWRST) & 1) && stop_on_reset) {
-            exit(0);
+            sim_exit (SIM_RESET, "software reset");
         }
         break;
 
+    /*-------------------------------------------------------------------------
+     * Flash controller.
+     */
+    STORAGE (NVMCON); break;	// Flash Control
+    STORAGE (NVMCONCLR); *bufp = 0; break;
+    STORAGE (NVMCONSET); *bufp = 0; break;
+    STORAGE (NVMCONINV); *bufp = 0; break;
+    STORAGE (NVMKEY); *bufp = 0; break;	// Unlock Key
+    STORAGE (NVMADDR); break;	// Flash Address
+    STORAGE (NVMADDRCLR); *bufp = 0; break;
+    STORAGE (NVMADDRSET); *bufp = 0; break;
+    STORAGE (NVMADDRINV); *bufp = 0; break;
+    STORAGE (NVMDATA); break;	// Program Data
+    STORAGE (NVMSRCADDR); break; // Source Data Address
+
     /*-------------------------------------------------------------------------
      * Analog to digital converter.
      */
@@ -413,6 +430,96 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (CNEN); break;      // Input change interrupt enable
     STORAGE (CNPUE); break;     // Input pin pull-up enable
 
+    /*-------------------------------------------------------------------------
+     * Timer 1.
+     */
+    STORAGE (T1CON); break;                     // Control
+    STORAGE (T1CONCLR); *bufp = 0; break;
+    STORAGE (T1CONSET); *bufp = 0; break;
+    STORAGE (T1CONINV); *bufp = 0; break;
+    STORAGE (TMR1);                             // Counter
+        *bufp = timer_read (0);
+        break;
+    STORAGE (TMR1CLR); *bufp = 0; break;
+    STORAGE (TMR1SET); *bufp = 0; break;
+    STORAGE (TMR1INV); *bufp = 0; break;
+    STORAGE (PR1); break;                       // Period
+    STORAGE (PR1CLR); *bufp = 0; break;
+    STORAGE (PR1SET); *bufp = 0; break;
+    STORAGE (PR1INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 2.
+     */
+    STORAGE (T2CON); break;                     // Control
+    STORAGE (T2CONCLR); *bufp = 0; break;
+    STORAGE (T2CONSET); *bufp = 0; break;
+    STORAGE (T2CONINV); *bufp = 0; break;
+    STORAGE (TMR2);                             // Counter
+        *bufp = timer_read (1);
+        break;
+    STORAGE (TMR2CLR); *bufp = 0; break;
+    STORAGE (TMR2SET); *bufp = 0; break;
+    STORAGE (TMR2INV); *bufp = 0; break;
+    STORAGE (PR2); break;                       // Period
+    STORAGE (PR2CLR); *bufp = 0; break;
+    STORAGE (PR2SET); *bufp = 0; break;
+    STORAGE (PR2INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 3.
+     */
+    STORAGE (T3CON); break;                     // Control
+    STORAGE (T3CONCLR); *bufp = 0; break;
+    STORAGE (T3CONSET); *bufp = 0; break;
+    STORAGE (T3CONINV); *bufp = 0; break;
+    STORAGE (TMR3);                             // Counter
+        *bufp = timer_read (2);
+        break;
+    STORAGE (TMR3CLR); *bufp = 0; break;
+    STORAGE (TMR3SET); *bufp = 0; break;
+    STORAGE (TMR3INV); *bufp = 0; break;
+    STORAGE (PR3); break;                       // Period
+    STORAGE (PR3CLR); *bufp = 0; break;
+    STORAGE (PR3SET); *bufp = 0; break;
+    STORAGE (PR3INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 4.
+     */
+    STORAGE (T4CON); break;                     // Control
+    STORAGE (T4CONCLR); *bufp = 0; break;
+    STORAGE (T4CONSET); *bufp = 0; break;
+    STORAGE (T4CONINV); *bufp = 0; break;
+    STORAGE (TMR4);                             // Counter
+        *bufp = timer_read (3);
+        break;
+    STORAGE (TMR4CLR); *bufp = 0; break;
+    STORAGE (TMR4SET); *bufp = 0; break;
+    STORAGE (TMR4INV); *bufp = 0; break;
+    STORAGE (PR4); break;                       // Period
+    STORAGE (PR4CLR); *bufp = 0; break;
+    STORAGE (PR4SET); *bufp = 0; break;
+    STORAGE (PR4INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 5.
+     */
+    STORAGE (T5CON); break;                     // Control
+    STORAGE (T5CONCLR); *bufp = 0; break;
+    STORAGE (T5CONSET); *bufp = 0; break;
+    STORAGE (T5CONINV); *bufp = 0; break;
+    STORAGE (TMR5);                             // Counter
+        *bufp = timer_read (4);
+        break;
+    STORAGE (TMR5CLR); *bufp = 0; break;
+    STORAGE (TMR5SET); *bufp = 0; break;
+    STORAGE (TMR5INV); *bufp = 0; break;
+    STORAGE (PR5); break;                       // Period
+    STORAGE (PR5CLR); *bufp = 0; break;
+    STORAGE (PR5SET); *bufp = 0; break;
+    STORAGE (PR5INV); *bufp = 0; break;
+
     /*-------------------------------------------------------------------------
      * UART 1.
      */
@@ -552,7 +659,9 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (SPI1CONCLR); *bufp = 0; break;
     STORAGE (SPI1CONSET); *bufp = 0; break;
     STORAGE (SPI1CONINV); *bufp = 0; break;
-    STORAGE (SPI1STAT); break;                  // Status
+    STORAGE (SPI1STAT);                         // Status
+        spi_poll_status (0);
+        break;
     STORAGE (SPI1STATCLR); *bufp = 0; break;
     STORAGE (SPI1STATSET); *bufp = 0; break;
     STORAGE (SPI1STATINV); *bufp = 0; break;
@@ -571,7 +680,9 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (SPI2CONCLR); *bufp = 0; break;
     STORAGE (SPI2CONSET); *bufp = 0; break;
     STORAGE (SPI2CONINV); *bufp = 0; break;
-    STORAGE (SPI2STAT); break;                  // Status
+    STORAGE (SPI2STAT);                         // Status
+        spi_poll_status (1);
+        break;
     STORAGE (SPI2STATCLR); *bufp = 0; break;
     STORAGE (SPI2STATSET); *bufp = 0; break;
     STORAGE (SPI2STATINV); *bufp = 0; break;
@@ -590,7 +701,9 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (SPI3CONCLR); *bufp = 0; break;
     STORAGE (SPI3CONSET); *bufp = 0; break;
     STORAGE (SPI3CONINV); *bufp = 0; break;
-    STORAGE (SPI3STAT); break;                  // Status
+    STORAGE (SPI3STAT);                         // Status
+        spi_poll_status (2);
+        break;
     STORAGE (SPI3STATCLR); *bufp = 0; break;
     STORAGE (SPI3STATSET); *bufp = 0; break;
     STORAGE (SPI3STATINV); *bufp = 0; break;
@@ -609,7 +722,9 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (SPI4CONCLR); *bufp = 0; break;
     STORAGE (SPI4CONSET); *bufp = 0; break;
     STORAGE (SPI4CONINV); *bufp = 0; break;
-    STORAGE (SPI4STAT); break;                  // Status
+    STORAGE (SPI4STAT);                         // Status
+        spi_poll_status (3);
+        break;
     STORAGE (SPI4STATCLR); *bufp = 0; break;
     STORAGE (SPI4STATSET); *bufp = 0; break;
     STORAGE (SPI4STATINV); *bufp = 0; break;
@@ -627,7 +742,7 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
         if (trace_flag)
             printf ("--- Read %08x: peripheral register not supported\n",
                 address);
-        exit (1);
+        sim_exit (SIM_UNSUPPORTED, "read of unsupported register %08x", address);
     }
     return *bufp;
 }
@@ -683,7 +798,9 @@ irq:    update_irq_status();
     /*-------------------------------------------------------------------------
      * System controller.
      */
-    STORAGE (OSCCON); break;	// Oscillator Control
+    WRITEOP (OSCCON);		// Oscillator Control
+        clock_update();
+        return;
     STORAGE (OSCTUN); break;	// Oscillator Tuning
     STORAGE (DDPCON); break;	// Debug Data Port Control
     READONLY(DEVID);		// Device Identifier
@@ -705,9 +822,23 @@ irq:    update_irq_status();
             /* Reset all devices */
             io_reset();
             sdcard_reset();
+            spiflash_reset();
         }
 	break;
 
+    /*-------------------------------------------------------------------------
+     * Flash controller.
+     */
+    WRITEOP (NVMCON);		// Flash Control
+        nvm_control();
+        return;
+    STORAGE (NVMKEY);		// Unlock Key
+        nvm_unlock (data);
+        break;
+    WRITEOP (NVMADDR); return;	// Flash Address
+    STORAGE (NVMDATA); break;	// Program Data
+    STORAGE (NVMSRCADDR); break; // Source Data Address
+
     /*-------------------------------------------------------------------------
      * Analog to digital converter.
      */
@@ -829,6 +960,55 @@ irq:    update_irq_status();
     WRITEOP (CNEN); return;	    // Input change interrupt enable
     WRITEOP (CNPUE); return;	    // Input pin pull-up enable
 
+    /*-------------------------------------------------------------------------
+     * Timers.
+     */
+    WRITEOP (T1CON);                                // Control
+        timer_update (0, 0);
+        return;
+    WRITETMR (TMR1, 0);                             // Counter
+        timer_update (0, 1);
+        return;
+    WRITEOP (PR1);                                  // Period
+        timer_update (0, 0);
+        return;
+    WRITEOP (T2CON);                                // Control
+        timer_update (1, 0);
+        return;
+    WRITETMR (TMR2, 1);                             // Counter
+        timer_update (1, 1);
+        return;
+    WRITEOP (PR2);                                  // Period
+        timer_update (1, 0);
+        return;
+    WRITEOP (T3CON);                                // Control
+        timer_update (2, 0);
+        return;
+    WRITETMR (TMR3, 2);                             // Counter
+        timer_update (2, 1);
+        return;
+    WRITEOP (PR3);                                  // Period
+        timer_update (2, 0);
+        return;
+    WRITEOP (T4CON);                                // Control
+        timer_update (3, 0);
+        return;
+    WRITETMR (TMR4, 3);                             // Counter
+        timer_update (3, 1);
+        return;
+    WRITEOP (PR4);                                  // Period
+        timer_update (3, 0);
+        return;
+    WRITEOP (T5CON);                                // Control
+        timer_update (4, 0);
+        return;
+    WRITETMR (TMR5, 4);                             // Counter
+        timer_update (4, 1);
+        return;
+    WRITEOP (PR5);                                  // Period
+        timer_update (4, 0);
+        return;
+
     /*-------------------------------------------------------------------------
      * UART 1.
      */
@@ -977,7 +1157,7 @@ irq:    update_irq_status();
         if (trace_flag)
             printf ("--- Write %08x to %08x: peripheral register not supported\n",
                 data, address);
-        exit (1);
+        sim_exit (SIM_UNSUPPORTED, "write to unsupported register %08x", address);
 
 readonly:
         fprintf (stderr, "--- Write %08x to %s: readonly register\n",
@@ -1069,6 +1249,9 @@ void io_reset()
 
     uart_reset();
     spi_reset();
+    timer_reset();
+    nvm_reset();
+    clock_update();
 }
 
 void io_init (void *bootp, unsigned devcfg0, unsigned devcfg1,
@@ -1083,6 +1266,8 @@ void io_init (void *bootp, unsigned devcfg0, unsigned devcfg1,
     BOOTMEM(DEVCFG1) = devcfg1;
     BOOTMEM(DEVCFG0) = devcfg0;
 
+    clock_init (devcfg2);
     io_reset();
     sdcard_reset();
+    spiflash_reset();
 }
@@ -45,6 +45,13 @@
                       case name+12: *namep = #name"INV"; op_##name: \
                       VALUE(name) &= romask; \
                       VALUE(name) |= write_op (VALUE(name), data, address) & ~(romask)
+#define WRITETMR(name,unit) \
+                      case name: *namep = #name; goto op_##name;\
+                      case name+4: *namep = #name"CLR"; goto op_##name;\
+                      case name+8: *namep = #name"SET"; goto op_##name;\
+                      case name+12: *namep = #name"INV"; op_##name: \
+                      timer_read (unit); \
+                      VALUE(name) = write_op (VALUE(name), data, address)
 
 static uint32_t *bootmem;       // image of boot memory
 
@@ -100,6 +107,7 @@ void irq_raise (int irq)
 {
     if (VALUE(IFS(irq >> 5)) & (1 << (irq & 31)))
         return;
+    stat_irq[irq]++;
 //printf ("-- %s() irq = %d\n", __func__, irq);
     VALUE(IFS(irq >> 5)) |= 1 << (irq & 31);
     update_irq_status();
@@ -119,14 +127,8 @@ void irq_clear (int irq)
 
 static void gpio_write (int gpio_port, unsigned lat_value)
 {
-    /* Control SD card 0 */
-    if (gpio_port == sdcard_gpio_port0 && sdcard_gpio_cs0) {
-        sdcard_select (0, ! (lat_value & sdcard_gpio_cs0));
-    }
-    /* Control SD card 1 */
-    if (gpio_port == sdcard_gpio_port1 && sdcard_gpio_cs1) {
-        sdcard_select (1, ! (lat_value & sdcard_gpio_cs1));
-    }
+    /* Control chip select signals of SPI devices */
+    spi_chip_select (gpio_port, lat_value);
 }
 
 /*
@@ -227,7 +229,7 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (RCON); break;	// Reset Control
     STORAGE (RSWRST);           // Software Reset
         if ((VALUE(RSWRST) & 1) && stop_on_reset) {
-            exit(0);
+            sim_exit (SIM_RESET, "software reset");
         }
         break;
     STORAGE (OSCCON); break;	// Oscillator Control
@@ -241,6 +243,26 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (PB7DIV); break;	// Peripheral bus 7 divisor
     STORAGE (PB8DIV); break;	// Peripheral bus 8 divisor
 
+    /*-------------------------------------------------------------------------
+     * Flash controller.
+     */
+    STORAGE (NVMCON); break;	// Flash Control
+    STORAGE (NVMCONCLR); *bufp = 0; break;
+    STORAGE (NVMCONSET); *bufp = 0; break;
+    STORAGE (NVMCONINV); *bufp = 0; break;
+    STORAGE (NVMKEY); *bufp = 0; break;	// Unlock Key
+    STORAGE (NVMADDR); break;	// Flash Address
+    STORAGE (NVMADDRCLR); *bufp = 0; break;
+    STORAGE (NVMADDRSET); *bufp = 0; break;
+    STORAGE (NVMADDRINV); *bufp = 0; break;
+    STORAGE (NVMDATA0); break;	// Program Data
+    STORAGE (NVMDATA1); break;
+    STORAGE (NVMDATA2); break;
+    STORAGE (NVMDATA3); break;
+    STORAGE (NVMSRCADDR); break; // Source Data Address
+    STORAGE (NVMPWP); break;	// Program Flash Write Protect
+    STORAGE (NVMBWP); break;	// Boot Flash Write Protect
+
     /*-------------------------------------------------------------------------
      * Peripheral port select registers: input.
      */
@@ -439,6 +461,168 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (CNENG); break;     // Input change interrupt enable
     STORAGE (CNSTATG); break;   // Input change status
 
+    /*-------------------------------------------------------------------------
+     * Timer 1.
+     */
+    STORAGE (T1CON); break;                     // Control
+    STORAGE (T1CONCLR); *bufp = 0; break;
+    STORAGE (T1CONSET); *bufp = 0; break;
+    STORAGE (T1CONINV); *bufp = 0; break;
+    STORAGE (TMR1);                             // Counter
+        *bufp = timer_read (0);
+        break;
+    STORAGE (TMR1CLR); *bufp = 0; break;
+    STORAGE (TMR1SET); *bufp = 0; break;
+    STORAGE (TMR1INV); *bufp = 0; break;
+    STORAGE (PR1); break;                       // Period
+    STORAGE (PR1CLR); *bufp = 0; break;
+    STORAGE (PR1SET); *bufp = 0; break;
+    STORAGE (PR1INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 2.
+     */
+    STORAGE (T2CON); break;                     // Control
+    STORAGE (T2CONCLR); *bufp = 0; break;
+    STORAGE (T2CONSET); *bufp = 0; break;
+    STORAGE (T2CONINV); *bufp = 0; break;
+    STORAGE (TMR2);                             // Counter
+        *bufp = timer_read (1);
+        break;
+    STORAGE (TMR2CLR); *bufp = 0; break;
+    STORAGE (TMR2SET); *bufp = 0; break;
+    STORAGE (TMR2INV); *bufp = 0; break;
+    STORAGE (PR2); break;                       // Period
+    STORAGE (PR2CLR); *bufp = 0; break;
+    STORAGE (PR2SET); *bufp = 0; break;
+    STORAGE (PR2INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 3.
+     */
+    STORAGE (T3CON); break;                     // Control
+    STORAGE (T3CONCLR); *bufp = 0; break;
+    STORAGE (T3CONSET); *bufp = 0; break;
+    STORAGE (T3CONINV); *bufp = 0; break;
+    STORAGE (TMR3);                             // Counter
+        *bufp = timer_read (2);
+        break;
+    STORAGE (TMR3CLR); *bufp = 0; break;
+    STORAGE (TMR3SET); *bufp = 0; break;
+    STORAGE (TMR3INV); *bufp = 0; break;
+    STORAGE (PR3); break;                       // Period
+    STORAGE (PR3CLR); *bufp = 0; break;
+    STORAGE (PR3SET); *bufp = 0; break;
+    STORAGE (PR3INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 4.
+     */
+    STORAGE (T4CON); break;                     // Control
+    STORAGE (T4CONCLR); *bufp = 0; break;
+    STORAGE (T4CONSET); *bufp = 0; break;
+    STORAGE (T4CONINV); *bufp = 0; break;
+    STORAGE (TMR4);                             // Counter
+        *bufp = timer_read (3);
+        break;
+    STORAGE (TMR4CLR); *bufp = 0; break;
+    STORAGE (TMR4SET); *bufp = 0; break;
+    STORAGE (TMR4INV); *bufp = 0; break;
+    STORAGE (PR4); break;                       // Period
+    STORAGE (PR4CLR); *bufp = 0; break;
+    STORAGE (PR4SET); *bufp = 0; break;
+    STORAGE (PR4INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 5.
+     */
+    STORAGE (T5CON); break;                     // Control
+    STORAGE (T5CONCLR); *bufp = 0; break;
+    STORAGE (T5CONSET); *bufp = 0; break;
+    STORAGE (T5CONINV); *bufp = 0; break;
+    STORAGE (TMR5);                             // Counter
+        *bufp = timer_read (4);
+        break;
+    STORAGE (TMR5CLR); *bufp = 0; break;
+    STORAGE (TMR5SET); *bufp = 0; break;
+    STORAGE (TMR5INV); *bufp = 0; break;
+    STORAGE (PR5); break;                       // Period
+    STORAGE (PR5CLR); *bufp = 0; break;
+    STORAGE (PR5SET); *bufp = 0; break;
+    STORAGE (PR5INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 6.
+     */
+    STORAGE (T6CON); break;                     // Control
+    STORAGE (T6CONCLR); *bufp = 0; break;
+    STORAGE (T6CONSET); *bufp = 0; break;
+    STORAGE (T6CONINV); *bufp = 0; break;
+    STORAGE (TMR6);                             // Counter
+        *bufp = timer_read (5);
+        break;
+    STORAGE (TMR6CLR); *bufp = 0; break;
+    STORAGE (TMR6SET); *bufp = 0; break;
+    STORAGE (TMR6INV); *bufp = 0; break;
+    STORAGE (PR6); break;                       // Period
+    STORAGE (PR6CLR); *bufp = 0; break;
+    STORAGE (PR6SET); *bufp = 0; break;
+    STORAGE (PR6INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 7.
+     */
+    STORAGE (T7CON); break;                     // Control
+    STORAGE (T7CONCLR); *bufp = 0; break;
+    STORAGE (T7CONSET); *bufp = 0; break;
+    STORAGE (T7CONINV); *bufp = 0; break;
+    STORAGE (TMR7);                             // Counter
+        *bufp = timer_read (6);
+        break;
+    STORAGE (TMR7CLR); *bufp = 0; break;
+    STORAGE (TMR7SET); *bufp = 0; break;
+    STORAGE (TMR7INV); *bufp = 0; break;
+    STORAGE (PR7); break;                       // Period
+    STORAGE (PR7CLR); *bufp = 0; break;
+    STORAGE (PR7SET); *bufp = 0; break;
+    STORAGE (PR7INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 8.
+     */
+    STORAGE (T8CON); break;                     // Control
+    STORAGE (T8CONCLR); *bufp = 0; break;
+    STORAGE (T8CONSET); *bufp = 0; break;
+    STORAGE (T8CONINV); *bufp = 0; break;
+    STORAGE (TMR8);                             // Counter
+        *bufp = timer_read (7);
+        break;
+    STORAGE (TMR8CLR); *bufp = 0; break;
+    STORAGE (TMR8SET); *bufp = 0; break;
+    STORAGE (TMR8INV); *bufp = 0; break;
+    STORAGE (PR8); break;                       // Period
+    STORAGE (PR8CLR); *bufp = 0; break;
+    STORAGE (PR8SET); *bufp = 0; break;
+    STORAGE (PR8INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * Timer 9.
+     */
+    STORAGE (T9CON); break;                     // Control
+    STORAGE (T9CONCLR); *bufp = 0; break;
+    STORAGE (T9CONSET); *bufp = 0; break;
+    STORAGE (T9CONINV); *bufp = 0; break;
+    STORAGE (TMR9);                             // Counter
+        *bufp = timer_read (8);
+        break;
+    STORAGE (TMR9CLR); *bufp = 0; break;
+    STORAGE (TMR9SET); *bufp = 0; break;
+    STORAGE (TMR9INV); *bufp = 0; break;
+    STORAGE (PR9); break;                       // Period
+    STORAGE (PR9CLR); *bufp = 0; break;
+    STORAGE (PR9SET); *bufp = 0; break;
+    STORAGE (PR9INV); *bufp = 0; break;
+
     /*-------------------------------------------------------------------------
      * UART 1.
      */
@@ -578,7 +762,9 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (SPI1CONCLR); *bufp = 0; break;
     STORAGE (SPI1CONSET); *bufp = 0; break;
     STORAGE (SPI1CONINV); *bufp = 0; break;
-    STORAGE (SPI1STAT); break;                  // Status
+    STORAGE (SPI1STAT);                         // Status
+        spi_poll_status (0);
+        break;
     STORAGE (SPI1STATCLR); *bufp = 0; break;
     STORAGE (SPI1STATSET); *bufp = 0; break;
     STORAGE (SPI1STATINV); *bufp = 0; break;
@@ -601,7 +787,9 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (SPI2CONCLR); *bufp = 0; break;
     STORAGE (SPI2CONSET); *bufp = 0; break;
     STORAGE (SPI2CONINV); *bufp = 0; break;
-    STORAGE (SPI2STAT); break;                  // Status
+    STORAGE (SPI2STAT);                         // Status
+        spi_poll_status (1);
+        break;
     STORAGE (SPI2STATCLR); *bufp = 0; break;
     STORAGE (SPI2STATSET); *bufp = 0; break;
     STORAGE (SPI2STATINV); *bufp = 0; break;
@@ -624,7 +812,9 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (SPI3CONCLR); *bufp = 0; break;
     STORAGE (SPI3CONSET); *bufp = 0; break;
     STORAGE (SPI3CONINV); *bufp = 0; break;
-    STORAGE (SPI3STAT); break;                  // Status
+    STORAGE (SPI3STAT);                         // Status
+        spi_poll_status (2);
+        break;
     STORAGE (SPI3STATCLR); *bufp = 0; break;
     STORAGE (SPI3STATSET); *bufp = 0; break;
     STORAGE (SPI3STATINV); *bufp = 0; break;
@@ -647,7 +837,9 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (SPI4CONCLR); *bufp = 0; break;
     STORAGE (SPI4CONSET); *bufp = 0; break;
     STORAGE (SPI4CONINV); *bufp = 0; break;
-    STORAGE (SPI4STAT); break;                  // Status
+    STORAGE (SPI4STAT);                         // Status
+        spi_poll_status (3);
+        break;
     STORAGE (SPI4STATCLR); *bufp = 0; break;
     STORAGE (SPI4STATSET); *bufp = 0; break;
     STORAGE (SPI4STATINV); *bufp = 0; break;
@@ -663,10 +855,60 @@ unsigned io_read32 (unsigned address, unsigned *bufp, const char **namep)
     STORAGE (SPI4CON2SET); *bufp = 0; break;
     STORAGE (SPI4CON2INV); *bufp = 0; break;
 
+    /*-------------------------------------------------------------------------
+     * SPI 5.
+     */
+    STORAGE (SPI5CON); break;                   // Control
+    STORAGE (SPI5CONCLR); *bufp = 0; break;
+    STORAGE (SPI5CONSET); *bufp = 0; break;
+    STORAGE (SPI5CONINV); *bufp = 0; break;
+    STORAGE (SPI5STAT);                         // Status
+        spi_poll_status (4);
+        break;
+    STORAGE (SPI5STATCLR); *bufp = 0; break;
+    STORAGE (SPI5STATSET); *bufp = 0; break;
+    STORAGE (SPI5STATINV); *bufp = 0; break;
+    STORAGE (SPI5BUF);                          // Buffer
+        *bufp = spi_readbuf (4);
+        break;
+    STORAGE (SPI5BRG); break;                   // Baud rate
+    STORAGE (SPI5BRGCLR); *bufp = 0; break;
+    STORAGE (SPI5BRGSET); *bufp = 0; break;
+    STORAGE (SPI5BRGINV); *bufp = 0; break;
+    STORAGE (SPI5CON2); break;                   // Control 2
+    STORAGE (SPI5CON2CLR); *bufp = 0; break;
+    STORAGE (SPI5CON2SET); *bufp = 0; break;
+    STORAGE (SPI5CON2INV); *bufp = 0; break;
+
+    /*-------------------------------------------------------------------------
+     * SPI 6.
+     */
+    STORAGE (SPI6CON); break;                   // Control
+    STORAGE (SPI6CONCLR); *bufp = 0; break;
+    STORAGE (SPI6CONSET); *bufp = 0; break;
+    STORAGE (SPI6CONINV); *bufp = 0; break;
+    STORAGE (SPI6STAT);                         // Status
+        spi_poll_status (5);
+        break;
+    STORAGE (SPI6STATCLR); *bufp = 0; break;
+    STORAGE (SPI6STATSET); *bufp = 0; break;
+    STORAGE (SPI6STATINV); *bufp = 0; break;
+    STORAGE (SPI6BUF);                          // Buffer
+        *bufp = spi_readbuf (5);
+        break;
+    STORAGE (SPI6BRG); break;                   // Baud rate
+    STORAGE (SPI6BRGCLR); *bufp = 0; break;
+    STORAGE (SPI6BRGSET); *bufp = 0; break;
+    STORAGE (SPI6BRGINV); *bufp = 0; break;
+    STORAGE (SPI6CON2); break;                   // Control 2
+    STORAGE (SPI6CON2CLR); *bufp = 0; break;
+    STORAGE (SPI6CON2SET); *bufp = 0; break;
+    STORAGE (SPI6CON2INV); *bufp = 0; break;
+
     default:
         fprintf (stderr, "--- Read %08x: peripheral register not supported\n",
             address);
-        exit (1);
+        sim_exit (SIM_UNSUPPORTED, "read of unsupported register %08x", address);
     }
     return *bufp;
 }
@@ -919,18 +1161,39 @@ irq:    update_irq_status();
             /* Reset all devices */
             io_reset();
             sdcard_reset();
+            spiflash_reset();
         }
 	break;
-    STORAGE (OSCCON); break;	// Oscillator Control
+    WRITEOP (OSCCON); goto clk;	// Oscillator Control
     STORAGE (OSCTUN); break;	// Oscillator Tuning
-    STORAGE (SPLLCON); break;	// System PLL Control
-    STORAGE (PB1DIV); break;	// Peripheral bus 1 divisor
-    STORAGE (PB2DIV); break;	// Peripheral bus 2 divisor
-    STORAGE (PB3DIV); break;	// Peripheral bus 3 divisor
-    STORAGE (PB4DIV); break;	// Peripheral bus 4 divisor
-    STORAGE (PB5DIV); break;	// Peripheral bus 5 divisor
-    STORAGE (PB7DIV); break;	// Peripheral bus 7 divisor
-    STORAGE (PB8DIV); break;	// Peripheral bus 8 divisor
+    WRITEOP (SPLLCON); goto clk;	// System PLL Control
+    WRITEOPR (PB1DIV, PIC32_PBDIV_RDY); goto clk;	// Peripheral bus 1 divisor
+    WRITEOPR (PB2DIV, PIC32_PBDIV_RDY); goto clk;	// Peripheral bus 2 divisor
+    WRITEOPR (PB3DIV, PIC32_PBDIV_RDY); goto clk;	// Peripheral bus 3 divisor
+    WRITEOPR (PB4DIV, PIC32_PBDIV_RDY); goto clk;	// Peripheral bus 4 divisor
+    WRITEOPR (PB5DIV, PIC32_PBDIV_RDY); goto clk;	// Peripheral bus 5 divisor
+    WRITEOPR (PB7DIV, PIC32_PBDIV_RDY); goto clk;	// Peripheral bus 7 divisor
+    WRITEOPR (PB8DIV, PIC32_PBDIV_RDY);		// Peripheral bus 8 divisor
+clk:    clock_update();
+        return;
+
+    /*-------------------------------------------------------------------------
+     * Flash controller.
+     */
+    WRITEOP (NVMCON);		// Flash Control
+        nvm_control();
+        return;
+    STORAGE (NVMKEY);		// Unlock Key
+        nvm_unlock (data);
+        break;
+    WRITEOP (NVMADDR); return;	// Flash Address
+    STORAGE (NVMDATA0); break;	// Program Data
+    STORAGE (NVMDATA1); break;
+    STORAGE (NVMDATA2); break;
+    STORAGE (NVMDATA3); break;
+    STORAGE (NVMSRCADDR); break; // Source Data Address
+    STORAGE (NVMPWP); break;	// Program Flash Write Protect
+    STORAGE (NVMBWP); break;	// Boot Flash Write Protect
 
     /*-------------------------------------------------------------------------
      * Peripheral port select registers: input.
@@ -1144,6 +1407,91 @@ irq:    update_irq_status();
     WRITEOP (CNENG); return;	    // Input change interrupt enable
     WRITEOP (CNSTATG); return;	    // Input change status
 
+    /*-------------------------------------------------------------------------
+     * Timers.
+     */
+    WRITEOP (T1CON);                                // Control
+        timer_update (0, 0);
+        return;
+    WRITETMR (TMR1, 0);                             // Counter
+        timer_update (0, 1);
+        return;
+    WRITEOP (PR1);                                  // Period
+        timer_update (0, 0);
+        return;
+    WRITEOP (T2CON);                                // Control
+        timer_update (1, 0);
+        return;
+    WRITETMR (TMR2, 1);                             // Counter
+        timer_update (1, 1);
+        return;
+    WRITEOP (PR2);                                  // Period
+        timer_update (1, 0);
+        return;
+    WRITEOP (T3CON);                                // Control
+        timer_update (2, 0);
+        return;
+    WRITETMR (TMR3, 2);                             // Counter
+        timer_update (2, 1);
+        return;
+    WRITEOP (PR3);                                  // Period
+        timer_update (2, 0);
+        return;
+    WRITEOP (T4CON);                                // Control
+        timer_update (3, 0);
+        return;
+    WRITETMR (TMR4, 3);                             // Counter
+        timer_update (3, 1);
+        return;
+    WRITEOP (PR4);                                  // Period
+        timer_update (3, 0);
+        return;
+    WRITEOP (T5CON);                                // Control
+        timer_update (4, 0);
+        return;
+    WRITETMR (TMR5, 4);                             // Counter
+        timer_update (4, 1);
+        return;
+    WRITEOP (PR5);                                  // Period
+        timer_update (4, 0);
+        return;
+    WRITEOP (T6CON);                                // Control
+        timer_update (5, 0);
+        return;
+    WRITETMR (TMR6, 5);                             // Counter
+        timer_update (5, 1);
+        return;
+    WRITEOP (PR6);                                  // Period
+        timer_update (5, 0);
+        return;
+    WRITEOP (T7CON);                                // Control
+        timer_update (6, 0);
+        return;
+    WRITETMR (TMR7, 6);                             // Counter
+        timer_update (6, 1);
+        return;
+    WRITEOP (PR7);                                  // Period
+        timer_update (6, 0);
+        return;
+    WRITEOP (T8CON);                                // Control
+        timer_update (7, 0);
+        return;
+    WRITETMR (TMR8, 7);                             // Counter
+        timer_update (7, 1);
+        return;
+    WRITEOP (PR8);                                  // Period
+        timer_update (7, 0);
+        return;
+    WRITEOP (T9CON);                                // Control
+        timer_update (8, 0);
+        return;
+    WRITETMR (TMR9, 8);                             // Counter
+        timer_update (8, 1);
+        return;
+    WRITEOP (PR9);                                  // Period
+        timer_update (8, 0);
+        return;
+
     /*-------------------------------------------------------------------------
      * UART 1.
      */
@@ -1293,10 +1641,32 @@ irq:    update_irq_status();
     WRITEOP (SPI4BRG); return;      // Baud rate
     WRITEOP (SPI4CON2); return;                     // Control 2
 
+    WRITEOP (SPI5CON);                              // Control
+	spi_control (4);
+        return;
+    WRITEOPR (SPI5STAT, ~PIC32_SPISTAT_SPIROV);     // Status
+        return;                                     // Only ROV bit is writable
+    STORAGE (SPI5BUF);                              // Buffer
+        spi_writebuf (4, data);
+        return;
+    WRITEOP (SPI5BRG); return;                      // Baud rate
+    WRITEOP (SPI5CON2); return;                     // Control 2
+
+    WRITEOP (SPI6CON);                              // Control
+	spi_control (5);
+        return;
+    WRITEOPR (SPI6STAT, ~PIC32_SPISTAT_SPIROV);     // Status
+        return;                                     // Only ROV bit is writable
+    STORAGE (SPI6BUF);                              // Buffer
+        spi_writebuf (5, data);
+        return;
+    WRITEOP (SPI6BRG); return;                      // Baud rate
+    WRITEOP (SPI6CON2); return;                     // Control 2
+
     default:
         fprintf (stderr, "--- Write %08x to %08x: peripheral register not supported\n",
             data, address);
-        exit (1);
+        sim_exit (SIM_UNSUPPORTED, "write to unsupported register %08x", address);
 readonly:
         fprintf (stderr, "--- Write %08x to %s: readonly register\n",
             data, *namep);
@@ -1418,6 +1788,9 @@ void io_reset()
 
     uart_reset();
     spi_reset();
+    timer_reset();
+    nvm_reset();
+    clock_update();
 }
 
 void io_init (void *bootp, unsigned devcfg0, unsigned devcfg1,
@@ -1434,4 +1807,5 @@ void io_init (void *bootp, unsigned devcfg0, unsigned devcfg1,
 
     io_reset();
     sdcard_reset();
+    spiflash_reset();
 }
@@ -0,0 +1,311 @@
+/*
+ * Flash memory controller: program and erase of on-chip flash.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * An operation is started by setting WR bit in NVMCON, right after
+ * the unlock sequence is written to NVMKEY, with WREN bit set.
+ * Data for program are latched at the start: from NVMDATA registers,
+ * or from RAM at NVMSRCADDR for a row.  WR bit remains set for the
+ * typical time of the operation; then flash contents are modified,
+ * WR is cleared and Flash Control Event interrupt is raised.
+ * Programming can only clear bits, as on real flash.
+ *
+ * Flash contents are modified by cpu_flash_write(), which lets
+ * the simulator discard translated code for the modified range only.
+ * Program flash can be backed by an image file (option --flash),
+ * mapped into memory, so that the contents persist across runs.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "globals.h"
+
+#ifdef PIC32MX7
+#   include "pic32mx.h"
+#   define NVM_ROW      512             // bytes per row
+#   define NVM_PAGE     4096            // bytes per erase page
+#   define NVMDATA0     NVMDATA
+#endif
+
+#ifdef PIC32MZ
+#   include "pic32mz.h"
+#   define NVM_ROW      2048
+#   define NVM_PAGE     16384
+#endif
+
+#define KSEG1(paddr)    (0xa0000000 | (paddr))
+
+/*
+ * Typical times of operations, in microseconds.
+ */
+#define TIME_WORD_PGM   20
+#define TIME_QUAD_PGM   40
+#define TIME_ROW_PGM    2000
+#define TIME_PAGE_ERASE 20000
+#define TIME_PFM_ERASE  80000
+
+typedef struct {
+    int unlock;                         // state of unlock sequence
+    unsigned con;                       // NVMCON, as accepted
+    unsigned addr;                      // physical address of operation
+    unsigned len;                       // bytes to modify
+    int erase;                          // erase, or program
+    int error;                          // operation failed
+    unsigned char data [NVM_PAGE];      // data for program, ones for erase
+} nvm_t;
+
+static nvm_t nvm;
+
+/*
+ * Check that the range is inside of program or boot flash.
+ */
+static int nvm_valid (unsigned addr, unsigned len)
+{
+    if (IN_PROGRAM_MEM(addr))
+        return addr + (uint64_t) len <= PROGRAM_FLASH_START + PROGRAM_FLASH_SIZE;
+    if (IN_BOOT_MEM(addr))
+        return addr + (uint64_t) len <= BOOT_FLASH_START + BOOT_FLASH_SIZE;
+    return 0;
+}
+
+/*
+ * End of operation: modify the flash contents.
+ */
+static void nvm_done (int arg)
+{
+    unsigned char *old;
+    unsigned i, n;
+
+    if (nvm.erase) {
+        for (i=0; i<nvm.len; i+=n) {
+            n = nvm.len - i;
+            if (n > NVM_PAGE)
+                n = NVM_PAGE;
+            cpu_flash_write (nvm.addr + i, nvm.data, n);
+        }
+    } else if (nvm.len > 0) {
+        old = (unsigned char*) host_pointer (KSEG1(nvm.addr), nvm.len, 0);
+        for (i=0; i<nvm.len; i++)
+            nvm.data[i] &= old[i];
+        cpu_flash_write (nvm.addr, nvm.data, nvm.len);
+    }
+    nvm.con &= ~PIC32_NVMCON_WR;
+    if (nvm.error)
+        nvm.con |= PIC32_NVMCON_WRERR;
+    VALUE(NVMCON) = nvm.con;
+    irq_raise (PIC32_IRQ_FCE);
+}
+
+/*
+ * Start the operation: check the address and latch the data.
+ */
+static void nvm_start (unsigned op)
+{
+    unsigned usec = 0, src;
+    char *ptr;
+
+    nvm.con &= ~(PIC32_NVMCON_WRERR | PIC32_NVMCON_LVDERR);
+    nvm.addr = VALUE(NVMADDR) & 0x1fffffff;
+    nvm.len = 0;
+    nvm.erase = 0;
+    nvm.error = 0;
+    switch (op) {
+    case PIC32_NVMCON_NOP:
+        break;
+    case PIC32_NVMCON_WORD_PGM:
+        nvm.addr &= ~3;
+        nvm.len = 4;
+        memcpy (nvm.data, &VALUE(NVMDATA0), 4);
+        usec = TIME_WORD_PGM;
+        break;
+#ifdef PIC32MZ
+    case PIC32_NVMCON_QUAD_PGM:
+        nvm.addr &= ~15;
+        nvm.len = 16;
+        memcpy (nvm.data, &VALUE(NVMDATA0), 4);
+        memcpy (nvm.data + 4, &VALUE(NVMDATA1), 4);
+        memcpy (nvm.data + 8, &VALUE(NVMDATA2), 4);
+        memcpy (nvm.data + 12, &VALUE(NVMDATA3), 4);
+        usec = TIME_QUAD_PGM;
+        break;
+#endif
+    case PIC32_NVMCON_ROW_PGM:
+        nvm.addr &= ~(NVM_ROW - 1);
+        nvm.len = NVM_ROW;
+        src = VALUE(NVMSRCADDR) & 0x1fffffff & ~3;
+        ptr = host_pointer (KSEG1(src), NVM_ROW, 1);
+        if (! ptr) {
+            nvm.error = 1;
+            break;
+        }
+        memcpy (nvm.data, ptr, NVM_ROW);
+        usec = TIME_ROW_PGM;
+        break;
+    case PIC32_NVMCON_PAGE_ERASE:
+        nvm.addr &= ~(NVM_PAGE - 1);
+        nvm.len = NVM_PAGE;
+        nvm.erase = 1;
+        usec = TIME_PAGE_ERASE;
+        break;
+#ifdef PIC32MZ
+    case PIC32_NVMCON_LPFM_ERASE:
+        nvm.addr = PROGRAM_FLASH_START;
+        nvm.len = PROGRAM_FLASH_SIZE / 2;
+        nvm.erase = 1;
+        usec = TIME_PFM_ERASE;
+        break;
+    case PIC32_NVMCON_UPFM_ERASE:
+        nvm.addr = PROGRAM_FLASH_START + PROGRAM_FLASH_SIZE / 2;
+        nvm.len = PROGRAM_FLASH_SIZE / 2;
+        nvm.erase = 1;
+        usec = TIME_PFM_ERASE;
+        break;
+#endif
+    case PIC32_NVMCON_PFM_ERASE:
+        nvm.addr = PROGRAM_FLASH_START;
+        nvm.len = PROGRAM_FLASH_SIZE;
+        nvm.erase = 1;
+        usec = TIME_PFM_ERASE;
+        break;
+    default:
+        nvm.error = 1;
+        break;
+    }
+
+    if (nvm.len > 0 && ! nvm_valid (nvm.addr, nvm.len))
+        nvm.error = 1;
+    if (nvm.error) {
+        nvm.len = 0;
+        nvm.erase = 0;
+        usec = 0;
+    }
+    if (nvm.erase)
+        memset (nvm.data, 0xff, NVM_PAGE);
+    if (trace_flag)
+        printf ("--- Flash operation %u at %08x, %u bytes%s\n",
+            op, nvm.addr, nvm.len, nvm.error ? ": error" : "");
+
+    event_schedule (EVENT_NVM, cpu_cycles() +
+        (uint64_t) usec * clock_sysclk() / 1000000, nvm_done, 0);
+}
+
+/*
+ * Write to NVMKEY: unlock sequence.
+ */
+void nvm_unlock (unsigned key)
+{
+    if (nvm.unlock == 0 && key == 0xaa996655)
+        nvm.unlock = 1;
+    else if (nvm.unlock == 1 && key == 0x556699aa)
+        nvm.unlock = 2;
+    else
+        nvm.unlock = 0;
+}
+
+/*
+ * Write to NVMCON: start the operation when WR bit is set.
+ * The register is read-only while the operation is in progress.
+ */
+void nvm_control()
+{
+    unsigned con = VALUE(NVMCON);
+    int unlocked = (nvm.unlock == 2);
+
+    nvm.unlock = 0;
+    if (nvm.con & PIC32_NVMCON_WR) {
+        VALUE(NVMCON) = nvm.con;
+        return;
+    }
+
+    /* Error bits are read-only. */
+    con &= ~(PIC32_NVMCON_WRERR | PIC32_NVMCON_LVDERR);
+    con |= nvm.con & (PIC32_NVMCON_WRERR | PIC32_NVMCON_LVDERR);
+
+    /* WR bit can be set only after the unlock sequence. */
+    if (! unlocked || ! (con & PIC32_NVMCON_WREN))
+        con &= ~PIC32_NVMCON_WR;
+
+    nvm.con = con;
+    VALUE(NVMCON) = con;
+    if (con & PIC32_NVMCON_WR)
+        nvm_start (con & PIC32_NVMCON_NVMOP);
+}
+
+void nvm_reset()
+{
+    event_cancel (EVENT_NVM);
+    nvm.unlock = 0;
+    nvm.con = 0;
+    VALUE(NVMCON) = 0;
+    VALUE(NVMKEY) = 0;
+    VALUE(NVMADDR) = 0;
+    VALUE(NVMDATA0) = 0;
+    VALUE(NVMSRCADDR) = 0;
+#ifdef PIC32MZ
+    VALUE(NVMDATA1) = 0;
+    VALUE(NVMDATA2) = 0;
+    VALUE(NVMDATA3) = 0;
+    VALUE(NVMPWP) = 0;
+    VALUE(NVMBWP) = 0;
+#endif
+}
+
+/*
+ * Map an image file of program flash into memory.
+ * A new or short file is extended with erased flash (all ones).
+ */
+void *nvm_image (const char *filename)
+{
+    unsigned char *mem;
+    struct stat st;
+    int fd;
+
+    fd = open (filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror (filename);
+        exit (1);
+    }
+    fstat (fd, &st);
+    if (st.st_size > PROGRAM_FLASH_SIZE) {
+        fprintf (stderr, "%s: flash image is larger than %u kbytes\n",
+            filename, PROGRAM_FLASH_SIZE / 1024);
+        exit (1);
+    }
+    if (ftruncate (fd, PROGRAM_FLASH_SIZE) < 0) {
+        perror (filename);
+        exit (1);
+    }
+    mem = mmap (0, PROGRAM_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        perror (filename);
+        exit (1);
+    }
+    close (fd);
+    if (st.st_size < PROGRAM_FLASH_SIZE)
+        memset (mem + st.st_size, 0xff, PROGRAM_FLASH_SIZE - st.st_size);
+    printf ("Program flash image '%s'\n", filename);
+    return mem;
+}
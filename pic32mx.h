@@ -803,6 +803,16 @@
 /*
  * SPI Control register.
  */
+#define PIC32_SPICON_SRXISEL	0x00000003	/* Receive interrupt mode: */
+#define PIC32_SPICON_SRXISEL_EMPTY 0x00000000	/* - last word is read */
+#define PIC32_SPICON_SRXISEL_ANY   0x00000001	/* - buffer is not empty */
+#define PIC32_SPICON_SRXISEL_HALF  0x00000002	/* - buffer is half full or more */
+#define PIC32_SPICON_SRXISEL_FULL  0x00000003	/* - buffer is full */
+#define PIC32_SPICON_STXISEL	0x0000000c	/* Transmit interrupt mode: */
+#define PIC32_SPICON_STXISEL_DONE  0x00000000	/* - last transfer is shifted out */
+#define PIC32_SPICON_STXISEL_EMPTY 0x00000004	/* - buffer is empty */
+#define PIC32_SPICON_STXISEL_HALF  0x00000008	/* - buffer is half empty or more */
+#define PIC32_SPICON_STXISEL_NFUL  0x0000000c	/* - buffer is not full */
 #define PIC32_SPICON_MSTEN	0x00000020	/* Master mode */
 #define PIC32_SPICON_CKP	0x00000040      /* Idle clock is high level */
 #define PIC32_SPICON_SSEN	0x00000080      /* Slave mode: SSx pin enable */
@@ -832,7 +842,11 @@
 #define PIC32_SPISTAT_SPITBE	0x00000008      /* Transmit buffer is empty */
 #define PIC32_SPISTAT_SPIRBE    0x00000020      /* Receive buffer is empty */
 #define PIC32_SPISTAT_SPIROV	0x00000040      /* Receive overflow flag */
+#define PIC32_SPISTAT_SRMT	0x00000080      /* Shift register is empty */
+#define PIC32_SPISTAT_SPITUR	0x00000100      /* Transmit underrun */
 #define PIC32_SPISTAT_SPIBUSY	0x00000800      /* SPI is busy */
+#define PIC32_SPISTAT_TXBUFELM	0x001f0000      /* Number of words in transmit buffer */
+#define PIC32_SPISTAT_RXBUFELM	0x1f000000      /* Number of words in receive buffer */
 
 /*--------------------------------------
  * DMA controller registers.
@@ -919,6 +933,7 @@
 #define PIC32_NVMCON_WORD_PGM            1 /* Word program */
 #define PIC32_NVMCON_ROW_PGM             3 /* Row program */
 #define PIC32_NVMCON_PAGE_ERASE          4 /* Page erase */
+#define PIC32_NVMCON_PFM_ERASE           5 /* Program flash erase */
 
 #define PIC32_NVMCON_LVDSTAT    0x00000800
 #define PIC32_NVMCON_LVDERR     0x00001000
@@ -927,13 +942,86 @@
 #define PIC32_NVMCON_WR         0x00008000
 
 
+/*--------------------------------------
+ * Timer registers.
+ */
+#define T1CON		PIC32_R (0x0600) /* Control */
+#define T1CONCLR	PIC32_R (0x0604)
+#define T1CONSET	PIC32_R (0x0608)
+#define T1CONINV	PIC32_R (0x060C)
+#define TMR1		PIC32_R (0x0610) /* Counter */
+#define TMR1CLR		PIC32_R (0x0614)
+#define TMR1SET		PIC32_R (0x0618)
+#define TMR1INV		PIC32_R (0x061C)
+#define PR1		PIC32_R (0x0620) /* Period */
+#define PR1CLR		PIC32_R (0x0624)
+#define PR1SET		PIC32_R (0x0628)
+#define PR1INV		PIC32_R (0x062C)
+
+#define T2CON		PIC32_R (0x0800) /* Control */
+#define T2CONCLR	PIC32_R (0x0804)
+#define T2CONSET	PIC32_R (0x0808)
+#define T2CONINV	PIC32_R (0x080C)
+#define TMR2		PIC32_R (0x0810) /* Counter */
+#define TMR2CLR		PIC32_R (0x0814)
+#define TMR2SET		PIC32_R (0x0818)
+#define TMR2INV		PIC32_R (0x081C)
+#define PR2		PIC32_R (0x0820) /* Period */
+#define PR2CLR		PIC32_R (0x0824)
+#define PR2SET		PIC32_R (0x0828)
+#define PR2INV		PIC32_R (0x082C)
+
+#define T3CON		PIC32_R (0x0A00) /* Control */
+#define T3CONCLR	PIC32_R (0x0A04)
+#define T3CONSET	PIC32_R (0x0A08)
+#define T3CONINV	PIC32_R (0x0A0C)
+#define TMR3		PIC32_R (0x0A10) /* Counter */
+#define TMR3CLR		PIC32_R (0x0A14)
+#define TMR3SET		PIC32_R (0x0A18)
+#define TMR3INV		PIC32_R (0x0A1C)
+#define PR3		PIC32_R (0x0A20) /* Period */
+#define PR3CLR		PIC32_R (0x0A24)
+#define PR3SET		PIC32_R (0x0A28)
+#define PR3INV		PIC32_R (0x0A2C)
+
+#define T4CON		PIC32_R (0x0C00) /* Control */
+#define T4CONCLR	PIC32_R (0x0C04)
+#define T4CONSET	PIC32_R (0x0C08)
+#define T4CONINV	PIC32_R (0x0C0C)
+#define TMR4		PIC32_R (0x0C10) /* Counter */
+#define TMR4CLR		PIC32_R (0x0C14)
+#define TMR4SET		PIC32_R (0x0C18)
+#define TMR4INV		PIC32_R (0x0C1C)
+#define PR4		PIC32_R (0x0C20) /* Period */
+#define PR4CLR		PIC32_R (0x0C24)
+#define PR4SET		PIC32_R (0x0C28)
+#define PR4INV		PIC32_R (0x0C2C)
+
+#define T5CON		PIC32_R (0x0E00) /* Control */
+#define T5CONCLR	PIC32_R (0x0E04)
+#define T5CONSET	PIC32_R (0x0E08)
+#define T5CONINV	PIC32_R (0x0E0C)
+#define TMR5		PIC32_R (0x0E10) /* Counter */
+#define TMR5CLR		PIC32_R (0x0E14)
+#define TMR5SET		PIC32_R (0x0E18)
+#define TMR5INV		PIC32_R (0x0E1C)
+#define PR5		PIC32_R (0x0E20) /* Period */
+#define PR5CLR		PIC32_R (0x0E24)
+#define PR5SET		PIC32_R (0x0E28)
+#define PR5INV		PIC32_R (0x0E2C)
+
 /*
- * Timer2 registers
+ * Timer Control register.
  */
-#define T2CON 		PIC32_R (0x0800)
-#define T2CONSET 	PIC32_R (0x0808)
-#define TMR2  		PIC32_R (0x0810)
-#define PR2   		PIC32_R (0x0820)
+#define PIC32_TCON_TCS		0x0002	/* External clock source */
+#define PIC32_TCON_TSYNC	0x0004	/* Synchronize external clock (Timer1) */
+#define PIC32_TCON_T32		0x0008	/* 32-bit mode (Timer2, 4, 6, 8) */
+#define PIC32_TCON_TCKPS	0x0070	/* Prescaler select */
+#define PIC32_TCON_TGATE	0x0080	/* Gated time accumulation */
+#define PIC32_TCON_TWIP		0x0800	/* Asynchronous write in progress (Timer1) */
+#define PIC32_TCON_TWDIS	0x1000	/* Asynchronous write disable (Timer1) */
+#define PIC32_TCON_SIDL		0x2000	/* Stop in idle mode */
+#define PIC32_TCON_ON		0x8000	/* Timer is enabled */
 
 /*
  * Output compare registers
@@ -1140,6 +1140,13 @@
 #define PB7DIV          PIC32_R (0x1360)
 #define PB8DIV          PIC32_R (0x1370)
 
+/*
+ * Peripheral Bus Clock Divisor register.
+ */
+#define PIC32_PBDIV_MASK	0x007f	/* Clock divisor, minus 1 */
+#define PIC32_PBDIV_RDY		0x0800	/* Ready to accept new value */
+#define PIC32_PBDIV_ON		0x8000	/* Output clock enable */
+
 /*
  * Configuration Control register.
  */
@@ -1160,6 +1167,43 @@
 #define PIC32_CFGCON_TROEN	0x00000004 /* Trace output enable */
 #define PIC32_CFGCON_TDOEN	0x00000001 /* 2-wire JTAG protocol uses TDO */
 
+/*--------------------------------------
+ * Non-volatile memory control registers.
+ */
+#define NVMCON          PIC32_R (0x0600)
+#define NVMCONCLR       PIC32_R (0x0604)
+#define NVMCONSET       PIC32_R (0x0608)
+#define NVMCONINV       PIC32_R (0x060C)
+#define NVMKEY          PIC32_R (0x0610)
+#define NVMADDR         PIC32_R (0x0620)
+#define NVMADDRCLR      PIC32_R (0x0624)
+#define NVMADDRSET      PIC32_R (0x0628)
+#define NVMADDRINV      PIC32_R (0x062C)
+#define NVMDATA0        PIC32_R (0x0630)
+#define NVMDATA1        PIC32_R (0x0640)
+#define NVMDATA2        PIC32_R (0x0650)
+#define NVMDATA3        PIC32_R (0x0660)
+#define NVMSRCADDR      PIC32_R (0x0670)
+#define NVMPWP          PIC32_R (0x0680) /* Program flash write protect */
+#define NVMBWP          PIC32_R (0x0690) /* Boot flash write protect */
+
+#define PIC32_NVMCON_NVMOP      0x0000000F
+#define PIC32_NVMCON_NOP                 0 /* No operation */
+#define PIC32_NVMCON_WORD_PGM            1 /* Word program */
+#define PIC32_NVMCON_QUAD_PGM            2 /* Quad word program */
+#define PIC32_NVMCON_ROW_PGM             3 /* Row program */
+#define PIC32_NVMCON_PAGE_ERASE          4 /* Page erase */
+#define PIC32_NVMCON_LPFM_ERASE          5 /* Lower program flash erase */
+#define PIC32_NVMCON_UPFM_ERASE          6 /* Upper program flash erase */
+#define PIC32_NVMCON_PFM_ERASE           7 /* Program flash erase */
+
+#define PIC32_NVMCON_BFSWAP     0x00000040
+#define PIC32_NVMCON_PFSWAP     0x00000080
+#define PIC32_NVMCON_LVDERR     0x00001000
+#define PIC32_NVMCON_WRERR      0x00002000
+#define PIC32_NVMCON_WREN       0x00004000
+#define PIC32_NVMCON_WR         0x00008000
+
 /*--------------------------------------
  * A/D Converter registers.
  */
@@ -1251,6 +1295,139 @@
 #define AD1CAL4         PIC32_R (0x4b20c)
 #define AD1CAL5         PIC32_R (0x4b210)
 
+/*--------------------------------------
+ * Timer registers.
+ */
+#define T1CON		PIC32_R (0x40000) /* Control */
+#define T1CONCLR	PIC32_R (0x40004)
+#define T1CONSET	PIC32_R (0x40008)
+#define T1CONINV	PIC32_R (0x4000C)
+#define TMR1		PIC32_R (0x40010) /* Counter */
+#define TMR1CLR		PIC32_R (0x40014)
+#define TMR1SET		PIC32_R (0x40018)
+#define TMR1INV		PIC32_R (0x4001C)
+#define PR1		PIC32_R (0x40020) /* Period */
+#define PR1CLR		PIC32_R (0x40024)
+#define PR1SET		PIC32_R (0x40028)
+#define PR1INV		PIC32_R (0x4002C)
+
+#define T2CON		PIC32_R (0x40200) /* Control */
+#define T2CONCLR	PIC32_R (0x40204)
+#define T2CONSET	PIC32_R (0x40208)
+#define T2CONINV	PIC32_R (0x4020C)
+#define TMR2		PIC32_R (0x40210) /* Counter */
+#define TMR2CLR		PIC32_R (0x40214)
+#define TMR2SET		PIC32_R (0x40218)
+#define TMR2INV		PIC32_R (0x4021C)
+#define PR2		PIC32_R (0x40220) /* Period */
+#define PR2CLR		PIC32_R (0x40224)
+#define PR2SET		PIC32_R (0x40228)
+#define PR2INV		PIC32_R (0x4022C)
+
+#define T3CON		PIC32_R (0x40400) /* Control */
+#define T3CONCLR	PIC32_R (0x40404)
+#define T3CONSET	PIC32_R (0x40408)
+#define T3CONINV	PIC32_R (0x4040C)
+#define TMR3		PIC32_R (0x40410) /* Counter */
+#define TMR3CLR		PIC32_R (0x40414)
+#define TMR3SET		PIC32_R (0x40418)
+#define TMR3INV		PIC32_R (0x4041C)
+#define PR3		PIC32_R (0x40420) /* Period */
+#define PR3CLR		PIC32_R (0x40424)
+#define PR3SET		PIC32_R (0x40428)
+#define PR3INV		PIC32_R (0x4042C)
+
+#define T4CON		PIC32_R (0x40600) /* Control */
+#define T4CONCLR	PIC32_R (0x40604)
+#define T4CONSET	PIC32_R (0x40608)
+#define T4CONINV	PIC32_R (0x4060C)
+#define TMR4		PIC32_R (0x40610) /* Counter */
+#define TMR4CLR		PIC32_R (0x40614)
+#define TMR4SET		PIC32_R (0x40618)
+#define TMR4INV		PIC32_R (0x4061C)
+#define PR4		PIC32_R (0x40620) /* Period */
+#define PR4CLR		PIC32_R (0x40624)
+#define PR4SET		PIC32_R (0x40628)
+#define PR4INV		PIC32_R (0x4062C)
+
+#define T5CON		PIC32_R (0x40800) /* Control */
+#define T5CONCLR	PIC32_R (0x40804)
+#define T5CONSET	PIC32_R (0x40808)
+#define T5CONINV	PIC32_R (0x4080C)
+#define TMR5		PIC32_R (0x40810) /* Counter */
+#define TMR5CLR		PIC32_R (0x40814)
+#define TMR5SET		PIC32_R (0x40818)
+#define TMR5INV		PIC32_R (0x4081C)
+#define PR5		PIC32_R (0x40820) /* Period */
+#define PR5CLR		PIC32_R (0x40824)
+#define PR5SET		PIC32_R (0x40828)
+#define PR5INV		PIC32_R (0x4082C)
+
+#define T6CON		PIC32_R (0x40A00) /* Control */
+#define T6CONCLR	PIC32_R (0x40A04)
+#define T6CONSET	PIC32_R (0x40A08)
+#define T6CONINV	PIC32_R (0x40A0C)
+#define TMR6		PIC32_R (0x40A10) /* Counter */
+#define TMR6CLR		PIC32_R (0x40A14)
+#define TMR6SET		PIC32_R (0x40A18)
+#define TMR6INV		PIC32_R (0x40A1C)
+#define PR6		PIC32_R (0x40A20) /* Period */
+#define PR6CLR		PIC32_R (0x40A24)
+#define PR6SET		PIC32_R (0x40A28)
+#define PR6INV		PIC32_R (0x40A2C)
+
+#define T7CON		PIC32_R (0x40C00) /* Control */
+#define T7CONCLR	PIC32_R (0x40C04)
+#define T7CONSET	PIC32_R (0x40C08)
+#define T7CONINV	PIC32_R (0x40C0C)
+#define TMR7		PIC32_R (0x40C10) /* Counter */
+#define TMR7CLR		PIC32_R (0x40C14)
+#define TMR7SET		PIC32_R (0x40C18)
+#define TMR7INV		PIC32_R (0x40C1C)
+#define PR7		PIC32_R (0x40C20) /* Period */
+#define PR7CLR		PIC32_R (0x40C24)
+#define PR7SET		PIC32_R (0x40C28)
+#define PR7INV		PIC32_R (0x40C2C)
+
+#define T8CON		PIC32_R (0x40E00) /* Control */
+#define T8CONCLR	PIC32_R (0x40E04)
+#define T8CONSET	PIC32_R (0x40E08)
+#define T8CONINV	PIC32_R (0x40E0C)
+#define TMR8		PIC32_R (0x40E10) /* Counter */
+#define TMR8CLR		PIC32_R (0x40E14)
+#define TMR8SET		PIC32_R (0x40E18)
+#define TMR8INV		PIC32_R (0x40E1C)
+#define PR8		PIC32_R (0x40E20) /* Period */
+#define PR8CLR		PIC32_R (0x40E24)
+#define PR8SET		PIC32_R (0x40E28)
+#define PR8INV		PIC32_R (0x40E2C)
+
+#define T9CON		PIC32_R (0x41000) /* Control */
+#define T9CONCLR	PIC32_R (0x41004)
+#define T9CONSET	PIC32_R (0x41008)
+#define T9CONINV	PIC32_R (0x4100C)
+#define TMR9		PIC32_R (0x41010) /* Counter */
+#define TMR9CLR		PIC32_R (0x41014)
+#define TMR9SET		PIC32_R (0x41018)
+#define TMR9INV		PIC32_R (0x4101C)
+#define PR9		PIC32_R (0x41020) /* Period */
+#define PR9CLR		PIC32_R (0x41024)
+#define PR9SET		PIC32_R (0x41028)
+#define PR9INV		PIC32_R (0x4102C)
+
+/*
+ * Timer Control register.
+ */
+#define PIC32_TCON_TCS		0x0002	/* External clock source */
+#define PIC32_TCON_TSYNC	0x0004	/* Synchronize external clock (Timer1) */
+#define PIC32_TCON_T32		0x0008	/* 32-bit mode (Timer2, 4, 6, 8) */
+#define PIC32_TCON_TCKPS	0x0070	/* Prescaler select */
+#define PIC32_TCON_TGATE	0x0080	/* Gated time accumulation */
+#define PIC32_TCON_TWIP		0x0800	/* Asynchronous write in progress (Timer1) */
+#define PIC32_TCON_TWDIS	0x1000	/* Asynchronous write disable (Timer1) */
+#define PIC32_TCON_SIDL		0x2000	/* Stop in idle mode */
+#define PIC32_TCON_ON		0x8000	/* Timer is enabled */
+
 /*--------------------------------------
  * SPI registers.
  */
@@ -1365,6 +1542,16 @@
 /*
  * SPI Control register.
  */
+#define PIC32_SPICON_SRXISEL	0x00000003	/* Receive interrupt mode: */
+#define PIC32_SPICON_SRXISEL_EMPTY 0x00000000	/* - last word is read */
+#define PIC32_SPICON_SRXISEL_ANY   0x00000001	/* - buffer is not empty */
+#define PIC32_SPICON_SRXISEL_HALF  0x00000002	/* - buffer is half full or more */
+#define PIC32_SPICON_SRXISEL_FULL  0x00000003	/* - buffer is full */
+#define PIC32_SPICON_STXISEL	0x0000000c	/* Transmit interrupt mode: */
+#define PIC32_SPICON_STXISEL_DONE  0x00000000	/* - last transfer is shifted out */
+#define PIC32_SPICON_STXISEL_EMPTY 0x00000004	/* - buffer is empty */
+#define PIC32_SPICON_STXISEL_HALF  0x00000008	/* - buffer is half empty or more */
+#define PIC32_SPICON_STXISEL_NFUL  0x0000000c	/* - buffer is not full */
 #define PIC32_SPICON_MSTEN	0x00000020	/* Master mode */
 #define PIC32_SPICON_CKP	0x00000040      /* Idle clock is high level */
 #define PIC32_SPICON_SSEN	0x00000080      /* Slave mode: SSx pin enable */
@@ -1394,7 +1581,11 @@
 #define PIC32_SPISTAT_SPITBE	0x00000008      /* Transmit buffer is empty */
 #define PIC32_SPISTAT_SPIRBE    0x00000020      /* Receive buffer is empty */
 #define PIC32_SPISTAT_SPIROV	0x00000040      /* Receive overflow flag */
+#define PIC32_SPISTAT_SRMT	0x00000080      /* Shift register is empty */
+#define PIC32_SPISTAT_SPITUR	0x00000100      /* Transmit underrun */
 #define PIC32_SPISTAT_SPIBUSY	0x00000800      /* SPI is busy */
+#define PIC32_SPISTAT_TXBUFELM	0x001f0000      /* Number of words in transmit buffer */
+#define PIC32_SPISTAT_RXBUFELM	0x1f000000      /* Number of words in receive buffer */
 
 /*--------------------------------------
  * Interrupt controller registers.
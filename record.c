@@ -0,0 +1,220 @@
+/*
+ * Record and replay of external input.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * Record file is a text file:
+ *
+ *      pic32sim-record 1               - signature and version
+ *      sd0 0123456789abcdef            - hash of SD card image contents
+ *      123456 2 0d                     - cycle count, UART number, byte
+ *
+ * Input bytes are logged at the moment when uart_poll() delivers them
+ * to the UART receiver.  On replay, the bytes are delivered at exactly
+ * the same cycle counts, and input from vtty is ignored.
+ */
+#include <stdio.h>
+#include <string.h>
+#include "globals.h"
+
+#define RECORD_SIGNATURE    "pic32sim-record 1"
+#define RECORD_NSD          2           /* number of SD cards */
+
+int record_enabled;                     /* recording input */
+int replay_enabled;                     /* replaying input */
+
+static FILE *record_file;               /* record or replay file */
+static const char *record_name;         /* file name */
+static char record_buf[64*1024];        /* stdio buffer for record file */
+static uint64_t sd_hash [RECORD_NSD];   /* SD image hashes from replay file */
+static int sd_hash_valid [RECORD_NSD];
+
+static uint64_t next_cycles;            /* next input event on replay */
+static unsigned next_unit;
+static unsigned next_byte;
+static int next_valid;
+
+/*
+ * Flush the record file at exit.
+ */
+static void record_close()
+{
+    fclose (record_file);
+    record_file = 0;
+}
+
+/*
+ * Start recording input to a file.
+ */
+void record_open (const char *filename)
+{
+    record_file = fopen (filename, "w");
+    if (! record_file) {
+        perror (filename);
+        exit (1);
+    }
+    setvbuf (record_file, record_buf, _IOFBF, sizeof(record_buf));
+    fprintf (record_file, "%s\n", RECORD_SIGNATURE);
+    record_name = filename;
+    record_enabled = 1;
+    atexit (record_close);
+}
+
+/*
+ * Read next input event from replay file.
+ */
+static void replay_next()
+{
+    unsigned long long cycles;
+
+    next_valid = (fscanf (record_file, "%llu %u %x",
+        &cycles, &next_unit, &next_byte) == 3);
+    next_cycles = cycles;
+    next_unit--;
+}
+
+/*
+ * Start replaying input from a file.
+ * Read SD card hashes from the header.
+ */
+void replay_open (const char *filename)
+{
+    char line [256];
+    unsigned long long hash;
+    unsigned unit;
+    long pos;
+
+    record_file = fopen (filename, "r");
+    if (! record_file) {
+        perror (filename);
+        exit (1);
+    }
+    if (! fgets (line, sizeof(line), record_file) ||
+        strncmp (line, RECORD_SIGNATURE, strlen (RECORD_SIGNATURE)) != 0) {
+        fprintf (stderr, "%s: bad record file\n", filename);
+        exit (1);
+    }
+    for (;;) {
+        pos = ftell (record_file);
+        if (! fgets (line, sizeof(line), record_file))
+            break;
+        if (sscanf (line, "sd%u %llx", &unit, &hash) != 2) {
+            fseek (record_file, pos, SEEK_SET);
+            break;
+        }
+        if (unit < RECORD_NSD) {
+            sd_hash[unit] = hash;
+            sd_hash_valid[unit] = 1;
+        }
+    }
+    record_name = filename;
+    replay_enabled = 1;
+    replay_next();
+}
+
+/*
+ * Compute FNV-1a hash of file contents.
+ */
+static uint64_t file_hash (const char *filename)
+{
+    static unsigned char buf [64*1024];
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    FILE *fd;
+    size_t n, i;
+
+    fd = fopen (filename, "r");
+    if (! fd) {
+        perror (filename);
+        exit (1);
+    }
+    while ((n = fread (buf, 1, sizeof(buf), fd)) > 0) {
+        for (i=0; i<n; i++) {
+            hash ^= buf[i];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    fclose (fd);
+    return hash;
+}
+
+/*
+ * Record the hash of SD card image, or check it on replay.
+ */
+void record_sdcard (unsigned unit, const char *filename)
+{
+    uint64_t hash;
+
+    if (unit >= RECORD_NSD || ! filename ||
+        ! (record_enabled || replay_enabled))
+        return;
+
+    hash = file_hash (filename);
+    if (record_enabled) {
+        fprintf (record_file, "sd%u %016llx\n",
+            unit, (unsigned long long) hash);
+        return;
+    }
+    if (! sd_hash_valid[unit] || sd_hash[unit] != hash) {
+        fprintf (stderr, "%s: contents of SD card image '%s' differ from recording\n",
+            record_name, filename);
+        exit (1);
+    }
+}
+
+/*
+ * Log an input byte delivered to UART.
+ */
+void record_input (unsigned unit, unsigned byte)
+{
+    fprintf (record_file, "%llu %u %02x\n",
+        (unsigned long long) cpu_cycles(), unit+1, byte & 0xff);
+}
+
+/*
+ * Get next input byte for UART, when it's time to deliver it.
+ * Return -1 when no data.
+ */
+int replay_input (unsigned unit)
+{
+    uint64_t now;
+    int byte;
+
+    if (! next_valid || next_unit != unit)
+        return -1;
+
+    now = cpu_cycles();
+    if (next_cycles > now)
+        return -1;
+
+    if (next_cycles < now) {
+        static int diverged;
+
+        if (! diverged) {
+            fprintf (stderr, "%s: replay diverged at cycle %llu\n",
+                record_name, (unsigned long long) next_cycles);
+            diverged = 1;
+        }
+    }
+    byte = next_byte;
+    replay_next();
+    return byte;
+}
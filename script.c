@@ -0,0 +1,390 @@
+/*
+ * Script engine for automated interaction with console ports.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * Script file consists of commands, one per line:
+ *
+ *      uart N          - select UART port for following commands (default 1)
+ *      send "text"     - send text to UART input
+ *      expect "regex"  - wait for extended regular expression in UART output
+ *      timeout T       - set timeout for following expect commands
+ *      sleep T         - pause the script for a given time
+ *      exit N          - terminate simulation with given exit code
+ *
+ * Strings may contain escapes \r, \n, \t, \e, \xNN, \\ and \".
+ * Time T is a number of CPU cycles, or a wall time with
+ * suffix "s" or "ms".  Zero timeout means wait forever,
+ * zero sleep does not pause.
+ * CPU cycles measure simulated time, as cpu_cycles() does:
+ * they include cycles halted on WAIT and skipped by fast-forward,
+ * so they can exceed the number of executed instructions.
+ * Empty lines and lines starting with '#' are ignored.
+ * When the script is over, simulation continues.
+ *
+ * UART output is fed to the script directly from vtty_put_char(),
+ * and matched at the end of every simulation quantum.
+ * Patterns from --pass and --fail options are matched against
+ * output of all ports, with or without a script.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <regex.h>
+#include <time.h>
+#include "globals.h"
+
+#define SCRIPT_NUNITS   6               /* number of UART ports */
+#define SCRIPT_BUFSZ    4096            /* size of output buffer per port */
+
+enum {
+    CMD_UART,
+    CMD_SEND,
+    CMD_EXPECT,
+    CMD_TIMEOUT,
+    CMD_SLEEP,
+    CMD_EXIT,
+};
+
+typedef struct {
+    int op;                             /* command */
+    int line;                           /* line number in script */
+    unsigned value;                     /* unit number or exit code */
+    char *text;                         /* string for send or expect */
+    unsigned len;                       /* length of string */
+    regex_t regex;                      /* compiled pattern for expect */
+    uint64_t time;                      /* time for timeout or sleep */
+    int wall;                           /* time is in milliseconds */
+} command_t;
+
+int script_enabled;                     /* script is running */
+
+static const char *script_name;         /* script file name */
+static command_t *cmd;                  /* array of commands */
+static int ncmd;                        /* number of commands */
+static int pc;                          /* current command */
+static int started;                     /* current command started */
+static unsigned unit;                   /* current UART port */
+static uint64_t timeout;                /* current timeout value */
+static int timeout_wall;                /* timeout is in milliseconds */
+static uint64_t deadline;               /* when current command expires */
+
+static char output [SCRIPT_NUNITS] [SCRIPT_BUFSZ + 1];
+static unsigned output_len [SCRIPT_NUNITS];
+static int output_changed [SCRIPT_NUNITS];
+
+static regex_t pattern [2];             /* console patterns: pass and fail */
+static int pattern_valid [2];
+static int pattern_changed [SCRIPT_NUNITS];
+
+/*
+ * Current wall time in milliseconds.
+ */
+static uint64_t wall_msec()
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000ULL + now.tv_nsec / 1000000;
+}
+
+/*
+ * Parse a time value: CPU cycles, or milliseconds with a suffix.
+ */
+static int parse_time (char *arg, uint64_t *timep, int *wallp)
+{
+    char *ep;
+
+    *timep = strtoull (arg, &ep, 0);
+    *wallp = 0;
+    if (ep == arg)
+        return 0;
+    if (strcmp (ep, "s") == 0) {
+        *timep *= 1000;
+        *wallp = 1;
+    } else if (strcmp (ep, "ms") == 0) {
+        *wallp = 1;
+    } else if (*ep != 0)
+        return 0;
+    return 1;
+}
+
+/*
+ * Parse a quoted string with escapes, in place.
+ * Return the length, or -1 on error.
+ */
+static int parse_string (char *arg)
+{
+    char *src = arg, *dst = arg;
+
+    if (*src++ != '"')
+        return -1;
+    while (*src != '"') {
+        if (*src == 0)
+            return -1;
+        if (*src != '\\') {
+            *dst++ = *src++;
+            continue;
+        }
+        src++;
+        switch (*src++) {
+        case 'r':  *dst++ = '\r';   break;
+        case 'n':  *dst++ = '\n';   break;
+        case 't':  *dst++ = '\t';   break;
+        case 'e':  *dst++ = '\33';  break;
+        case '\\': *dst++ = '\\';   break;
+        case '"':  *dst++ = '"';    break;
+        case 'x':
+            *dst++ = strtoul (src, &src, 16);
+            break;
+        default:
+            /* Keep other escapes for regular expressions. */
+            *dst++ = '\\';
+            *dst++ = src[-1];
+            break;
+        }
+    }
+    *dst = 0;
+    return dst - arg;
+}
+
+/*
+ * Load script from file.
+ */
+void script_load (const char *filename)
+{
+    FILE *fd;
+    char line [1024], *p, *arg;
+    int lineno = 0, len;
+    command_t *c;
+
+    fd = fopen (filename, "r");
+    if (! fd) {
+        perror (filename);
+        exit (1);
+    }
+    script_name = filename;
+    while (fgets (line, sizeof(line), fd)) {
+        lineno++;
+        p = line + strspn (line, " \t");
+        p[strcspn (p, "\r\n")] = 0;
+        if (*p == 0 || *p == '#')
+            continue;
+
+        arg = p + strcspn (p, " \t");
+        if (*arg)
+            *arg++ = 0;
+        arg += strspn (arg, " \t");
+
+        cmd = realloc (cmd, (ncmd + 1) * sizeof (command_t));
+        if (! cmd) {
+            fprintf (stderr, "%s: out of memory\n", filename);
+            exit (1);
+        }
+        c = &cmd[ncmd++];
+        memset (c, 0, sizeof (*c));
+        c->line = lineno;
+
+        if (strcmp (p, "uart") == 0) {
+            c->op = CMD_UART;
+            c->value = strtoul (arg, 0, 0) - 1;
+            if (c->value >= SCRIPT_NUNITS)
+                goto error;
+
+        } else if (strcmp (p, "send") == 0 || strcmp (p, "expect") == 0) {
+            c->op = (*p == 's') ? CMD_SEND : CMD_EXPECT;
+            len = parse_string (arg);
+            if (len < 0)
+                goto error;
+            c->text = strdup (arg);
+            c->len = len;
+            if (c->op == CMD_EXPECT &&
+                regcomp (&c->regex, c->text, REG_EXTENDED) != 0)
+                goto error;
+
+        } else if (strcmp (p, "timeout") == 0 || strcmp (p, "sleep") == 0) {
+            c->op = (*p == 't') ? CMD_TIMEOUT : CMD_SLEEP;
+            if (! parse_time (arg, &c->time, &c->wall))
+                goto error;
+
+        } else if (strcmp (p, "exit") == 0) {
+            c->op = CMD_EXIT;
+            c->value = strtoul (arg, 0, 0);
+
+        } else {
+error:      fprintf (stderr, "%s: line %d: bad command '%s %s'\n",
+                filename, lineno, p, arg);
+            exit (1);
+        }
+    }
+    fclose (fd);
+    if (ncmd > 0)
+        script_enabled = 1;
+}
+
+/*
+ * Set a pattern of console output, which terminates
+ * the simulation with pass or fail status.
+ */
+void script_pattern (const char *regex, int fail)
+{
+    if (regcomp (&pattern[fail], regex, REG_EXTENDED | REG_NOSUB) != 0) {
+        fprintf (stderr, "Bad %s pattern: %s\n", fail ? "fail" : "pass", regex);
+        exit (1);
+    }
+    pattern_valid[fail] = 1;
+    script_enabled = 1;
+}
+
+/*
+ * Match console output against pass and fail patterns.
+ */
+static void check_patterns()
+{
+    unsigned u;
+
+    for (u=0; u<SCRIPT_NUNITS; u++) {
+        if (! pattern_changed[u])
+            continue;
+        pattern_changed[u] = 0;
+        if (pattern_valid[1] && regexec (&pattern[1], output[u], 0, 0, 0) == 0)
+            sim_exit (SIM_FAIL, "fail pattern found on uart%u", u+1);
+        if (pattern_valid[0] && regexec (&pattern[0], output[u], 0, 0, 0) == 0)
+            sim_exit (SIM_PASS, "pass pattern found on uart%u", u+1);
+    }
+}
+
+/*
+ * Receive a byte of UART output.
+ */
+void script_output (unsigned unit, int ch)
+{
+    unsigned len;
+
+    if (unit >= SCRIPT_NUNITS || ch == 0)
+        return;
+
+    len = output_len[unit];
+    if (len >= SCRIPT_BUFSZ) {
+        /* Buffer is full: drop the older half. */
+        len = SCRIPT_BUFSZ / 2;
+        memmove (output[unit], output[unit] + SCRIPT_BUFSZ - len, len);
+    }
+    output[unit][len++] = ch;
+    output[unit][len] = 0;
+    output_len[unit] = len;
+    output_changed[unit] = 1;
+    pattern_changed[unit] = 1;
+}
+
+/*
+ * Check whether the deadline of current command has passed.
+ */
+static int expired (int wall)
+{
+    if (deadline == 0)
+        return 0;
+    return (wall ? wall_msec() : cpu_cycles()) >= deadline;
+}
+
+/*
+ * Set the deadline for current command.
+ */
+static void set_deadline (uint64_t time, int wall)
+{
+    if (time == 0)
+        deadline = 0;
+    else
+        deadline = time + (wall ? wall_msec() : cpu_cycles());
+}
+
+/*
+ * Run the script: called at the end of every simulation quantum.
+ */
+void script_poll()
+{
+    command_t *c;
+    regmatch_t match;
+    unsigned len;
+
+    check_patterns();
+    while (pc < ncmd) {
+        c = &cmd[pc];
+        switch (c->op) {
+        case CMD_UART:
+            unit = c->value;
+            break;
+
+        case CMD_SEND:
+            vtty_send (unit, c->text, c->len);
+            break;
+
+        case CMD_TIMEOUT:
+            timeout = c->time;
+            timeout_wall = c->wall;
+            break;
+
+        case CMD_SLEEP:
+            if (c->time == 0) {
+                /* Nothing to wait for: a zero deadline never expires. */
+                break;
+            }
+            if (! started) {
+                started = 1;
+                set_deadline (c->time, c->wall);
+            }
+            if (! expired (c->wall))
+                return;
+            break;
+
+        case CMD_EXPECT:
+            if (! started) {
+                started = 1;
+                set_deadline (timeout, timeout_wall);
+                output_changed[unit] = 1;
+            }
+            if (output_changed[unit]) {
+                output_changed[unit] = 0;
+                if (regexec (&c->regex, output[unit], 1, &match, 0) == 0) {
+                    /* Matched: consume the output up to end of match. */
+                    len = output_len[unit] - match.rm_eo;
+                    memmove (output[unit], output[unit] + match.rm_eo, len + 1);
+                    output_len[unit] = len;
+                    break;
+                }
+            }
+            if (expired (timeout_wall)) {
+                fprintf (stderr, "\n%s: line %d: timeout waiting for \"%s\"\n",
+                    script_name, c->line, c->text);
+                sim_exit (SIM_TIMEOUT, "%s: line %d: timeout", script_name, c->line);
+            }
+            return;
+
+        case CMD_EXIT:
+            fprintf (stderr, "\n%s: line %d: exit %u\n",
+                script_name, c->line, c->value);
+            sim_exit (c->value, "%s: line %d: exit", script_name, c->line);
+        }
+        pc++;
+        started = 0;
+    }
+    script_enabled = pattern_valid[0] || pattern_valid[1];
+}
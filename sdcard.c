@@ -21,6 +21,30 @@
  * arising out of or in connection with the use or performance of
  * this software.
  */
+/*
+ * When the card is in read-multiple mode, next blocks are read
+ * in advance by a background I/O thread, into a ring of RA_BLOCKS
+ * buffers per card.  The simulation thread takes blocks from the ring,
+ * and waits only when the I/O thread has not finished the block yet.
+ * Read-ahead is cancelled by CMD_STOP and by any write to the card.
+ * A generation number protects against blocks read before cancel.
+ *
+ * Blocks of write-multiple sequence are gathered into an extent buffer,
+ * and written to the file by a single call, when the sequence ends by
+ * Stop Tran token or by any other command, or when the buffer is full.
+ * Durability is set by sdcard_sync_mode(): no fsync, fsync at exit,
+ * or fsync after every write transaction.
+ *
+ * Statistics of guest access to the cards, and histograms of host
+ * latency of image file i/o, are printed by sdcard_stats_print()
+ * as part of simulator statistics (--stats option and SIGUSR1).
+ *
+ * Timing profile of a card sets busy periods in simulated time:
+ * read access latency delays the data token, and programming of
+ * a block (plus erase latency for the first block of a write command)
+ * holds the data output low.  End of a busy period is scheduled
+ * as an event, so the guest polling loop sees it at exact time.
+ */
 #include <stdio.h>
 #include <assert.h>
 #include <sys/types.h>
@@ -28,6 +52,8 @@
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include "globals.h"
 
 //#define TRACE       printf
@@ -50,47 +76,144 @@
 #define CMD_WRITE_SINGLE    (0x40+24)
 #define CMD_WRITE_MULTIPLE  (0x40+25)
 #define CMD_APP             (0x40+55)   /* CMD55 */
+#define CMD_READ_OCR        (0x40+58)   /* CMD58 */
 
 #define DATA_START_BLOCK        0xFE    /* start data for single block */
 #define STOP_TRAN_TOKEN         0xFD    /* stop token for write multiple */
 #define WRITE_MULTIPLE_TOKEN    0xFC    /* start data for write multiple */
 
+#define RA_BLOCKS       8               /* blocks of read-ahead */
+#define WB_BYTES        (64*1024)       /* size of write extent buffer */
+#define RUN_BUCKETS     8               /* run lengths: 1, 2, 4 ... 64, more */
+#define LAT_BUCKETS     16              /* latency: 1, 2, 4 ... 16384 usec, more */
+
+enum {
+    BUSY_NONE,
+    BUSY_READ,                          /* Waiting for data token */
+    BUSY_PROGRAM,                       /* Programming a block */
+};
+
 /* SD card private data */
 struct sdcard {
     const char *name;                   /* Device name */
     unsigned kbytes;                    /* Disk size */
+    int hc;                             /* High capacity: SDHC or SDXC */
     int unit;                           /* Index (sd0 or sd1) */
     int fd;                             /* Image file */
     int select;                         /* Selected */
     int read_multiple;                  /* Read-multiple mode */
     unsigned blen;                      /* Block length */
     unsigned wbecnt;                    /* Write block erase count */
-    unsigned offset;                    /* Read/write offset */
+    off_t offset;                       /* Read/write offset */
     unsigned count;                     /* Byte count */
     unsigned limit;                     /* Reply length */
+    int busy;                           /* Busy state */
+    uint64_t ready;                     /* Cycle count at end of busy state */
+    int erase_pending;                  /* First block of write-multiple */
     unsigned char buf [1024 + 16];
+
+    /* Read-ahead, filled by I/O thread. */
+    int ra_active;                      /* Read-ahead is running */
+    unsigned ra_gen;                    /* Generation of read-ahead */
+    off_t ra_offset;                    /* Offset of first block in ring */
+    unsigned ra_first;                  /* Index of first block in ring */
+    unsigned ra_count;                  /* Number of blocks ready */
+    unsigned char ra_buf [RA_BLOCKS] [1024];
+
+    /* Write-multiple data, not yet written to the file. */
+    off_t wb_offset;                    /* Offset of extent */
+    unsigned wb_len;                    /* Bytes in extent */
+    unsigned char wb_buf [WB_BYTES];
 };
 typedef struct sdcard sdcard_t;
 
 static sdcard_t sdcard[2];
 
-unsigned sdcard_gpio_port0;     // GPIO port number of CS0 signal
-unsigned sdcard_gpio_port1;     // GPIO port number of CS1 signal
-unsigned sdcard_gpio_cs0;       // GPIO pin mask of CS0 signal
-unsigned sdcard_gpio_cs1;       // GPIO pin mask of CS1 signal
+/* Timing profile, in microseconds of simulated time */
+typedef struct {
+    const char *name;
+    unsigned read_usec;                 /* Read access latency */
+    unsigned write_usec;                /* Program time per block */
+    unsigned erase_usec;                /* Erase latency, per write command */
+} sdprofile_t;
+
+static const sdprofile_t profile_table[] = {
+    { "none",       0,      0,      0 },
+    { "class4",     800,    125,    5000 },
+    { "class10",    400,    50,     2500 },
+    { "uhs",        150,    20,     1000 },
+    { 0 },
+};
+
+static sdprofile_t profile[2];          /* Current profile, per card */
+
+/* Statistics, per card */
+typedef struct {
+    uint64_t cmd [64];                  /* Commands by number */
+    uint64_t blocks_read;               /* Blocks read by guest */
+    uint64_t blocks_written;            /* Blocks written by guest */
+    uint64_t seq;                       /* Block accesses following previous one */
+    uint64_t random;                    /* Other block accesses */
+    off_t next_offset;                  /* Offset after last block access */
+    unsigned run_len;                   /* Blocks in current multi-block run */
+    uint64_t run [RUN_BUCKETS];         /* Multi-block runs, by log2 of length */
+    uint64_t read_lat [LAT_BUCKETS];    /* Host pread time, by log2 of usec */
+    uint64_t write_lat [LAT_BUCKETS];   /* Host pwrite time */
+    uint64_t ra_waits;                  /* Waits for read-ahead block */
+    uint64_t ra_wait_nsec;              /* Time of waits for read-ahead */
+} sdstat_t;
+
+static sdstat_t sdstat[2];
+
+static pthread_t ra_thread;             /* I/O thread */
+static int ra_started;                  /* I/O thread is running */
+static unsigned ra_generation;          /* Last generation number */
+static pthread_mutex_t ra_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ra_wakeup = PTHREAD_COND_INITIALIZER;  /* Work for I/O thread */
+static pthread_cond_t ra_done = PTHREAD_COND_INITIALIZER;    /* Block is ready */
+
+static int sync_mode;                   /* When to fsync the image */
+static int flush_at_exit;               /* Exit handler installed */
+
+static int64_t time_nsec()
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * Count the host i/o time in a latency histogram.
+ * Called from both simulation and I/O threads.
+ */
+static void count_latency (uint64_t *hist, int64_t nsec)
+{
+    uint64_t usec = nsec / 1000;
+    int b = 0;
+
+    while (b < LAT_BUCKETS-1 && (usec >> b) != 0)
+        b++;
+    __atomic_fetch_add (&hist[b], 1, __ATOMIC_RELAXED);
+}
 
-static void read_data (int fd, unsigned offset,
+static void read_data (int unit, int fd, off_t offset,
     unsigned char *buf, unsigned blen)
 {
+    int64_t start = time_nsec();
+    ssize_t nbytes;
+
     /* Fill uninitialized blocks by FF: simulate real flash media. */
     memset (buf, 0xFF, blen);
 
-    if (pread (fd, buf, blen, offset) != blen) {
-        printf ("sdcard: pread failed, offset %#x\n", offset);
+    nbytes = pread (fd, buf, blen, offset);
+    count_latency (sdstat[unit].read_lat, time_nsec() - start);
+    if (nbytes != blen) {
+        printf ("sdcard: pread failed, offset %#llx\n", (long long) offset);
         return;
     }
 #if 0
-    printf ("(%#x)\n", offset);
+    printf ("(%#llx)\n", (long long) offset);
     int i, k;
     for (i=0; i<blen; i+=32) {
         for (k=0; k<32; k++) {
@@ -101,17 +224,422 @@ static void read_data (int fd, unsigned offset,
 #endif
 }
 
-static void write_data (int fd, unsigned offset,
+static void write_data (int unit, int fd, off_t offset,
     unsigned char *buf, unsigned blen)
 {
-    if (pwrite (fd, buf, blen, offset) != blen) {
-        printf ("sdcard: pwrite failed, offset %#x\n", offset);
+    int64_t start = time_nsec();
+    ssize_t nbytes;
+
+    nbytes = pwrite (fd, buf, blen, offset);
+    count_latency (sdstat[unit].write_lat, time_nsec() - start);
+    if (nbytes != blen) {
+        printf ("sdcard: pwrite failed, offset %#llx\n", (long long) offset);
         return;
     }
 }
 
+/*
+ * Offset from the argument of read/write command.
+ * High capacity cards use block addressing.
+ */
+static off_t card_offset (sdcard_t *d)
+{
+    unsigned arg = d->buf[1] << 24 | d->buf[2] << 16 |
+        d->buf[3] << 8 | d->buf[4];
+
+    if (d->hc)
+        return (off_t) arg * 512;
+    return arg;
+}
+
+/*
+ * Offset of next block for I/O thread to read,
+ * or -1 when the ring is full, or at end of image.
+ */
+static off_t ra_want (sdcard_t *d)
+{
+    off_t offset;
+
+    if (! d->ra_active || d->ra_count >= RA_BLOCKS)
+        return -1;
+    offset = d->ra_offset + (off_t) d->ra_count * d->blen;
+    if (offset + d->blen > (off_t) d->kbytes * 1024)
+        return -1;
+    return offset;
+}
+
+/*
+ * I/O thread: fill read-ahead rings of both cards.
+ */
+static void *ra_thread_main (void *arg)
+{
+    static unsigned char buf [1024];
+    sdcard_t *d;
+    off_t offset;
+    unsigned gen, blen;
+    int fd, unit;
+
+    pthread_mutex_lock (&ra_lock);
+    for (;;) {
+        d = &sdcard[0];
+        offset = ra_want (d);
+        if (offset < 0) {
+            d = &sdcard[1];
+            offset = ra_want (d);
+        }
+        if (offset < 0) {
+            pthread_cond_wait (&ra_wakeup, &ra_lock);
+            continue;
+        }
+        gen = d->ra_gen;
+        unit = d->unit;
+        fd = d->fd;
+        blen = d->blen;
+        pthread_mutex_unlock (&ra_lock);
+
+        read_data (unit, fd, offset, buf, blen);
+
+        pthread_mutex_lock (&ra_lock);
+        if (d->ra_active && d->ra_gen == gen) {
+            memcpy (d->ra_buf [(d->ra_first + d->ra_count) % RA_BLOCKS], buf, blen);
+            d->ra_count++;
+            pthread_cond_signal (&ra_done);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Start read-ahead after the current block.
+ */
+static void ra_start (sdcard_t *d)
+{
+    if (! ra_started) {
+        if (pthread_create (&ra_thread, NULL, ra_thread_main, NULL) != 0) {
+            perror ("sdcard: pthread_create");
+            exit (1);
+        }
+        ra_started = 1;
+    }
+    pthread_mutex_lock (&ra_lock);
+    d->ra_active = 1;
+    d->ra_gen = ++ra_generation;
+    d->ra_offset = d->offset + d->blen;
+    d->ra_first = 0;
+    d->ra_count = 0;
+    pthread_cond_signal (&ra_wakeup);
+    pthread_mutex_unlock (&ra_lock);
+}
+
+/*
+ * Stop read-ahead, discard the ring.
+ */
+static void ra_cancel (sdcard_t *d)
+{
+    if (! d->ra_active)
+        return;
+    pthread_mutex_lock (&ra_lock);
+    d->ra_active = 0;
+    pthread_mutex_unlock (&ra_lock);
+}
+
+/*
+ * Get the block at current offset: from read-ahead ring,
+ * or directly from the image file.
+ */
+static void read_next (sdcard_t *d, unsigned char *buf)
+{
+    pthread_mutex_lock (&ra_lock);
+    if (d->ra_active && d->ra_offset == d->offset) {
+        if (d->ra_count == 0 && ra_want (d) >= 0) {
+            int64_t start = time_nsec();
+
+            while (d->ra_count == 0 && ra_want (d) >= 0)
+                pthread_cond_wait (&ra_done, &ra_lock);
+            sdstat[d->unit].ra_waits++;
+            sdstat[d->unit].ra_wait_nsec += time_nsec() - start;
+        }
+        if (d->ra_count > 0) {
+            memcpy (buf, d->ra_buf [d->ra_first], d->blen);
+            d->ra_first = (d->ra_first + 1) % RA_BLOCKS;
+            d->ra_count--;
+            d->ra_offset += d->blen;
+            pthread_cond_signal (&ra_wakeup);
+            pthread_mutex_unlock (&ra_lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock (&ra_lock);
+    read_data (d->unit, d->fd, d->offset, buf, d->blen);
+}
+
+/*
+ * Set durability of writes: none, exit or fsync.
+ */
+void sdcard_sync_mode (const char *mode)
+{
+    if (strcmp (mode, "none") == 0)
+        sync_mode = SDCARD_SYNC_NONE;
+    else if (strcmp (mode, "exit") == 0)
+        sync_mode = SDCARD_SYNC_EXIT;
+    else if (strcmp (mode, "fsync") == 0)
+        sync_mode = SDCARD_SYNC_FSYNC;
+    else {
+        fprintf (stderr, "Bad SD sync mode: %s\n", mode);
+        exit (1);
+    }
+}
+
+/*
+ * End of write transaction: fsync the image when requested.
+ */
+static void write_done (sdcard_t *d)
+{
+    if (sync_mode == SDCARD_SYNC_FSYNC && fsync (d->fd) < 0)
+        perror ("sdcard: fsync");
+}
+
+/*
+ * Write the pending extent of write-multiple data.
+ */
+static void wb_flush (sdcard_t *d)
+{
+    if (d->wb_len == 0)
+        return;
+    write_data (d->unit, d->fd, d->wb_offset, d->wb_buf, d->wb_len);
+    TRACE ("sdcard%d: flush sector %llu, length %u bytes\n",
+        d->unit, (long long) d->wb_offset / 512, d->wb_len);
+    d->wb_len = 0;
+    write_done (d);
+}
+
+/*
+ * Add a block of write-multiple data to the extent.
+ * Start a new extent when the block is not contiguous,
+ * or when the buffer is full.
+ */
+static void wb_append (sdcard_t *d, unsigned char *buf)
+{
+    if (d->wb_len > 0 && (d->wb_offset + d->wb_len != d->offset ||
+                          d->wb_len + d->blen > WB_BYTES))
+        wb_flush (d);
+    if (d->wb_len == 0)
+        d->wb_offset = d->offset;
+    memcpy (d->wb_buf + d->wb_len, buf, d->blen);
+    d->wb_len += d->blen;
+}
+
+/*
+ * Write pending data of both cards at exit.
+ */
+static void sdcard_flush()
+{
+    int unit;
+
+    for (unit=0; unit<2; unit++) {
+        sdcard_t *d = &sdcard[unit];
+
+        if (! d->fd)
+            continue;
+        wb_flush (d);
+        if (sync_mode == SDCARD_SYNC_EXIT && fsync (d->fd) < 0)
+            perror ("sdcard: fsync");
+    }
+}
+
+/*
+ * Set timing profile by name, or as read,write,erase times in usec.
+ * Prefix "N:" selects one card, otherwise both cards are set.
+ */
+void sdcard_profile (const char *arg)
+{
+    const sdprofile_t *p;
+    sdprofile_t custom;
+    int unit = -1;
+
+    if ((arg[0] == '0' || arg[0] == '1') && arg[1] == ':') {
+        unit = arg[0] - '0';
+        arg += 2;
+    }
+    for (p=profile_table; p->name; p++)
+        if (strcmp (arg, p->name) == 0)
+            break;
+    if (! p->name) {
+        if (sscanf (arg, "%u,%u,%u", &custom.read_usec,
+            &custom.write_usec, &custom.erase_usec) != 3) {
+            fprintf (stderr, "Bad SD profile: %s\n", arg);
+            exit (1);
+        }
+        custom.name = "custom";
+        p = &custom;
+    }
+    if (unit != 1)
+        profile[0] = *p;
+    if (unit != 0)
+        profile[1] = *p;
+}
+
+/*
+ * End of busy period.
+ */
+static void card_ready (int unit)
+{
+    sdcard[unit].busy = BUSY_NONE;
+}
+
+/*
+ * Start a busy period of given length.
+ */
+static void card_busy (sdcard_t *d, int state, unsigned usec)
+{
+    if (usec == 0)
+        return;
+    d->busy = state;
+    d->ready = cpu_cycles() + (uint64_t) usec * clock_sysclk() / 1000000;
+    event_schedule (EVENT_SDCARD + d->unit, d->ready, card_ready, d->unit);
+}
+
+/*
+ * Count a block access by guest.
+ */
+static void count_block (sdcard_t *d, int write)
+{
+    sdstat_t *s = &sdstat[d->unit];
+
+    if (write)
+        s->blocks_written++;
+    else
+        s->blocks_read++;
+    if (d->offset == s->next_offset)
+        s->seq++;
+    else
+        s->random++;
+    s->next_offset = d->offset + d->blen;
+}
+
+/*
+ * End of multi-block run: count it by length.
+ */
+static void count_run (sdcard_t *d)
+{
+    sdstat_t *s = &sdstat[d->unit];
+    int b = 0;
+
+    if (s->run_len == 0)
+        return;
+    while (b < RUN_BUCKETS-1 && (1u << b) < s->run_len)
+        b++;
+    s->run[b]++;
+    s->run_len = 0;
+}
+
+/*
+ * Print a histogram with power-of-two buckets, skipping empty ones.
+ * Run lengths are labeled by upper bound, latencies by exclusive bound.
+ */
+static void print_hist (FILE *out, const char *title, const uint64_t *hist,
+    int nbuckets, int lat)
+{
+    int b, n = 0;
+
+    fprintf (out, "        %s:", title);
+    for (b=0; b<nbuckets; b++) {
+        if (hist[b] == 0)
+            continue;
+        if (b == nbuckets-1)
+            fprintf (out, " %s%u", lat ? ">=" : ">", 1u << (b-1));
+        else
+            fprintf (out, " %s%u", lat ? "<" : "", 1u << b);
+        fprintf (out, ": %llu", (unsigned long long) hist[b]);
+        n++;
+    }
+    fprintf (out, "%s\n", n ? "" : " none");
+}
+
+/*
+ * Print statistics of SD cards.
+ */
+void sdcard_stats_print (FILE *out)
+{
+    int unit, i, n;
+
+    for (unit=0; unit<2; unit++) {
+        sdstat_t *s = &sdstat[unit];
+
+        if (! sdcard[unit].fd)
+            continue;
+        fprintf (out, "    SD card %d: %llu blocks read, %llu blocks written, "
+            "%llu sequential, %llu random\n", unit,
+            (unsigned long long) s->blocks_read, (unsigned long long) s->blocks_written,
+            (unsigned long long) s->seq, (unsigned long long) s->random);
+        fprintf (out, "        Commands:");
+        n = 0;
+        for (i=0; i<64; i++) {
+            if (s->cmd[i] == 0)
+                continue;
+            fprintf (out, " CMD%d: %llu", i, (unsigned long long) s->cmd[i]);
+            n++;
+        }
+        fprintf (out, "%s\n", n ? "" : " none");
+        print_hist (out, "Multi-block runs", s->run, RUN_BUCKETS, 0);
+        print_hist (out, "Read latency, usec", s->read_lat, LAT_BUCKETS, 1);
+        print_hist (out, "Write latency, usec", s->write_lat, LAT_BUCKETS, 1);
+        fprintf (out, "        Read-ahead waits: %llu, %.3f msec\n",
+            (unsigned long long) s->ra_waits, s->ra_wait_nsec / 1e6);
+    }
+}
+
+static void json_array (FILE *out, const char *name, const uint64_t *v, int n)
+{
+    int i;
+
+    fprintf (out, ", \"%s\": [", name);
+    for (i=0; i<n; i++)
+        fprintf (out, "%s%llu", i ? ", " : "", (unsigned long long) v[i]);
+    fprintf (out, "]");
+}
+
+/*
+ * Write statistics of SD cards in JSON format, as "sdcard" member.
+ */
+void sdcard_stats_json (FILE *out)
+{
+    int unit, i, k, n = 0;
+
+    fprintf (out, "\"sdcard\": [");
+    for (unit=0; unit<2; unit++) {
+        sdstat_t *s = &sdstat[unit];
+
+        if (! sdcard[unit].fd)
+            continue;
+        fprintf (out, "%s{\"unit\": %d, \"blocks_read\": %llu, \"blocks_written\": %llu, "
+            "\"sequential\": %llu, \"random\": %llu, \"commands\": {",
+            n++ ? ", " : "", unit,
+            (unsigned long long) s->blocks_read, (unsigned long long) s->blocks_written,
+            (unsigned long long) s->seq, (unsigned long long) s->random);
+        k = 0;
+        for (i=0; i<64; i++) {
+            if (s->cmd[i] == 0)
+                continue;
+            fprintf (out, "%s\"%d\": %llu", k++ ? ", " : "", i,
+                (unsigned long long) s->cmd[i]);
+        }
+        fprintf (out, "}");
+        json_array (out, "runs", s->run, RUN_BUCKETS);
+        json_array (out, "read_latency", s->read_lat, LAT_BUCKETS);
+        json_array (out, "write_latency", s->write_lat, LAT_BUCKETS);
+        fprintf (out, ", \"readahead_waits\": %llu, \"readahead_wait_time\": %.6f}",
+            (unsigned long long) s->ra_waits, s->ra_wait_nsec / 1e9);
+    }
+    fprintf (out, "]");
+}
+
 static void card_reset (sdcard_t *d)
 {
+    wb_flush (d);
+    ra_cancel (d);
+    event_cancel (EVENT_SDCARD + d->unit);
+    d->busy = BUSY_NONE;
     d->select = 0;
     d->blen = 512;
     d->count = 0;
@@ -134,19 +662,22 @@ void sdcard_init (int unit, const char *name, const char *filename, int cs_port,
     sdcard_t *d = &sdcard[unit];
     struct stat st;
 
+    if (d->fd)
+        wb_flush (d);
+    if (! flush_at_exit) {
+        atexit (sdcard_flush);
+        flush_at_exit = 1;
+    }
+    pthread_mutex_lock (&ra_lock);
     memset (d, 0, sizeof (*d));
+    pthread_mutex_unlock (&ra_lock);
     d->name = name;
     if (! filename) {
         /* No SD card installed. */
         return;
     }
-    if (unit == 0) {
-        sdcard_gpio_port0 = cs_port;
-        sdcard_gpio_cs0 = (cs_pin >= 0) ? (1 << cs_pin) : 0;
-    } else {
-        sdcard_gpio_port1 = cs_port;
-        sdcard_gpio_cs1 = (cs_pin >= 0) ? (1 << cs_pin) : 0;
-    }
+    spi_attach (name, sdcard_spi_port, cs_port, cs_pin,
+        sdcard_select, sdcard_io, unit);
 
     d->fd = open (filename, O_RDWR);
     if (d->fd < 0) {
@@ -156,7 +687,11 @@ void sdcard_init (int unit, const char *name, const char *filename, int cs_port,
     }
     fstat (d->fd, &st);
     d->kbytes = st.st_size / 1024;
-    printf("Card%u image '%s', %d kbytes\n", unit, filename, d->kbytes);
+
+    /* Cards over 2 Gbytes are high capacity. */
+    d->hc = (d->kbytes > 2*1024*1024);
+    printf("Card%u image '%s', %u kbytes%s\n", unit, filename, d->kbytes,
+        ! d->hc ? "" : d->kbytes > 32*1024*1024 ? ", SDXC" : ", SDHC");
 }
 
 void sdcard_select (int unit, int on)
@@ -177,22 +712,43 @@ void sdcard_select (int unit, int on)
  * Data i/o: send byte to device.
  * Return received byte.
  */
-unsigned sdcard_io (unsigned data)
+unsigned sdcard_io (int unit, unsigned data)
 {
-    sdcard_t *d = sdcard[0].select ? &sdcard[0] :
-                  sdcard[1].select ? &sdcard[1] : 0;
+    sdcard_t *d = &sdcard[unit];
     unsigned reply;
 
-    if (! d || ! d->fd) {
+    if (! d->select || ! d->fd) {
         //TRACE ("sdcard: unselected i/o\n");
         return 0xFF;
     }
+    if (d->busy && cpu_cycles() >= d->ready) {
+        event_cancel (EVENT_SDCARD + d->unit);
+        d->busy = BUSY_NONE;
+    }
+    if (d->busy == BUSY_PROGRAM) {
+        /* Programming: data output is held low. */
+        return 0;
+    }
     data = (unsigned char) data;
     reply = 0xFF;
     if (d->count == 0) {
         d->buf[0] = data;
-        if (data != 0xFF)
+        if (data != 0xFF) {
             d->count++;
+
+            /* Stop Tran token or any command ends write-multiple. */
+            if (data != WRITE_MULTIPLE_TOKEN) {
+                wb_flush (d);
+                count_run (d);
+                if (d->busy == BUSY_READ) {
+                    /* Read is aborted by new command. */
+                    event_cancel (EVENT_SDCARD + d->unit);
+                    d->busy = BUSY_NONE;
+                }
+            }
+            if (data >= 0x40 && data < 0x80)
+                sdstat[d->unit].cmd [data - 0x40]++;
+        }
     } else {
         switch (d->buf[0]) {
         case CMD_GO_IDLE:               /* CMD0: reset */
@@ -223,6 +779,11 @@ unsigned sdcard_io (unsigned data)
                 break;
             d->buf [d->count++] = data;
             if (d->count == 7) {
+                reply = 0;
+                if (d->hc) {
+                    /* Block length is fixed at 512 bytes. */
+                    break;
+                }
                 d->blen = d->buf[1] << 24 | d->buf[2] << 16 |
                     d->buf[3] << 8 | d->buf[4];
                 TRACE ("sdcard%d: set block length %u bytes\n", d->unit, d->blen);
@@ -246,7 +807,9 @@ unsigned sdcard_io (unsigned data)
                 break;
             d->buf [d->count++] = data;
             if (d->count == 7) {
-                /* Send reply */
+                /* Send reply: CSD version 2.0, capacity in 512-kbyte units */
+                unsigned csize = d->kbytes / 512 - 1;
+
                 TRACE ("sdcard%d: send media size %u sectors\n",
                     d->unit, d->kbytes * 2);
                 reply = 0;
@@ -261,9 +824,9 @@ unsigned sdcard_io (unsigned data)
                 d->buf[2+4] = 0;
                 d->buf[2+5] = 0;
                 d->buf[2+6] = 0;
-                d->buf[2+7] = 0;
-                d->buf[2+8] = (d->kbytes / 512 - 1) >> 8;
-                d->buf[2+9] = d->kbytes / 512 - 1;
+                d->buf[2+7] = (csize >> 16) & 0x3f;
+                d->buf[2+8] = csize >> 8;
+                d->buf[2+9] = csize;
                 d->buf[2+10] = 0;
                 d->buf[2+11] = 0;
                 d->buf[2+12] = 0;
@@ -281,15 +844,16 @@ unsigned sdcard_io (unsigned data)
             if (d->count == 7) {
                 /* Send reply */
                 reply = 0;
-                d->offset = d->buf[1] << 24 | d->buf[2] << 16 |
-                    d->buf[3] << 8 | d->buf[4];
-                TRACE ("sdcard%d: read offset %#x, length %u bytes\n",
-                    d->unit, d->offset, d->blen);
+                d->offset = card_offset (d);
+                TRACE ("sdcard%d: read offset %#llx, length %u bytes\n",
+                    d->unit, (long long) d->offset, d->blen);
                 d->limit = d->blen + 3;
                 d->count = 1;
                 d->buf[0] = 0;
                 d->buf[1] = DATA_START_BLOCK;
-                read_data (d->fd, d->offset, &d->buf[2], d->blen);
+                read_data (d->unit, d->fd, d->offset, &d->buf[2], d->blen);
+                count_block (d, 0);
+                card_busy (d, BUSY_READ, profile[d->unit].read_usec);
                 d->buf[d->limit - 1] = 0xFF;
                 d->buf[d->limit] = 0xFF;
             }
@@ -302,17 +866,20 @@ unsigned sdcard_io (unsigned data)
                 /* Send reply */
                 reply = 0;
                 d->read_multiple = 1;
-                d->offset = d->buf[1] << 24 | d->buf[2] << 16 |
-                    d->buf[3] << 8 | d->buf[4];
-                TRACE ("sdcard%d: read offset %#x, length %u bytes\n",
-                    d->unit, d->offset, d->blen);
+                d->offset = card_offset (d);
+                TRACE ("sdcard%d: read offset %#llx, length %u bytes\n",
+                    d->unit, (long long) d->offset, d->blen);
                 d->limit = d->blen + 3;
                 d->count = 1;
                 d->buf[0] = 0;
                 d->buf[1] = DATA_START_BLOCK;
-                read_data (d->fd, d->offset, &d->buf[2], d->blen);
+                read_data (d->unit, d->fd, d->offset, &d->buf[2], d->blen);
+                count_block (d, 0);
+                card_busy (d, BUSY_READ, profile[d->unit].read_usec);
                 d->buf[d->limit - 1] = 0xFF;
                 d->buf[d->limit] = 0xFF;
+                sdstat[d->unit].run_len = 1;
+                ra_start (d);
             }
             break;
         case CMD_WRITE_SINGLE:          /* Write block */
@@ -322,16 +889,19 @@ unsigned sdcard_io (unsigned data)
             if (d->count == 7) {
                 /* Accept command */
                 reply = 0;
-                d->offset = d->buf[1] << 24 | d->buf[2] << 16 |
-                    d->buf[3] << 8 | d->buf[4];
-                TRACE ("sdcard%d: write offset %#x\n", d->unit, d->offset);
+                d->offset = card_offset (d);
+                TRACE ("sdcard%d: write offset %#llx\n", d->unit, (long long) d->offset);
             } else if (d->count == 7 + d->blen + 2 + 2) {
                 if (d->buf[7] == DATA_START_BLOCK) {
                     /* Accept data */
                     reply = 0x05;
-                    d->offset = d->buf[1] << 24 | d->buf[2] << 16 |
-                        d->buf[3] << 8 | d->buf[4];
-                    write_data (d->fd, d->offset, &d->buf[8], d->blen);
+                    d->offset = card_offset (d);
+                    ra_cancel (d);
+                    write_data (d->unit, d->fd, d->offset, &d->buf[8], d->blen);
+                    count_block (d, 1);
+                    write_done (d);
+                    card_busy (d, BUSY_PROGRAM, profile[d->unit].erase_usec +
+                        profile[d->unit].write_usec);
                     TRACE ("sdcard%d: write data, length %u bytes\n", d->unit, d->blen);
                 } else {
                     /* Reject data */
@@ -347,9 +917,9 @@ unsigned sdcard_io (unsigned data)
             if (d->count == 7) {
                 /* Accept command */
                 reply = 0;
-                d->offset = d->buf[1] << 24 | d->buf[2] << 16 |
-                    d->buf[3] << 8 | d->buf[4];
-                TRACE ("sdcard%d: write multiple offset %#x\n", d->unit, d->offset);
+                d->offset = card_offset (d);
+                TRACE ("sdcard%d: write multiple offset %#llx\n", d->unit, (long long) d->offset);
+                d->erase_pending = 1;
                 d->count = 0;
             }
             break;
@@ -360,9 +930,15 @@ unsigned sdcard_io (unsigned data)
             if (d->count == 2 + d->blen + 2) {
                 /* Accept data */
                 reply = 0x05;
-                write_data (d->fd, d->offset, &d->buf[1], d->blen);
-                TRACE ("sdcard%d: write sector %u, length %u bytes\n",
-                    d->unit, d->offset / 512, d->blen);
+                ra_cancel (d);
+                wb_append (d, &d->buf[1]);
+                count_block (d, 1);
+                sdstat[d->unit].run_len++;
+                card_busy (d, BUSY_PROGRAM, profile[d->unit].write_usec +
+                    (d->erase_pending ? profile[d->unit].erase_usec : 0));
+                d->erase_pending = 0;
+                TRACE ("sdcard%d: write sector %llu, length %u bytes\n",
+                    d->unit, (long long) d->offset / 512, d->blen);
                 d->offset += 512;
                 d->count = 0;
             }
@@ -371,15 +947,55 @@ unsigned sdcard_io (unsigned data)
             if (d->count > 1)
                 break;
             d->read_multiple = 0;
+            ra_cancel (d);
             reply = 0;
             break;
-        case CMD_SEND_IF_COND:          /* Stop read-multiple sequence */
-            if (d->count > 1)
+        case CMD_SEND_IF_COND:          /* Check voltage range */
+            if (! d->hc) {
+                /* Version 1 card: command is unknown. */
+                if (d->count > 1)
+                    break;
+                d->read_multiple = 0;
+                reply = 4;
                 break;
-            d->read_multiple = 0;
-            reply = 4;                  /* Unknown command */
+            }
+            if (d->count >= 7)
+                break;
+            d->buf [d->count++] = data;
+            if (d->count == 7) {
+                /* Reply R7: idle state, voltage accepted, check pattern */
+                reply = 1;
+                d->limit = 5;
+                d->count = 1;
+                d->buf[0] = 0;
+                d->buf[1] = 0;
+                d->buf[2] = 0;
+                d->buf[3] = 1;          /* buf[4] keeps the check pattern */
+                d->buf[5] = 0xFF;
+            }
+            break;
+        case CMD_READ_OCR:              /* Read OCR register */
+            if (d->count >= 7)
+                break;
+            d->buf [d->count++] = data;
+            if (d->count == 7) {
+                /* Reply R3: powered up, CCS bit, 2.7-3.6V */
+                reply = 0;
+                d->limit = 5;
+                d->count = 1;
+                d->buf[0] = 0;
+                d->buf[1] = d->hc ? 0xC0 : 0x80;
+                d->buf[2] = 0xFF;
+                d->buf[3] = 0x80;
+                d->buf[4] = 0;
+                d->buf[5] = 0xFF;
+            }
             break;
         case 0:                         /* Reply */
+            if (d->count == 1 && d->busy == BUSY_READ) {
+                /* Data token is not ready yet. */
+                break;
+            }
             if (d->count <= d->limit) {
                 reply = d->buf [d->count++];
                 break;
@@ -388,7 +1004,9 @@ unsigned sdcard_io (unsigned data)
                 /* Next read-multiple block. */
                 d->offset += d->blen;
                 d->count = 1;
-                read_data (d->fd, d->offset, &d->buf[2], d->blen);
+                read_next (d, &d->buf[2]);
+                count_block (d, 0);
+                sdstat[d->unit].run_len++;
                 reply = 0;
             }
             break;
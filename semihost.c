@@ -0,0 +1,352 @@
+/*
+ * Semihosting: file and console I/O for firmware via SDBBP instruction.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * Firmware requests a service from the simulator by executing
+ * the instruction "sdbbp 1", following the MIPS Unified Hosting
+ * Interface (UHI) conventions, as implemented by libgloss for newlib:
+ *
+ *      t9 (r25)        - operation code
+ *      a0...a3         - arguments
+ *      v0              - result, or -1 on error
+ *      v1              - errno value
+ *
+ * Operations:
+ *      1  exit (code)
+ *      2  open (path, flags, mode)
+ *      3  close (fd)
+ *      4  read (fd, buf, count)
+ *      5  write (fd, buf, count)
+ *      6  lseek (fd, offset, whence)
+ *      64 gettime (struct { uint32 sec, nsec; } *tp) - pic32sim extension
+ *
+ * SDBBP causes a debug exception at the debug vector.  A breakpoint
+ * on the vector catches it: the operation is performed, the debug
+ * mode is cleared and the execution resumes after the SDBBP.
+ * Buffers must reside in RAM or flash.  Relative file names are
+ * resolved in the directory given by --semihost option.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "icm/icmCpuManager.h"
+#include "globals.h"
+
+extern icmProcessorP processor;
+Uns64 read_reg (const char *name);
+void write_reg (const char *name, Uns64 value);
+
+#define SEMIHOST_VECTOR 0xbfc00480      /* debug exception vector */
+#define SEMIHOST_CODE   1               /* code of sdbbp instruction */
+#define SEMIHOST_NFILES 16              /* max open files */
+#define SEMIHOST_COST   100             /* cycles per call */
+
+#define DEBUG_DM        0x40000000      /* Debug register: debug mode */
+
+enum {
+    UHI_EXIT    = 1,
+    UHI_OPEN    = 2,
+    UHI_CLOSE   = 3,
+    UHI_READ    = 4,
+    UHI_WRITE   = 5,
+    UHI_LSEEK   = 6,
+    UHI_GETTIME = 64,
+};
+
+/*
+ * Flags of open() in newlib.
+ */
+#define NEWLIB_O_ACCMODE    0x0003
+#define NEWLIB_O_APPEND     0x0008
+#define NEWLIB_O_CREAT      0x0200
+#define NEWLIB_O_TRUNC      0x0400
+#define NEWLIB_O_EXCL       0x0800
+
+int semihost_enabled;                   /* semihosting is enabled */
+
+static int semihost_dir = AT_FDCWD;     /* directory for file names */
+static int semihost_fd [SEMIHOST_NFILES] = { 0, 1, 2, -1, -1, -1, -1, -1,
+                                          -1, -1, -1, -1, -1, -1, -1, -1 };
+
+/*
+ * Enable semihosting, with file names relative to a given directory.
+ */
+void semihost_open (const char *dirname)
+{
+    if (dirname) {
+        semihost_dir = open (dirname, O_RDONLY | O_DIRECTORY);
+        if (semihost_dir < 0) {
+            perror (dirname);
+            exit (1);
+        }
+    }
+    semihost_enabled = 1;
+}
+
+/*
+ * Set breakpoint on debug vector.
+ */
+void semihost_setup()
+{
+    if (! semihost_enabled)
+        return;
+    if (! icmSetAddressBreakpoint (processor, SEMIHOST_VECTOR)) {
+        fprintf (stderr, "Cannot set breakpoint at debug vector %08x\n",
+            SEMIHOST_VECTOR);
+        exit (1);
+    }
+}
+
+/*
+ * Get host file descriptor.
+ */
+static int host_fd (unsigned fd)
+{
+    if (fd >= SEMIHOST_NFILES)
+        return -1;
+    return semihost_fd [fd];
+}
+
+/*
+ * Copy a null-terminated string from target memory.
+ */
+static int get_string (unsigned addr, char *buf, unsigned size)
+{
+    char *p;
+    unsigned i;
+
+    for (i=0; i<size; i++) {
+        p = host_pointer (addr + i, 1, 0);
+        if (! p)
+            return 0;
+        buf[i] = *p;
+        if (*p == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int do_open (unsigned path, unsigned flags, unsigned mode)
+{
+    char name [1024];
+    int oflags, fd, result;
+
+    if (! get_string (path, name, sizeof(name))) {
+        errno = EFAULT;
+        return -1;
+    }
+    switch (flags & NEWLIB_O_ACCMODE) {
+    case 0:  oflags = O_RDONLY; break;
+    case 1:  oflags = O_WRONLY; break;
+    default: oflags = O_RDWR;   break;
+    }
+    if (flags & NEWLIB_O_APPEND) oflags |= O_APPEND;
+    if (flags & NEWLIB_O_CREAT)  oflags |= O_CREAT;
+    if (flags & NEWLIB_O_TRUNC)  oflags |= O_TRUNC;
+    if (flags & NEWLIB_O_EXCL)   oflags |= O_EXCL;
+
+    for (fd=0; fd<SEMIHOST_NFILES; fd++) {
+        if (semihost_fd [fd] < 0)
+            break;
+    }
+    if (fd >= SEMIHOST_NFILES) {
+        errno = EMFILE;
+        return -1;
+    }
+    result = openat (semihost_dir, name, oflags, mode & 0777);
+    if (result < 0)
+        return -1;
+    semihost_fd [fd] = result;
+    return fd;
+}
+
+static int do_close (unsigned fd)
+{
+    int hfd = host_fd (fd);
+
+    if (hfd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    semihost_fd [fd] = -1;
+    if (hfd <= 2) {
+        /* Keep stdin, stdout and stderr of simulator open. */
+        return 0;
+    }
+    return close (hfd);
+}
+
+/*
+ * Read into a side buffer and store the data through cpu_write_mem(),
+ * so that translated code of the target range is discarded.
+ * A short read is allowed, so one buffer per call is enough.
+ */
+static int do_read (unsigned fd, unsigned buf, unsigned count)
+{
+    int hfd = host_fd (fd);
+    static char data [4096];
+    int nread;
+
+    if (hfd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    if (! host_pointer (buf, count, 1)) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (count > sizeof(data))
+        count = sizeof(data);
+    nread = read (hfd, data, count);
+    if (nread > 0 && ! cpu_write_mem (buf, data, nread)) {
+        errno = EFAULT;
+        return -1;
+    }
+    return nread;
+}
+
+static int do_write (unsigned fd, unsigned buf, unsigned count)
+{
+    int hfd = host_fd (fd);
+    char *p = host_pointer (buf, count, 0);
+
+    if (hfd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    if (! p) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (hfd <= 2)
+        fflush (stdout);
+    return write (hfd, p, count);
+}
+
+static int do_lseek (unsigned fd, int offset, unsigned whence)
+{
+    int hfd = host_fd (fd);
+    off_t result;
+
+    if (hfd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+    result = lseek (hfd, offset, whence);
+    if (result > 0x7fffffff) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+    return result;
+}
+
+static int do_gettime (unsigned tp)
+{
+    uint32_t data [2];
+    struct timespec now;
+
+    if (! host_pointer (tp, 8, 1) || (tp & 3)) {
+        errno = EFAULT;
+        return -1;
+    }
+    clock_gettime (CLOCK_REALTIME, &now);
+    data[0] = now.tv_sec;
+    data[1] = now.tv_nsec;
+    if (! cpu_write_mem (tp, data, sizeof(data))) {
+        errno = EFAULT;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Breakpoint reached: perform semihosting call.
+ * Return 0 when the breakpoint is not ours.
+ */
+int semihost_breakpoint (unsigned *cycles)
+{
+    unsigned depc, insn, op, a0, a1, a2;
+    unsigned *p;
+    int result;
+
+    if (! semihost_enabled || icmGetPC (processor) != SEMIHOST_VECTOR)
+        return 0;
+
+    /* Check that it's our sdbbp instruction. */
+    depc = read_reg ("depc");
+    p = (unsigned*) host_pointer (depc, 4, 0);
+    if (! p)
+        return 0;
+    insn = *p;
+    if ((insn & 0xfc00003f) != 0x7000003f ||
+        ((insn >> 6) & 0xfffff) != SEMIHOST_CODE)
+        return 0;
+
+    op = read_reg ("t9");
+    a0 = read_reg ("a0");
+    a1 = read_reg ("a1");
+    a2 = read_reg ("a2");
+    errno = 0;
+    switch (op) {
+    case UHI_EXIT:
+        fflush (stdout);
+        sim_exit (a0 == 0 ? SIM_PASS : SIM_FAIL, "semihost exit %d", a0);
+    case UHI_OPEN:
+        result = do_open (a0, a1, a2);
+        break;
+    case UHI_CLOSE:
+        result = do_close (a0);
+        break;
+    case UHI_READ:
+        result = do_read (a0, a1, a2);
+        break;
+    case UHI_WRITE:
+        result = do_write (a0, a1, a2);
+        break;
+    case UHI_LSEEK:
+        result = do_lseek (a0, a1, a2);
+        break;
+    case UHI_GETTIME:
+        result = do_gettime (a0);
+        break;
+    default:
+        result = -1;
+        errno = ENOSYS;
+        break;
+    }
+    if (trace_flag)
+        printf ("--- semihost op %u (%08x, %08x, %08x) = %d\n",
+            op, a0, a1, a2, result);
+
+    write_reg ("v0", result);
+    write_reg ("v1", result < 0 ? errno : 0);
+
+    /* Leave debug mode and continue after sdbbp. */
+    write_reg ("debug", read_reg ("debug") & ~DEBUG_DM);
+    icmSetPC (processor, depc + 4);
+    *cycles = SEMIHOST_COST;
+    return 1;
+}
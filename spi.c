@@ -21,25 +21,85 @@
  * arising out of or in connection with the use or performance of
  * this software.
  */
+/*
+ * In standard mode, SPI has one word of transmit buffer and one word
+ * of receive buffer.  In enhanced buffer mode (ENHBUF), both buffers
+ * are 128-bit FIFOs: 16 words deep in 8-bit mode, 8 in 16-bit mode
+ * and 4 in 32-bit mode.  A word written to SPIxBUF is moved to the
+ * shift register, and the transfer completes after (bits * 2 * (BRG+1))
+ * periods of PBCLK.  Completion is scheduled as an event.  The status
+ * register is also updated on read, so a polling loop sees the transfer
+ * completed at exactly the right cycle.
+ *
+ * Devices are attached to SPI ports by spi_attach(), each with its own
+ * chip select signal at a GPIO pin.  Writes to LATx registers are routed
+ * to devices by a table of devices per GPIO port.  Every word is
+ * exchanged byte by byte with all selected devices on the port;
+ * with no device selected, all ones are received.  Board defaults
+ * can be overridden by --spi option, parsed by spi_config().
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
 #include "globals.h"
 
 #ifdef PIC32MX7
 #   include "pic32mx.h"
 #   define NUM_SPI      4               // number of SPI ports
+#   define SPI_IRQ_FAULT 0              // error irq offset
+#   define SPI_IRQ_TX   1               // transmitter irq offset
+#   define SPI_IRQ_RX   2               // receiver irq offset
 #endif
 
 #ifdef PIC32MZ
 #   include "pic32mz.h"
 #   define NUM_SPI      6               // number of SPI ports
+#   define SPI_IRQ_FAULT 0              // error irq offset
+#   define SPI_IRQ_RX   1               // receiver irq offset
+#   define SPI_IRQ_TX   2               // transmitter irq offset
 #endif
 
-#define SPI_IRQ_FAULT   0               // error irq offset
-#define SPI_IRQ_TX      1               // transmitter irq offset
-#define SPI_IRQ_RX      2               // receiver irq offset
+#define FIFO_SIZE       16              // max depth of enhanced buffer
+#define SPI_MAXDEV      8               // max number of SPI devices
+#define NUM_PORT        16              // max number of GPIO ports
+
+typedef struct {
+    const char *name;                   // device name
+    int unit;                           // SPI port
+    int cs_port;                        // GPIO port of chip select
+    unsigned cs_mask;                   // GPIO pin mask of chip select
+    int selected;                       // chip select is active
+    void (*select) (int arg, int on);   // chip select handler
+    unsigned (*io) (int arg, unsigned data); // byte exchange handler
+    int arg;                            // argument for handlers
+} spidev_t;
+
+typedef struct {
+    char name [16];                     // device name
+    int unit;                           // SPI port
+    int cs_port;                        // GPIO port of chip select
+    int cs_pin;                         // GPIO pin of chip select
+} spiconf_t;
 
-static unsigned spi_buf[NUM_SPI][4];    // SPI transmit and receive buffer
-static unsigned spi_rfifo[NUM_SPI];     // SPI read fifo counter
-static unsigned spi_wfifo[NUM_SPI];     // SPI write fifo counter
+static spidev_t spi_dev[SPI_MAXDEV];    // attached devices
+static int spi_ndev;
+static spidev_t *spi_port_dev[NUM_PORT][SPI_MAXDEV]; // devices by GPIO port
+static int spi_port_ndev[NUM_PORT];
+static spidev_t *spi_unit_dev[NUM_SPI][SPI_MAXDEV];  // devices by SPI port
+static int spi_unit_ndev[NUM_SPI];
+static spiconf_t spi_conf[SPI_MAXDEV];  // devices from --spi options
+static int spi_nconf;
+
+static unsigned spi_rxfifo[NUM_SPI][FIFO_SIZE]; // receive FIFO
+static unsigned spi_rxfifo_head[NUM_SPI];       // index of first word
+static unsigned spi_rxfifo_count[NUM_SPI];      // number of words
+static unsigned spi_txfifo[NUM_SPI][FIFO_SIZE]; // transmit FIFO
+static unsigned spi_txfifo_head[NUM_SPI];
+static unsigned spi_txfifo_count[NUM_SPI];
+static unsigned spi_shift[NUM_SPI];     // word in shift register
+static int spi_busy[NUM_SPI];           // transfer in progress
+static uint64_t spi_done[NUM_SPI];      // cycle count when transfer completes
+static unsigned spi_last[NUM_SPI];      // last word read from SPIxBUF
 
 unsigned sdcard_spi_port;               // SPI port number of SD card
 
@@ -76,115 +136,466 @@ static unsigned spi_stat[NUM_SPI] = {	// SPIxSTAT address
 #endif
 };
 
-unsigned spi_readbuf (int unit)
+static unsigned spi_brg[NUM_SPI] = {    // SPIxBRG address
+    SPI1BRG,
+    SPI2BRG,
+    SPI3BRG,
+    SPI4BRG,
+#ifdef PIC32MZ
+    SPI5BRG,
+    SPI6BRG,
+#endif
+};
+
+/*
+ * Depth of transmit and receive buffers.
+ */
+static unsigned spi_depth (int unit)
+{
+    unsigned con = VALUE(spi_con[unit]);
+
+    if (! (con & PIC32_SPICON_ENHBUF))
+        return 1;
+    if (con & PIC32_SPICON_MODE32)
+        return FIFO_SIZE / 4;
+    if (con & PIC32_SPICON_MODE16)
+        return FIFO_SIZE / 2;
+    return FIFO_SIZE;
+}
+
+/*
+ * Duration of one word transfer, in CPU cycles.
+ */
+static unsigned spi_word_cycles (int unit)
+{
+    unsigned con = VALUE(spi_con[unit]);
+    unsigned bits = (con & PIC32_SPICON_MODE32) ? 32 :
+                    (con & PIC32_SPICON_MODE16) ? 16 : 8;
+
+    return bits * 2 * ((VALUE(spi_brg[unit]) & 0x1fff) + 1) *
+        clock_ratio (PBCLK_SPI);
+}
+
+/*
+ * Update status bits from the state of buffers.
+ */
+static void spi_update_flags (int unit)
+{
+    unsigned depth = spi_depth (unit);
+    unsigned stat = VALUE(spi_stat[unit]);
+    unsigned rxcount = spi_rxfifo_count[unit];
+    unsigned txcount = spi_txfifo_count[unit];
+
+    stat &= ~(PIC32_SPISTAT_SPIRBF | PIC32_SPISTAT_SPITBF |
+              PIC32_SPISTAT_SPITBE | PIC32_SPISTAT_SPIRBE |
+              PIC32_SPISTAT_SRMT | PIC32_SPISTAT_SPIBUSY |
+              PIC32_SPISTAT_TXBUFELM | PIC32_SPISTAT_RXBUFELM);
+    if (rxcount >= depth)
+        stat |= PIC32_SPISTAT_SPIRBF;
+    if (rxcount == 0)
+        stat |= PIC32_SPISTAT_SPIRBE;
+    if (txcount >= depth)
+        stat |= PIC32_SPISTAT_SPITBF;
+    if (txcount == 0)
+        stat |= PIC32_SPISTAT_SPITBE;
+    if (! spi_busy[unit])
+        stat |= PIC32_SPISTAT_SRMT;
+    if (spi_busy[unit] || txcount > 0)
+        stat |= PIC32_SPISTAT_SPIBUSY;
+    stat |= txcount << 16 | rxcount << 24;
+    VALUE(spi_stat[unit]) = stat;
+}
+
+/*
+ * Raise receive interrupt according to SRXISEL mode.
+ * In standard mode, the interrupt is raised when the buffer is full.
+ */
+static void spi_rx_irq (int unit)
+{
+    unsigned depth = spi_depth (unit);
+    unsigned count = spi_rxfifo_count[unit];
+
+    if (! (VALUE(spi_con[unit]) & PIC32_SPICON_ENHBUF)) {
+        if (count < 1)
+            return;
+    } else switch (VALUE(spi_con[unit]) & PIC32_SPICON_SRXISEL) {
+    case PIC32_SPICON_SRXISEL_EMPTY:
+        /* Raised by spi_readbuf() when the last word is read. */
+        return;
+    case PIC32_SPICON_SRXISEL_ANY:
+        if (count < 1)
+            return;
+        break;
+    case PIC32_SPICON_SRXISEL_HALF:
+        if (count < depth/2)
+            return;
+        break;
+    default:
+        if (count < depth)
+            return;
+        break;
+    }
+    irq_raise (spi_irq[unit] + SPI_IRQ_RX);
+}
+
+/*
+ * Raise transmit interrupt according to STXISEL mode.
+ * In standard mode, the interrupt is raised when the buffer is empty.
+ */
+static void spi_tx_irq (int unit)
+{
+    unsigned depth = spi_depth (unit);
+    unsigned count = spi_txfifo_count[unit];
+
+    if (! (VALUE(spi_con[unit]) & PIC32_SPICON_ENHBUF)) {
+        if (count > 0)
+            return;
+    } else switch (VALUE(spi_con[unit]) & PIC32_SPICON_STXISEL) {
+    case PIC32_SPICON_STXISEL_DONE:
+        /* Last transfer is shifted out. */
+        if (count > 0 || spi_busy[unit])
+            return;
+        break;
+    case PIC32_SPICON_STXISEL_EMPTY:
+        if (count > 0)
+            return;
+        break;
+    case PIC32_SPICON_STXISEL_HALF:
+        if (count > depth/2)
+            return;
+        break;
+    default:
+        /* Transmit buffer has at least one empty space. */
+        if (count >= depth)
+            return;
+        break;
+    }
+    irq_raise (spi_irq[unit] + SPI_IRQ_TX);
+}
+
+/*
+ * Set the SPI port and chip select of a device, overriding
+ * the board configuration.  Argument is "name:N:Xn", where
+ * N is SPI port number and Xn is GPIO pin, like C4.
+ */
+void spi_config (const char *arg)
 {
-    unsigned result = spi_buf[unit][spi_rfifo[unit]];
-    
-    if (VALUE(spi_con[unit]) & PIC32_SPICON_ENHBUF) {
-	spi_rfifo[unit]++;
-	spi_rfifo[unit] &= 3;
+    spiconf_t *c = &spi_conf[spi_nconf];
+    const char *p = strchr (arg, ':');
+    unsigned unit, pin;
+    char port;
+    int len = 0;
+
+    if (! p || p == arg || p - arg >= sizeof (c->name) ||
+        sscanf (p+1, "%u:%c%u%n", &unit, &port, &pin, &len) != 3 ||
+        p[1+len] != 0 || unit < 1 || unit > NUM_SPI ||
+        toupper (port) < 'A' || toupper (port) >= 'A' + NUM_PORT || pin > 31) {
+        fprintf (stderr, "Bad SPI device: %s\n", arg);
+        exit (1);
     }
-    if (VALUE(spi_stat[unit]) & PIC32_SPISTAT_SPIRBF) {
-	VALUE(spi_stat[unit]) &= ~PIC32_SPISTAT_SPIRBF;
-	//irq_clear (spi_irq[unit] + SPI_IRQ_RX);  
+    if (spi_nconf >= SPI_MAXDEV) {
+        fprintf (stderr, "Too many SPI devices: %s\n", arg);
+        exit (1);
     }
-    return result;
+    memcpy (c->name, arg, p - arg);
+    c->name [p - arg] = 0;
+    c->unit = unit - 1;
+    c->cs_port = toupper (port) - 'A';
+    c->cs_pin = pin;
+    spi_nconf++;
 }
 
-void spi_writebuf (int unit, unsigned val)
+/*
+ * Recompute tables of devices by GPIO port and by SPI port.
+ */
+static void spi_update_tables()
+{
+    spidev_t *d;
+
+    memset (spi_port_ndev, 0, sizeof (spi_port_ndev));
+    memset (spi_unit_ndev, 0, sizeof (spi_unit_ndev));
+    for (d=spi_dev; d<spi_dev+spi_ndev; d++) {
+        spi_port_dev [d->cs_port] [spi_port_ndev [d->cs_port]++] = d;
+        spi_unit_dev [d->unit] [spi_unit_ndev [d->unit]++] = d;
+    }
+}
+
+/*
+ * Attach a device to SPI port, with chip select at given GPIO pin.
+ * Negative port or pin means the device is not connected.
+ * A device attached again with the same name is moved.
+ * Return 0 when the device is not connected.
+ */
+int spi_attach (const char *name, int unit, int cs_port, int cs_pin,
+    void (*select) (int, int), unsigned (*io) (int, unsigned), int arg)
 {
-    /* Perform SD card i/o on configured SPI port. */
-    if (unit == sdcard_spi_port) {
-        unsigned result = 0;
-
-        if (VALUE(spi_con[unit]) & PIC32_SPICON_MODE32) {
-            /* 32-bit data width */
-            result  = (unsigned char) sdcard_io (val >> 24) << 24;
-            result |= (unsigned char) sdcard_io (val >> 16) << 16;
-            result |= (unsigned char) sdcard_io (val >> 8) << 8;
-            result |= (unsigned char) sdcard_io (val);
-
-        } else if (VALUE(spi_con[unit]) & PIC32_SPICON_MODE16) {
-            /* 16-bit data width */
-            result = (unsigned char) sdcard_io (val >> 8) << 8;
-            result |= (unsigned char) sdcard_io (val);
-
-        } else {
-            /* 8-bit data width */
-            result = (unsigned char) sdcard_io (val);
+    spiconf_t *c;
+    spidev_t *d;
+
+    for (c=spi_conf; c<spi_conf+spi_nconf; c++) {
+        if (strcmp (c->name, name) == 0) {
+            unit = c->unit;
+            cs_port = c->cs_port;
+            cs_pin = c->cs_pin;
         }
-        spi_buf[unit][spi_wfifo[unit]] = result;
-    } else {
+    }
+    if (unit < 0 || cs_port < 0 || cs_pin < 0)
+        return 0;
+    if (unit >= NUM_SPI || cs_port >= NUM_PORT || cs_pin > 31) {
+        fprintf (stderr, "%s: bad SPI port or chip select\n", name);
+        exit (1);
+    }
+    for (d=spi_dev; d<spi_dev+spi_ndev; d++)
+        if (strcmp (d->name, name) == 0)
+            break;
+    if (d == spi_dev + spi_ndev) {
+        if (spi_ndev >= SPI_MAXDEV) {
+            fprintf (stderr, "%s: too many SPI devices\n", name);
+            exit (1);
+        }
+        spi_ndev++;
+    }
+    d->name = name;
+    d->unit = unit;
+    d->cs_port = cs_port;
+    d->cs_mask = 1u << cs_pin;
+    d->selected = 0;
+    d->select = select;
+    d->io = io;
+    d->arg = arg;
+    spi_update_tables();
+    return 1;
+}
+
+/*
+ * Write to LATx register: update chip select signals
+ * of devices on this GPIO port.
+ */
+void spi_chip_select (int port, unsigned lat_value)
+{
+    spidev_t *d;
+    int i, selected;
+
+    if (port >= NUM_PORT)
+        return;
+    for (i=0; i<spi_port_ndev[port]; i++) {
+        d = spi_port_dev[port][i];
+        selected = ! (lat_value & d->cs_mask);
+        if (selected == d->selected) {
+            /* Other pins of the port changed. */
+            continue;
+        }
+        d->selected = selected;
+        d->select (d->arg, selected);
+    }
+}
+
+/*
+ * Exchange one byte with all selected devices on the SPI port.
+ */
+static unsigned spi_io (int unit, unsigned data)
+{
+    unsigned result = 0xFF;
+    spidev_t *d;
+    int i;
+
+    for (i=0; i<spi_unit_ndev[unit]; i++) {
+        d = spi_unit_dev[unit][i];
+        if (d->selected)
+            result &= d->io (d->arg, data & 0xFF);
+    }
+    return result & 0xFF;
+}
+
+/*
+ * Exchange one word with the devices attached to the SPI port.
+ */
+static unsigned spi_exchange (int unit, unsigned val)
+{
+    unsigned result;
+
+    if (spi_unit_ndev[unit] == 0) {
         /* No device */
-        spi_buf[unit][spi_wfifo[unit]] = ~0;
+        return ~0;
     }
-    if (VALUE(spi_stat[unit]) & PIC32_SPISTAT_SPIRBF) {
+
+    if (VALUE(spi_con[unit]) & PIC32_SPICON_MODE32) {
+        /* 32-bit data width */
+        result  = spi_io (unit, val >> 24) << 24;
+        result |= spi_io (unit, val >> 16) << 16;
+        result |= spi_io (unit, val >> 8) << 8;
+        result |= spi_io (unit, val);
+
+    } else if (VALUE(spi_con[unit]) & PIC32_SPICON_MODE16) {
+        /* 16-bit data width */
+        result = spi_io (unit, val >> 8) << 8;
+        result |= spi_io (unit, val);
+
+    } else {
+        /* 8-bit data width */
+        result = spi_io (unit, val);
+    }
+    return result;
+}
+
+static void spi_event (int unit);
+
+/*
+ * Move next word from transmit buffer to shift register.
+ */
+static void spi_start (int unit)
+{
+    if (spi_busy[unit] || spi_txfifo_count[unit] == 0)
+        return;
+
+    spi_shift[unit] = spi_txfifo[unit][spi_txfifo_head[unit]];
+    spi_txfifo_head[unit] = (spi_txfifo_head[unit] + 1) % FIFO_SIZE;
+    spi_txfifo_count[unit]--;
+    spi_busy[unit] = 1;
+    spi_done[unit] = cpu_cycles() + spi_word_cycles (unit);
+    event_schedule (EVENT_SPI + unit, spi_done[unit], spi_event, unit);
+}
+
+/*
+ * Transfer of one word completed.
+ */
+static void spi_event (int unit)
+{
+    unsigned result = spi_exchange (unit, spi_shift[unit]);
+
+    spi_busy[unit] = 0;
+    if (spi_rxfifo_count[unit] >= spi_depth (unit)) {
+        /* Receive overflow: new data is lost. */
         VALUE(spi_stat[unit]) |= PIC32_SPISTAT_SPIROV;
-        //irq_raise (spi_irq[unit] + SPI_IRQ_FAULT);
-    } else if (VALUE(spi_con[unit]) & PIC32_SPICON_ENHBUF) {
-        spi_wfifo[unit]++;
-        spi_wfifo[unit] &= 3;
-        if (spi_wfifo[unit] == spi_rfifo[unit]) {
-            VALUE(spi_stat[unit]) |= PIC32_SPISTAT_SPIRBF;
-            //irq_raise (spi_irq[unit] + SPI_IRQ_RX);
-        }
+        irq_raise (spi_irq[unit] + SPI_IRQ_FAULT);
     } else {
-        VALUE(spi_stat[unit]) |= PIC32_SPISTAT_SPIRBF;
-        //irq_raise (spi_irq[unit] + SPI_IRQ_RX);
+        spi_rxfifo[unit][(spi_rxfifo_head[unit] + spi_rxfifo_count[unit]) %
+            FIFO_SIZE] = result;
+        spi_rxfifo_count[unit]++;
     }
+    spi_start (unit);
+    spi_update_flags (unit);
+    spi_rx_irq (unit);
+    spi_tx_irq (unit);
 }
 
+/*
+ * Complete the transfer, if its time has come.
+ * Called on access to SPI registers, before the event is run
+ * at the end of simulation quantum.
+ */
+static void spi_sync (int unit)
+{
+    if (spi_busy[unit] && cpu_cycles() >= spi_done[unit]) {
+        event_cancel (EVENT_SPI + unit);
+        spi_event (unit);
+    }
+}
+
+/*
+ * Read of SPIxSTAT register.
+ */
+void spi_poll_status (int unit)
+{
+    spi_sync (unit);
+}
+
+/*
+ * Read of SPIxBUF register.
+ * When receive buffer is empty, the last word is returned again.
+ */
+unsigned spi_readbuf (int unit)
+{
+    spi_sync (unit);
+    if (spi_rxfifo_count[unit] == 0)
+        return spi_last[unit];
+
+    spi_last[unit] = spi_rxfifo[unit][spi_rxfifo_head[unit]];
+    spi_rxfifo_head[unit] = (spi_rxfifo_head[unit] + 1) % FIFO_SIZE;
+    spi_rxfifo_count[unit]--;
+    spi_update_flags (unit);
+
+    if (spi_rxfifo_count[unit] == 0) {
+        irq_clear (spi_irq[unit] + SPI_IRQ_RX);
+        if ((VALUE(spi_con[unit]) & PIC32_SPICON_ENHBUF) &&
+            (VALUE(spi_con[unit]) & PIC32_SPICON_SRXISEL) ==
+                PIC32_SPICON_SRXISEL_EMPTY)
+            irq_raise (spi_irq[unit] + SPI_IRQ_RX);
+    }
+    return spi_last[unit];
+}
+
+/*
+ * Write to SPIxBUF register.
+ * When transmit buffer is full, the word is lost.
+ */
+void spi_writebuf (int unit, unsigned val)
+{
+    if (! (VALUE(spi_con[unit]) & PIC32_SPICON_ON))
+        return;
+
+    spi_sync (unit);
+    if (spi_txfifo_count[unit] >= spi_depth (unit))
+        return;
+
+    spi_txfifo[unit][(spi_txfifo_head[unit] + spi_txfifo_count[unit]) %
+        FIFO_SIZE] = val;
+    spi_txfifo_count[unit]++;
+    irq_clear (spi_irq[unit] + SPI_IRQ_TX);
+    spi_start (unit);
+    spi_update_flags (unit);
+    spi_tx_irq (unit);
+}
+
+/*
+ * Clear buffers and stop the transfer.
+ */
+static void spi_stop (int unit)
+{
+    spi_rxfifo_head[unit] = 0;
+    spi_rxfifo_count[unit] = 0;
+    spi_txfifo_head[unit] = 0;
+    spi_txfifo_count[unit] = 0;
+    spi_busy[unit] = 0;
+    event_cancel (EVENT_SPI + unit);
+}
+
+/*
+ * Write to SPIxCON register.
+ */
 void spi_control (int unit)
 {
     if (! (VALUE(spi_con[unit]) & PIC32_SPICON_ON)) {
 	irq_clear (spi_irq[unit] + SPI_IRQ_FAULT);
 	irq_clear (spi_irq[unit] + SPI_IRQ_RX);
 	irq_clear (spi_irq[unit] + SPI_IRQ_TX);
-	VALUE(spi_stat[unit]) = PIC32_SPISTAT_SPITBE;
-    } else if (! (VALUE(spi_con[unit]) & PIC32_SPICON_ENHBUF)) {
-	spi_rfifo[unit] = 0;
-	spi_wfifo[unit] = 0;
+        spi_stop (unit);
+	VALUE(spi_stat[unit]) = 0;
+        spi_update_flags (unit);
+        return;
     }
+    spi_sync (unit);
+    spi_update_flags (unit);
+    spi_tx_irq (unit);
 }
 
 void spi_reset()
 {
-    VALUE(SPI1CON)  = 0;
-    VALUE(SPI1STAT) = PIC32_SPISTAT_SPITBE;     // Transmit buffer is empty
-    spi_wfifo[0]    = 0;
-    spi_rfifo[0]    = 0;
-    VALUE(SPI1BRG)  = 0;
-
-    VALUE(SPI2CON)  = 0;
-    VALUE(SPI2STAT) = PIC32_SPISTAT_SPITBE;     // Transmit buffer is empty
-    spi_wfifo[1]    = 0;
-    spi_rfifo[1]    = 0;
-    VALUE(SPI2BRG)  = 0;
-
-    VALUE(SPI3CON)  = 0;
-    VALUE(SPI3STAT) = PIC32_SPISTAT_SPITBE;     // Transmit buffer is empty
-    spi_wfifo[2]    = 0;
-    spi_rfifo[2]    = 0;
-    VALUE(SPI3BRG)  = 0;
-
-    VALUE(SPI4CON)  = 0;
-    VALUE(SPI4STAT) = PIC32_SPISTAT_SPITBE;     // Transmit buffer is empty
-    spi_wfifo[3]    = 0;
-    spi_rfifo[3]    = 0;
-    VALUE(SPI4BRG)  = 0;
-#ifdef PIC32MZ
-    VALUE(SPI5CON)  = 0;
-    VALUE(SPI5STAT) = PIC32_SPISTAT_SPITBE;     // Transmit buffer is empty
-    spi_wfifo[4]    = 0;
-    spi_rfifo[4]    = 0;
-    VALUE(SPI5BRG)  = 0;
-
-    VALUE(SPI6CON)  = 0;
-    VALUE(SPI6STAT) = PIC32_SPISTAT_SPITBE;     // Transmit buffer is empty
-    spi_wfifo[5]    = 0;
-    spi_rfifo[5]    = 0;
-    VALUE(SPI6BRG)  = 0;
+    spidev_t *d;
+    int unit;
+
+    /* Devices are reset deselected. */
+    for (d=spi_dev; d<spi_dev+spi_ndev; d++)
+        d->selected = 0;
 
+    for (unit=0; unit<NUM_SPI; unit++) {
+        VALUE(spi_con[unit]) = 0;
+        VALUE(spi_stat[unit]) = 0;
+        VALUE(spi_brg[unit]) = 0;
+        spi_stop (unit);
+        spi_update_flags (unit);        // Transmit buffer is empty
+    }
+#ifdef PIC32MZ
     VALUE(SPI1CON2) = 0;
     VALUE(SPI2CON2) = 0;
     VALUE(SPI3CON2) = 0;
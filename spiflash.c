@@ -0,0 +1,343 @@
+/*
+ * SPI NOR flash memory, compatible with Winbond W25Q series.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * Flash contents are kept in an image file, mapped into memory.
+ * Reads are served directly from the mapping, and programmed or erased
+ * data go to the file.  The size of the image sets the capacity,
+ * from 64 kbytes to 16 Mbytes (3-byte addressing).
+ *
+ * Page program and erase commands are executed when the chip select
+ * is deasserted.  Then BUSY bit is set in the status register until
+ * the end of the operation, scheduled as an event.  While busy,
+ * the chip accepts only Read Status commands.
+ *
+ * Dual and quad commands are accepted in single-wire form:
+ * the data come on the same SPI port, with the same dummy bytes.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "globals.h"
+
+//#define TRACE       printf
+#ifndef TRACE
+#define TRACE(...)  /*empty*/
+#endif
+
+/*
+ * Commands.
+ */
+#define CMD_WRITE_STATUS    0x01
+#define CMD_PAGE_PROGRAM    0x02
+#define CMD_READ            0x03
+#define CMD_WRITE_DISABLE   0x04
+#define CMD_READ_STATUS1    0x05
+#define CMD_WRITE_ENABLE    0x06
+#define CMD_FAST_READ       0x0B
+#define CMD_SECTOR_ERASE    0x20        /* 4 kbytes */
+#define CMD_READ_STATUS2    0x35
+#define CMD_BLOCK_ERASE32   0x52        /* 32 kbytes */
+#define CMD_CHIP_ERASE      0x60
+#define CMD_READ_ID         0x90        /* Manufacturer/device ID */
+#define CMD_READ_ID_DUAL    0x92
+#define CMD_READ_ID_QUAD    0x94
+#define CMD_JEDEC_ID        0x9F
+#define CMD_RELEASE_PD      0xAB        /* Release power-down, device ID */
+#define CMD_POWER_DOWN      0xB9
+#define CMD_CHIP_ERASE2     0xC7
+#define CMD_BLOCK_ERASE64   0xD8        /* 64 kbytes */
+
+#define STATUS_BUSY         0x01        /* Erase or program in progress */
+#define STATUS_WEL          0x02        /* Write enable latch */
+
+#define MANUFACTURER_ID     0xEF        /* Winbond */
+#define MEMORY_TYPE         0x40        /* W25Q series */
+#define PAGE_SIZE           256
+
+/*
+ * Typical times of operations, in microseconds.
+ */
+#define TIME_PAGE_PROGRAM   400
+#define TIME_SECTOR_ERASE   45000
+#define TIME_BLOCK_ERASE32  120000
+#define TIME_BLOCK_ERASE64  150000
+#define TIME_CHIP_ERASE     40000000    /* for 16 Mbytes */
+
+typedef struct {
+    const char *name;                   /* Device name */
+    unsigned char *data;                /* Mapped image */
+    unsigned size;                      /* Capacity in bytes */
+    unsigned capacity_id;               /* log2 of size */
+    int select;                         /* Selected */
+    unsigned count;                     /* Bytes since chip select */
+    unsigned cmd;                       /* Current command */
+    unsigned addr;                      /* Address of current command */
+    unsigned status;                    /* Status register */
+    uint64_t ready;                     /* Cycle count at end of busy state */
+    int page_valid;                     /* Page buffer has data */
+    unsigned char page [PAGE_SIZE];     /* Page buffer for program */
+} flash_t;
+
+static flash_t flash;
+
+/*
+ * End of program or erase operation.
+ */
+static void flash_ready (int arg)
+{
+    flash.status &= ~(STATUS_BUSY | STATUS_WEL);
+}
+
+/*
+ * Start program or erase operation of given length.
+ */
+static void flash_busy (flash_t *f, uint64_t usec)
+{
+    f->status |= STATUS_BUSY;
+    f->ready = cpu_cycles() + usec * clock_sysclk() / 1000000;
+    event_schedule (EVENT_FLASH, f->ready, flash_ready, 0);
+}
+
+/*
+ * Erase a region of given size, aligned.
+ */
+static void flash_erase (flash_t *f, unsigned size, uint64_t usec)
+{
+    unsigned addr = f->addr & (f->size - 1) & ~(size - 1);
+
+    TRACE ("%s: erase %#x, %u bytes\n", f->name, addr, size);
+    memset (f->data + addr, 0xFF, size);
+    flash_busy (f, usec);
+}
+
+/*
+ * Chip select deasserted: execute program or erase command.
+ */
+static void flash_execute (flash_t *f)
+{
+    unsigned base, i;
+
+    if (! (f->status & STATUS_WEL) || (f->status & STATUS_BUSY))
+        return;
+
+    switch (f->cmd) {
+    case CMD_PAGE_PROGRAM:
+        if (! f->page_valid || f->count < 4)
+            break;
+        /* NOR flash: programming can only clear bits. */
+        base = f->addr & (f->size - 1) & ~(PAGE_SIZE - 1);
+        for (i=0; i<PAGE_SIZE; i++)
+            f->data [base + i] &= f->page[i];
+        TRACE ("%s: program page %#x\n", f->name, base);
+        flash_busy (f, TIME_PAGE_PROGRAM);
+        break;
+    case CMD_SECTOR_ERASE:
+        if (f->count >= 4)
+            flash_erase (f, 4096, TIME_SECTOR_ERASE);
+        break;
+    case CMD_BLOCK_ERASE32:
+        if (f->count >= 4)
+            flash_erase (f, 32768, TIME_BLOCK_ERASE32);
+        break;
+    case CMD_BLOCK_ERASE64:
+        if (f->count >= 4)
+            flash_erase (f, 65536, TIME_BLOCK_ERASE64);
+        break;
+    case CMD_CHIP_ERASE:
+    case CMD_CHIP_ERASE2:
+        f->addr = 0;
+        flash_erase (f, f->size, (uint64_t) TIME_CHIP_ERASE * f->size / (16*1024*1024));
+        break;
+    case CMD_WRITE_STATUS:
+        /* Protection bits are not implemented. */
+        f->status &= ~STATUS_WEL;
+        break;
+    }
+}
+
+/*
+ * Chip select signal.
+ */
+static void flash_select (int arg, int on)
+{
+    flash_t *f = &flash;
+
+    if (on) {
+        if (! f->select) {
+            f->select = 1;
+            f->count = 0;
+        }
+    } else if (f->select) {
+        f->select = 0;
+        if (f->count > 0)
+            flash_execute (f);
+    }
+}
+
+/*
+ * Reply to ID commands: manufacturer and device ID, alternately.
+ * Address bit 0 selects which comes first.
+ */
+static unsigned reply_id (flash_t *f, unsigned index)
+{
+    if ((index ^ f->addr) & 1)
+        return f->capacity_id - 1;
+    return MANUFACTURER_ID;
+}
+
+/*
+ * Data i/o: send byte to device.
+ * Return received byte.
+ */
+static unsigned flash_io (int arg, unsigned data)
+{
+    flash_t *f = &flash;
+    unsigned n = f->count++;
+
+    if ((f->status & STATUS_BUSY) && cpu_cycles() >= f->ready) {
+        event_cancel (EVENT_FLASH);
+        flash_ready (0);
+    }
+    if (n == 0) {
+        f->cmd = data;
+        f->addr = 0;
+        f->page_valid = 0;
+        if (f->status & STATUS_BUSY) {
+            /* Only status can be read while busy. */
+            if (data != CMD_READ_STATUS1 && data != CMD_READ_STATUS2)
+                f->cmd = 0;
+            return 0xFF;
+        }
+        switch (data) {
+        case CMD_WRITE_ENABLE:
+            f->status |= STATUS_WEL;
+            break;
+        case CMD_WRITE_DISABLE:
+            f->status &= ~STATUS_WEL;
+            break;
+        case CMD_PAGE_PROGRAM:
+            memset (f->page, 0xFF, PAGE_SIZE);
+            break;
+        }
+        return 0xFF;
+    }
+
+    /* Address bytes, most significant first. */
+    if (n <= 3)
+        f->addr = f->addr << 8 | data;
+
+    switch (f->cmd) {
+    case CMD_READ_STATUS1:
+        return f->status;
+    case CMD_READ_STATUS2:
+        return 0;
+    case CMD_JEDEC_ID:
+        return (n == 1) ? MANUFACTURER_ID :
+               (n == 2) ? MEMORY_TYPE :
+               (n == 3) ? f->capacity_id : 0xFF;
+    case CMD_READ:
+        if (n < 4)
+            break;
+        return f->data [f->addr++ & (f->size - 1)];
+    case CMD_FAST_READ:
+        if (n < 5)
+            break;
+        return f->data [f->addr++ & (f->size - 1)];
+    case CMD_READ_ID:
+        if (n < 4)
+            break;
+        return reply_id (f, n - 4);
+    case CMD_READ_ID_DUAL:
+        if (n < 5)                      /* address and mode byte */
+            break;
+        return reply_id (f, n - 5);
+    case CMD_READ_ID_QUAD:
+        if (n < 7)                      /* address, mode and 2 dummy bytes */
+            break;
+        return reply_id (f, n - 7);
+    case CMD_RELEASE_PD:
+        if (n < 4)                      /* 3 dummy bytes */
+            break;
+        return f->capacity_id - 1;
+    case CMD_PAGE_PROGRAM:
+        if (n < 4)
+            break;
+        /* Address wraps within the page. */
+        f->page [(f->addr + n - 4) % PAGE_SIZE] = data;
+        f->page_valid = 1;
+        break;
+    }
+    return 0xFF;
+}
+
+/*
+ * Initialize flash memory from image file.
+ * The device is connected to SPI port by --spi=flash:N:pin option.
+ */
+void spiflash_init (const char *filename)
+{
+    flash_t *f = &flash;
+    struct stat st;
+    int fd;
+
+    f->name = "flash";
+    fd = open (filename, O_RDWR);
+    if (fd < 0) {
+        perror (filename);
+        exit (1);
+    }
+    fstat (fd, &st);
+    f->size = st.st_size;
+    for (f->capacity_id=16; f->capacity_id<=24; f->capacity_id++)
+        if (f->size == 1u << f->capacity_id)
+            break;
+    if (f->capacity_id > 24) {
+        fprintf (stderr, "%s: size of flash image must be a power of 2, "
+            "from 64 kbytes to 16 Mbytes\n", filename);
+        exit (1);
+    }
+    f->data = mmap (0, f->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (f->data == MAP_FAILED) {
+        perror (filename);
+        exit (1);
+    }
+    close (fd);
+    printf ("Flash image '%s', %u kbytes\n", filename, f->size / 1024);
+
+    if (! spi_attach (f->name, -1, -1, -1, flash_select, flash_io, 0))
+        fprintf (stderr, "%s: not connected, use --spi=%s:N:pin option\n",
+            f->name, f->name);
+}
+
+void spiflash_reset()
+{
+    flash_t *f = &flash;
+
+    event_cancel (EVENT_FLASH);
+    f->status = 0;
+    f->count = 0;
+}
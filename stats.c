@@ -0,0 +1,206 @@
+/*
+ * Simulation statistics.
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * Counters are incremented directly by the simulator and peripherals.
+ * Statistics are printed at exit when enabled by --stats option,
+ * and any time on SIGUSR1.  With --stats=file, a line in JSON format
+ * is also appended to the file every second of wall time.
+ */
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+#include "icm/icmCpuManager.h"
+#include "globals.h"
+
+extern icmProcessorP processor;
+
+#define STATS_INTERVAL  1000000000LL    /* nsec between JSON records */
+#define STATS_CHECK     1024            /* quanta between time checks */
+
+uint64_t stat_io_read [3];              /* I/O reads: bytes, halfwords, words */
+uint64_t stat_io_write [3];             /* I/O writes */
+uint64_t stat_irq [STAT_NIRQ];          /* interrupts raised, per irq number */
+uint64_t stat_quanta;                   /* simulation quanta */
+uint64_t stat_idle_nsec;                /* wall time waiting for console input */
+uint64_t stat_vtty_in;                  /* bytes received from console */
+uint64_t stat_vtty_out;                 /* bytes sent to console */
+
+static int stats_enabled;               /* print at exit */
+static FILE *stats_file;                /* JSON records */
+static struct timespec start_wall;      /* wall time at start */
+static struct timespec start_cpu;       /* process CPU time at start */
+static int64_t last_record;             /* wall time of last JSON record */
+static unsigned check_count;            /* quanta since last time check */
+static volatile sig_atomic_t dump_requested;
+
+static int64_t elapsed (clockid_t clk, const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime (clk, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000LL +
+        now.tv_nsec - start->tv_nsec;
+}
+
+/*
+ * Print statistics in text form.
+ */
+static void stats_print()
+{
+    double wall = elapsed (CLOCK_MONOTONIC, &start_wall) / 1e9;
+    double cpu = elapsed (CLOCK_PROCESS_CPUTIME_ID, &start_cpu) / 1e9;
+    uint64_t icount = icmGetProcessorICount (processor);
+    uint64_t nread = stat_io_read[0] + stat_io_read[1] + stat_io_read[2];
+    uint64_t nwrite = stat_io_write[0] + stat_io_write[1] + stat_io_write[2];
+    int irq, n;
+
+    fprintf (stderr, "Statistics:\n");
+    fprintf (stderr, "    Instructions: %llu, cycles: %llu, quanta: %llu\n",
+        (unsigned long long) icount, (unsigned long long) cpu_cycles(),
+        (unsigned long long) stat_quanta);
+    fprintf (stderr, "    Wall time: %.3f sec, CPU time: %.3f sec, idle: %.3f sec\n",
+        wall, cpu, stat_idle_nsec / 1e9);
+    if (wall > 0)
+        fprintf (stderr, "    Speed: %.2f MIPS, %.0f I/O callbacks/sec\n",
+            icount / wall / 1e6, (nread + nwrite) / wall);
+    fprintf (stderr, "    I/O reads: %llu (byte %llu, halfword %llu, word %llu)\n",
+        (unsigned long long) nread, (unsigned long long) stat_io_read[0],
+        (unsigned long long) stat_io_read[1], (unsigned long long) stat_io_read[2]);
+    fprintf (stderr, "    I/O writes: %llu (byte %llu, halfword %llu, word %llu)\n",
+        (unsigned long long) nwrite, (unsigned long long) stat_io_write[0],
+        (unsigned long long) stat_io_write[1], (unsigned long long) stat_io_write[2]);
+    fprintf (stderr, "    Console: %llu bytes in, %llu bytes out\n",
+        (unsigned long long) stat_vtty_in, (unsigned long long) stat_vtty_out);
+    fprintf (stderr, "    Interrupts:");
+    n = 0;
+    for (irq=0; irq<STAT_NIRQ; irq++) {
+        if (stat_irq[irq] == 0)
+            continue;
+        if (n > 0 && n % 6 == 0)
+            fprintf (stderr, "\n               ");
+        fprintf (stderr, " %d: %llu", irq, (unsigned long long) stat_irq[irq]);
+        n++;
+    }
+    fprintf (stderr, "%s\n", n ? "" : " none");
+    sdcard_stats_print (stderr);
+}
+
+/*
+ * Append a record in JSON format.
+ */
+static void stats_record()
+{
+    int64_t wall = elapsed (CLOCK_MONOTONIC, &start_wall);
+    uint64_t icount = icmGetProcessorICount (processor);
+    int irq, n;
+
+    fprintf (stats_file, "{\"wall_time\": %.6f, \"cpu_time\": %.6f, "
+        "\"instructions\": %llu, \"cycles\": %llu, \"mips\": %.3f, ",
+        wall / 1e9, elapsed (CLOCK_PROCESS_CPUTIME_ID, &start_cpu) / 1e9,
+        (unsigned long long) icount, (unsigned long long) cpu_cycles(),
+        wall > 0 ? icount * 1e3 / wall : 0);
+    fprintf (stats_file, "\"io_read\": [%llu, %llu, %llu], "
+        "\"io_write\": [%llu, %llu, %llu], ",
+        (unsigned long long) stat_io_read[0], (unsigned long long) stat_io_read[1],
+        (unsigned long long) stat_io_read[2], (unsigned long long) stat_io_write[0],
+        (unsigned long long) stat_io_write[1], (unsigned long long) stat_io_write[2]);
+    fprintf (stats_file, "\"quanta\": %llu, \"idle_time\": %.6f, "
+        "\"vtty_in\": %llu, \"vtty_out\": %llu, \"irq\": {",
+        (unsigned long long) stat_quanta, stat_idle_nsec / 1e9,
+        (unsigned long long) stat_vtty_in, (unsigned long long) stat_vtty_out);
+    n = 0;
+    for (irq=0; irq<STAT_NIRQ; irq++) {
+        if (stat_irq[irq] == 0)
+            continue;
+        fprintf (stats_file, "%s\"%d\": %llu", n ? ", " : "",
+            irq, (unsigned long long) stat_irq[irq]);
+        n++;
+    }
+    fprintf (stats_file, "}, ");
+    sdcard_stats_json (stats_file);
+    fprintf (stats_file, "}\n");
+    fflush (stats_file);
+    last_record = wall;
+}
+
+static void stats_signal (int sig)
+{
+    dump_requested = 1;
+}
+
+/*
+ * Enable statistics, with optional file for JSON records.
+ */
+void stats_open (const char *filename)
+{
+    stats_enabled = 1;
+    if (filename) {
+        stats_file = fopen (filename, "a");
+        if (! stats_file) {
+            perror (filename);
+            exit (1);
+        }
+    }
+}
+
+/*
+ * Start counting time: called when simulation starts.
+ */
+void stats_start()
+{
+    clock_gettime (CLOCK_MONOTONIC, &start_wall);
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &start_cpu);
+    signal (SIGUSR1, stats_signal);
+}
+
+/*
+ * Called at the end of every simulation quantum.
+ */
+void stats_poll()
+{
+    stat_quanta++;
+    if (dump_requested) {
+        dump_requested = 0;
+        stats_print();
+    }
+    if (stats_file && ++check_count >= STATS_CHECK) {
+        check_count = 0;
+        if (elapsed (CLOCK_MONOTONIC, &start_wall) - last_record >= STATS_INTERVAL)
+            stats_record();
+    }
+}
+
+/*
+ * Print statistics at exit.
+ */
+void stats_finish()
+{
+    if (stats_file) {
+        stats_record();
+        fclose (stats_file);
+        stats_file = 0;
+    }
+    if (stats_enabled)
+        stats_print();
+}
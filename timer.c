@@ -0,0 +1,269 @@
+/*
+ * Timers 1-5 (PIC32MX) or 1-9 (PIC32MZ).
+ *
+ * Copyright (C) 2014 Serge Vakulenko <serge@vak.ru>
+ *
+ * Permission to use, copy, modify, and distribute this software
+ * and its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that the copyright notice and this
+ * permission notice and warranty disclaimer appear in supporting
+ * documentation, and that the name of the author not be used in
+ * advertising or publicity pertaining to distribution of the
+ * software without specific, written prior permission.
+ *
+ * The author disclaim all warranties with regard to this
+ * software, including all implied warranties of merchantability
+ * and fitness.  In no event shall the author be liable for any
+ * special, indirect or consequential damages or any damages
+ * whatsoever resulting from loss of use, data or profits, whether
+ * in an action of contract, negligence or other tortious action,
+ * arising out of or in connection with the use or performance of
+ * this software.
+ */
+/*
+ * Timers are not incremented: the value of TMRx is computed on read,
+ * from the cycle count when the timer was started.  Period match
+ * is scheduled as a single event, which raises the interrupt.
+ * Timer pairs 2/3, 4/5, 6/7 and 8/9 can be combined into
+ * a 32-bit timer by T32 bit of the even timer.
+ * External clock and gated mode are not supported: such a timer
+ * does not count.  Timers are clocked by PBCLK3 on PIC32MZ.
+ */
+#include <stdio.h>
+#include "globals.h"
+
+#ifdef PIC32MX7
+#   include "pic32mx.h"
+#   define NUM_TIMER    5
+#endif
+
+#ifdef PIC32MZ
+#   include "pic32mz.h"
+#   define NUM_TIMER    9
+#endif
+
+static const unsigned timer_irq[NUM_TIMER] = {  // interrupt numbers
+    PIC32_IRQ_T1, PIC32_IRQ_T2, PIC32_IRQ_T3, PIC32_IRQ_T4, PIC32_IRQ_T5,
+#ifdef PIC32MZ
+    PIC32_IRQ_T6, PIC32_IRQ_T7, PIC32_IRQ_T8, PIC32_IRQ_T9,
+#endif
+};
+static const unsigned timer_con[NUM_TIMER] = {  // TxCON address
+    T1CON, T2CON, T3CON, T4CON, T5CON,
+#ifdef PIC32MZ
+    T6CON, T7CON, T8CON, T9CON,
+#endif
+};
+static const unsigned timer_tmr[NUM_TIMER] = {  // TMRx address
+    TMR1, TMR2, TMR3, TMR4, TMR5,
+#ifdef PIC32MZ
+    TMR6, TMR7, TMR8, TMR9,
+#endif
+};
+static const unsigned timer_pr[NUM_TIMER] = {   // PRx address
+    PR1, PR2, PR3, PR4, PR5,
+#ifdef PIC32MZ
+    PR6, PR7, PR8, PR9,
+#endif
+};
+
+typedef struct {
+    int running;                        // timer is counting
+    int mode32;                         // 32-bit pair with next timer
+    unsigned irq;                       // interrupt on period match
+    unsigned div;                       // cycles per tick
+    unsigned period;                    // period register
+    unsigned max;                       // maximum counter value
+    unsigned base;                      // counter value at start
+    uint64_t start;                     // cycle count at start
+    uint64_t match;                     // cycle count of next period match
+} tmr_t;
+
+static tmr_t timer[NUM_TIMER];
+
+/*
+ * Prescaler value from TxCON register.
+ */
+static unsigned timer_prescale (int unit, unsigned con)
+{
+    static const unsigned type_a[4] = { 1, 8, 64, 256 };
+    static const unsigned type_b[8] = { 1, 2, 4, 8, 16, 32, 64, 256 };
+
+    if (unit == 0)
+        return type_a [(con >> 4) & 3];
+    return type_b [(con >> 4) & 7];
+}
+
+/*
+ * Compute current counter value.
+ */
+static unsigned timer_count (tmr_t *t)
+{
+    uint64_t ticks, wrap;
+
+    if (! t->running)
+        return t->base;
+
+    ticks = (cpu_cycles() - t->start) / t->div;
+
+    /* Ticks until the counter is reset to zero. */
+    if (t->base <= t->period)
+        wrap = (uint64_t) t->period + 1 - t->base;
+    else
+        wrap = (uint64_t) t->max + 1 - t->base;
+
+    if (ticks < wrap)
+        return t->base + ticks;
+    return (ticks - wrap) % ((uint64_t) t->period + 1);
+}
+
+/*
+ * Period match: raise the interrupt and schedule the next match.
+ */
+static void timer_event (int unit)
+{
+    tmr_t *t = &timer[unit];
+
+    irq_raise (t->irq);
+    t->match += ((uint64_t) t->period + 1) * t->div;
+    event_schedule (EVENT_TIMER + unit, t->match, timer_event, unit);
+}
+
+/*
+ * Schedule the nearest period match.
+ */
+static void timer_schedule (int unit)
+{
+    tmr_t *t = &timer[unit];
+    uint64_t ticks;
+
+    if (! t->running || t->period == 0) {
+        event_cancel (EVENT_TIMER + unit);
+        return;
+    }
+
+    /* Ticks until the counter matches the period. */
+    if (t->base <= t->period)
+        ticks = t->period - t->base;
+    else
+        ticks = (uint64_t) t->max + 1 - t->base + t->period;
+
+    t->match = t->start + ticks * t->div;
+    event_schedule (EVENT_TIMER + unit, t->match, timer_event, unit);
+}
+
+/*
+ * Update the timer state after a write to TxCON, TMRx or PRx.
+ * The counter value is saved using the old settings.
+ */
+void timer_update (int unit, int tmr_written)
+{
+    tmr_t *t;
+    unsigned con, value;
+    int was32, high = 0;
+
+    /* Odd timer of a 32-bit pair is controlled by the even one. */
+    if (unit > 0 && ! (unit & 1) && timer[unit-1].mode32) {
+        unit--;
+        high = 1;
+    }
+    t = &timer[unit];
+
+    /* Only the written half of a 32-bit counter is replaced:
+     * the other half keeps the current count. */
+    value = timer_count (t);
+    if (tmr_written) {
+        if (! t->mode32)
+            value = VALUE(timer_tmr[unit]);
+        else if (high)
+            value = (value & 0xffff) | (VALUE(timer_tmr[unit+1]) << 16);
+        else
+            value = (value & 0xffff0000) | (VALUE(timer_tmr[unit]) & 0xffff);
+    }
+    if (t->mode32) {
+        /* Keep the high half in the odd timer. */
+        VALUE(timer_tmr[unit+1]) = value >> 16;
+    }
+
+    con = VALUE(timer_con[unit]);
+    was32 = t->mode32;
+    t->mode32 = (unit & 1) && unit+1 < NUM_TIMER && (con & PIC32_TCON_T32);
+    t->running = (con & PIC32_TCON_ON) &&
+        ! (con & (PIC32_TCON_TCS | PIC32_TCON_TGATE));
+    t->div = clock_ratio (PBCLK_TIMER) * timer_prescale (unit, con);
+    if (t->mode32 && ! was32) {
+        /* Pair is joined: the odd timer holds the high half. */
+        value = (value & 0xffff) | (timer_count (&timer[unit+1]) << 16);
+    }
+    if (t->mode32) {
+        t->irq = timer_irq[unit+1];
+        t->max = 0xffffffff;
+        t->period = (VALUE(timer_pr[unit]) & 0xffff) |
+                    (VALUE(timer_pr[unit+1]) << 16);
+        event_cancel (EVENT_TIMER + unit + 1);
+    } else {
+        t->irq = timer_irq[unit];
+        t->max = 0xffff;
+        t->period = VALUE(timer_pr[unit]) & 0xffff;
+        value &= 0xffff;
+    }
+    t->base = value;
+    t->start = cpu_cycles();
+    timer_schedule (unit);
+
+    if (was32 && ! t->mode32) {
+        /* Pair is split: restart the odd timer on its own,
+         * from the high half of the count. */
+        timer[unit+1].running = 0;
+        timer[unit+1].base = VALUE(timer_tmr[unit+1]);
+        timer_update (unit+1, 0);
+    }
+}
+
+/*
+ * Read of TMRx register.
+ */
+unsigned timer_read (int unit)
+{
+    unsigned value;
+
+    if (unit > 0 && ! (unit & 1) && timer[unit-1].mode32) {
+        /* High half of 32-bit counter. */
+        value = timer_count (&timer[unit-1]) >> 16;
+    } else {
+        value = timer_count (&timer[unit]);
+        if (timer[unit].mode32)
+            value &= 0xffff;
+    }
+    VALUE(timer_tmr[unit]) = value;
+    return value;
+}
+
+/*
+ * Clock frequency changed: restart all running timers.
+ */
+void timer_clock_changed()
+{
+    int unit;
+
+    for (unit=0; unit<NUM_TIMER; unit++) {
+        if (timer[unit].running)
+            timer_update (unit, 0);
+    }
+}
+
+void timer_reset()
+{
+    int unit;
+
+    for (unit=0; unit<NUM_TIMER; unit++) {
+        VALUE(timer_con[unit]) = 0;
+        VALUE(timer_tmr[unit]) = 0;
+        VALUE(timer_pr[unit])  = 0xffff;
+        timer[unit].running = 0;
+        timer[unit].mode32 = 0;
+        timer[unit].base = 0;
+        event_cancel (EVENT_TIMER + unit);
+    }
+}
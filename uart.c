@@ -45,14 +45,220 @@ static unsigned uart_irq[NUM_UART] = {  // UART interrupt numbers
     PIC32_IRQ_U5E,
     PIC32_IRQ_U6E,
 };
-static int uart_oactive[NUM_UART];      // UART output active
-static int uart_odelay[NUM_UART];       // UART output delay count
 static unsigned uart_sta[NUM_UART] =    // UxSTA address
     { U1STA, U2STA, U3STA, U4STA, U5STA, U6STA };
 static unsigned uart_mode[NUM_UART] =    // UxMODE address
     { U1MODE, U2MODE, U3MODE, U4MODE, U5MODE, U6MODE };
+static unsigned uart_brg[NUM_UART] =    // UxBRG address
+    { U1BRG, U2BRG, U3BRG, U4BRG, U5BRG, U6BRG };
 
-#define OUTPUT_DELAY 3
+#define FIFO_SIZE       8               // depth of hardware FIFOs
+#define RXQ_SIZE        256             // size of receive queue
+
+/*
+ * Receive queue: bytes delivered to UART by uart_poll(),
+ * at deterministic points of simulation.  From the queue,
+ * bytes are moved to the receive FIFO at the baud rate.
+ */
+static unsigned char uart_rxq[NUM_UART][RXQ_SIZE];
+static unsigned uart_rxq_first[NUM_UART];
+static unsigned uart_rxq_count[NUM_UART];
+
+static unsigned char uart_rxfifo[NUM_UART][FIFO_SIZE];
+static unsigned uart_rxfifo_first[NUM_UART];
+static unsigned uart_rxfifo_count[NUM_UART];
+static int uart_rx_busy[NUM_UART];      // receiving a byte
+
+static unsigned uart_txfifo_count[NUM_UART]; // bytes not yet transmitted
+
+int uart_infinite_baud;                 // transfer bytes instantly
+
+static FILE *uart_capture;              // capture file for output
+static char uart_capture_buf[64*1024];  // stdio buffer for capture file
+
+/*
+ * Flush the capture file at exit.
+ */
+static void uart_capture_close()
+{
+    fclose (uart_capture);
+    uart_capture = 0;
+}
+
+/*
+ * Open a file for capture of UART output.
+ * Every byte is logged as a line: cycle count, unit number
+ * and byte value in hex.  The file is flushed at exit.
+ */
+void uart_capture_open (const char *filename)
+{
+    uart_capture = fopen (filename, "w");
+    if (! uart_capture) {
+        perror (filename);
+        exit (1);
+    }
+    setvbuf (uart_capture, uart_capture_buf, _IOFBF, sizeof(uart_capture_buf));
+    fprintf (uart_capture, "# cycles uart byte\n");
+    atexit (uart_capture_close);
+}
+
+/*
+ * Time to transfer one byte, in CPU cycles.
+ * Frame has a start bit, 8 or 9 data bits,
+ * optional parity bit and 1 or 2 stop bits.
+ */
+static uint64_t uart_byte_cycles (int unit)
+{
+    unsigned mode = VALUE(uart_mode[unit]);
+    unsigned bits = 10;
+
+    if (uart_infinite_baud)
+        return 0;
+    if (mode & PIC32_UMODE_PDSEL)
+        bits++;
+    if (mode & PIC32_UMODE_STSEL)
+        bits++;
+    return (uint64_t) bits * ((mode & PIC32_UMODE_BRGH) ? 4 : 16) *
+        ((VALUE(uart_brg[unit]) & 0xffff) + 1) * clock_ratio (PBCLK_UART);
+}
+
+/*
+ * Update status bits from the state of FIFOs.
+ */
+static void uart_update_flags (int unit)
+{
+    unsigned sta = VALUE(uart_sta[unit]);
+
+    sta &= ~(PIC32_USTA_URXDA | PIC32_USTA_RIDLE |
+             PIC32_USTA_TRMT | PIC32_USTA_UTXBF);
+    if (uart_rxfifo_count[unit] > 0)
+        sta |= PIC32_USTA_URXDA;
+    if (! uart_rx_busy[unit])
+        sta |= PIC32_USTA_RIDLE;
+    if (uart_txfifo_count[unit] == 0)
+        sta |= PIC32_USTA_TRMT;
+    if (uart_txfifo_count[unit] >= FIFO_SIZE)
+        sta |= PIC32_USTA_UTXBF;
+    VALUE(uart_sta[unit]) = sta;
+}
+
+/*
+ * Raise receive interrupt when FIFO reaches the URXISEL threshold.
+ */
+static void uart_rx_irq (int unit)
+{
+    unsigned count = uart_rxfifo_count[unit];
+
+    switch (VALUE(uart_sta[unit]) & PIC32_USTA_URXISEL) {
+    case PIC32_USTA_URXISEL_NEMP:
+        if (count < 1)
+            return;
+        break;
+    case PIC32_USTA_URXISEL_HALF:
+        if (count < FIFO_SIZE/2)
+            return;
+        break;
+    default:
+        if (count < FIFO_SIZE*3/4)
+            return;
+        break;
+    }
+    irq_raise (uart_irq[unit] + UART_IRQ_RX);
+}
+
+/*
+ * Raise transmit interrupt according to UTXISEL mode.
+ */
+static void uart_tx_irq (int unit)
+{
+    unsigned count = uart_txfifo_count[unit];
+
+    switch (VALUE(uart_sta[unit]) & PIC32_USTA_UTXISEL) {
+    case PIC32_USTA_UTXISEL_1:
+        /* Transmit buffer has at least one empty space. */
+        if (count >= FIFO_SIZE)
+            return;
+        break;
+    case PIC32_USTA_UTXISEL_EMP:
+        /* Transmit buffer is empty, last byte is in shift register. */
+        if (count > 1)
+            return;
+        break;
+    default:
+        /* All characters have been transmitted. */
+        if (count > 0)
+            return;
+        break;
+    }
+    irq_raise (uart_irq[unit] + UART_IRQ_TX);
+}
+
+static void uart_rx_event (int unit);
+
+/*
+ * Move one byte from receive queue to FIFO.
+ */
+static void uart_rx_move (int unit)
+{
+    unsigned last = (uart_rxfifo_first[unit] + uart_rxfifo_count[unit]) % FIFO_SIZE;
+
+    uart_rxfifo[unit][last] = uart_rxq[unit][uart_rxq_first[unit]];
+    uart_rxfifo_count[unit]++;
+    uart_rxq_first[unit] = (uart_rxq_first[unit] + 1) % RXQ_SIZE;
+    uart_rxq_count[unit]--;
+}
+
+/*
+ * Start receiving, when data is pending and receiver is idle.
+ */
+static void uart_rx_start (int unit)
+{
+    if (uart_rx_busy[unit] || uart_rxq_count[unit] == 0 ||
+        uart_rxfifo_count[unit] >= FIFO_SIZE)
+        return;
+
+    if (uart_infinite_baud) {
+        /* Fill the FIFO instantly. */
+        while (uart_rxq_count[unit] > 0 && uart_rxfifo_count[unit] < FIFO_SIZE)
+            uart_rx_move (unit);
+        uart_rx_irq (unit);
+    } else {
+        uart_rx_busy[unit] = 1;
+        event_schedule (EVENT_UART_RX + unit,
+            cpu_cycles() + uart_byte_cycles (unit), uart_rx_event, unit);
+    }
+    uart_update_flags (unit);
+}
+
+/*
+ * Receive of one byte completed.
+ */
+static void uart_rx_event (int unit)
+{
+    uart_rx_busy[unit] = 0;
+    if (uart_rxq_count[unit] > 0 && uart_rxfifo_count[unit] < FIFO_SIZE)
+        uart_rx_move (unit);
+    uart_rx_irq (unit);
+
+    /* Start receiving next byte, if there is room in FIFO. */
+    uart_rx_start (unit);
+    uart_update_flags (unit);
+}
+
+/*
+ * Transmit of one byte completed.
+ */
+static void uart_tx_event (int unit)
+{
+    if (uart_txfifo_count[unit] > 0)
+        uart_txfifo_count[unit]--;
+    if (uart_txfifo_count[unit] > 0) {
+        event_schedule (EVENT_UART_TX + unit,
+            cpu_cycles() + uart_byte_cycles (unit), uart_tx_event, unit);
+    }
+    uart_update_flags (unit);
+    uart_tx_irq (unit);
+}
 
 /*
  * Read of UxRXREG register.
@@ -61,16 +267,20 @@ unsigned uart_get_char (int unit)
 {
     unsigned value;
 
-    // Read a byte from input queue
-    value = vtty_get_char (unit);
-    VALUE(uart_sta[unit]) &= ~PIC32_USTA_URXDA;
+    // Read a byte from receive FIFO
+    if (uart_rxfifo_count[unit] == 0)
+        return -1;
+    value = uart_rxfifo[unit][uart_rxfifo_first[unit]];
+    uart_rxfifo_first[unit] = (uart_rxfifo_first[unit] + 1) % FIFO_SIZE;
+    uart_rxfifo_count[unit]--;
 
-    if (vtty_is_char_avail (unit)) {
-        // One more byte available
-        VALUE(uart_sta[unit]) |= PIC32_USTA_URXDA;
-    } else {
+    if (uart_rxfifo_count[unit] == 0)
         irq_clear (uart_irq[unit] + UART_IRQ_RX);
-    }
+
+    // Room in FIFO: continue receiving
+    if (VALUE(uart_mode[unit]) & PIC32_UMODE_ON)
+        uart_rx_start (unit);
+    uart_update_flags (unit);
     return value;
 }
 
@@ -79,14 +289,7 @@ unsigned uart_get_char (int unit)
  */
 void uart_poll_status (int unit)
 {
-    // Keep receiver idle, transmit shift register always empty
-    VALUE(uart_sta[unit]) |= PIC32_USTA_RIDLE | PIC32_USTA_TRMT;
-
-    if (vtty_is_char_avail (unit)) {
-        // Receive data available
-        VALUE(uart_sta[unit]) |= PIC32_USTA_URXDA;
-    }
-    //printf ("<%x>", VALUE(uart_sta[unit])); fflush (stdout);
+    uart_update_flags (unit);
 }
 
 /*
@@ -94,15 +297,55 @@ void uart_poll_status (int unit)
  */
 void uart_put_char (int unit, unsigned data)
 {
+    if (! (VALUE(uart_mode[unit]) & PIC32_UMODE_ON) ||
+        ! (VALUE(uart_sta[unit]) & PIC32_USTA_UTXEN))
+        return;
+
+    if (uart_txfifo_count[unit] >= FIFO_SIZE) {
+        // Transmit FIFO overflow: byte is lost
+        return;
+    }
+    if (uart_capture)
+        fprintf (uart_capture, "%llu %u %02x\n",
+            (unsigned long long) cpu_cycles(), unit+1, data & 0xff);
+
     vtty_put_char (unit, data);
-    if ((VALUE(uart_mode[unit]) & PIC32_UMODE_ON) &&
-        (VALUE(uart_sta[unit]) & PIC32_USTA_UTXEN) &&
-        ! uart_oactive[unit])
-    {
-        uart_oactive[unit] = 1;
-        uart_odelay[unit] = 0;
-        VALUE(uart_sta[unit]) |= PIC32_USTA_UTXBF;
+
+    if (uart_infinite_baud) {
+        uart_tx_irq (unit);
+        return;
     }
+    uart_txfifo_count[unit]++;
+    if (uart_txfifo_count[unit] == 1) {
+        // Shift register was idle: start transmitting
+        event_schedule (EVENT_UART_TX + unit,
+            cpu_cycles() + uart_byte_cycles (unit), uart_tx_event, unit);
+    }
+    uart_update_flags (unit);
+    uart_tx_irq (unit);
+}
+
+/*
+ * Stop the receiver: clear receive FIFO.
+ */
+static void uart_rx_stop (int unit)
+{
+    irq_clear (uart_irq[unit] + UART_IRQ_RX);
+    event_cancel (EVENT_UART_RX + unit);
+    uart_rx_busy[unit] = 0;
+    uart_rxfifo_count[unit] = 0;
+    VALUE(uart_sta[unit]) &= ~(PIC32_USTA_OERR | PIC32_USTA_FERR |
+                               PIC32_USTA_PERR);
+}
+
+/*
+ * Stop the transmitter: clear transmit FIFO.
+ */
+static void uart_tx_stop (int unit)
+{
+    irq_clear (uart_irq[unit] + UART_IRQ_TX);
+    event_cancel (EVENT_UART_TX + unit);
+    uart_txfifo_count[unit] = 0;
 }
 
 /*
@@ -111,12 +354,10 @@ void uart_put_char (int unit, unsigned data)
 void uart_update_mode (int unit)
 {
     if (! (VALUE(uart_mode[unit]) & PIC32_UMODE_ON)) {
-        irq_clear (uart_irq[unit] + UART_IRQ_RX);
-        irq_clear (uart_irq[unit] + UART_IRQ_TX);
-        VALUE(uart_sta[unit]) &= ~(PIC32_USTA_URXDA | PIC32_USTA_FERR |
-                                   PIC32_USTA_PERR | PIC32_USTA_UTXBF);
-        VALUE(uart_sta[unit]) |= PIC32_USTA_RIDLE | PIC32_USTA_TRMT;
+        uart_rx_stop (unit);
+        uart_tx_stop (unit);
     }
+    uart_update_flags (unit);
 }
 
 /*
@@ -124,54 +365,64 @@ void uart_update_mode (int unit)
  */
 void uart_update_status (int unit)
 {
-    if (! (VALUE(uart_sta[unit]) & PIC32_USTA_URXEN)) {
-        irq_clear (uart_irq[unit] + UART_IRQ_RX);
-        VALUE(uart_sta[unit]) &= ~(PIC32_USTA_URXDA | PIC32_USTA_FERR |
-                                   PIC32_USTA_PERR);
-    }
+    if (! (VALUE(uart_sta[unit]) & PIC32_USTA_URXEN))
+        uart_rx_stop (unit);
+
     if (! (VALUE(uart_sta[unit]) & PIC32_USTA_UTXEN)) {
-        irq_clear (uart_irq[unit] + UART_IRQ_TX);
-        VALUE(uart_sta[unit]) &= ~PIC32_USTA_UTXBF;
-        VALUE(uart_sta[unit]) |= PIC32_USTA_TRMT;
+        uart_tx_stop (unit);
+    } else if (VALUE(uart_mode[unit]) & PIC32_UMODE_ON) {
+        // Transmitter enabled: check the interrupt condition
+        uart_tx_irq (unit);
+    }
+    uart_update_flags (unit);
+}
+
+/*
+ * Move input bytes from vtty (or replay file) to receive queue.
+ */
+static void uart_receive (int unit)
+{
+    int c, last;
+
+    while (uart_rxq_count[unit] < RXQ_SIZE) {
+        if (replay_enabled)
+            c = replay_input (unit);
+        else
+            c = vtty_get_char (unit);
+        if (c < 0)
+            break;
+        if (record_enabled)
+            record_input (unit, c);
+        if (mmio_recording)
+            mmio_record_input (unit, c);
+
+        last = (uart_rxq_first[unit] + uart_rxq_count[unit]) % RXQ_SIZE;
+        uart_rxq[unit][last] = c;
+        uart_rxq_count[unit]++;
     }
 }
 
+/*
+ * Called at the end of every simulation quantum:
+ * get input data and start the receivers.
+ * Transmitters are driven by scheduled events.
+ */
 void uart_poll()
 {
     int unit;
 
     for (unit=0; unit<NUM_UART; unit++) {
-	if (! (VALUE(uart_mode[unit]) & PIC32_UMODE_ON)) {
-	    /* UART disabled. */
-    	    uart_oactive[unit] = 0;
-            VALUE(uart_sta[unit]) &= ~PIC32_USTA_UTXBF;
-	    continue;
-	}
-
-	/* UART enabled. */
-	if ((VALUE(uart_sta[unit]) & PIC32_USTA_URXEN) && vtty_is_char_avail (unit)) {
-	    /* Receive data available. */
-	    VALUE(uart_sta[unit]) |= PIC32_USTA_URXDA;
-
-	    /* Activate receive interrupt. */
-	    irq_raise (uart_irq[unit] + UART_IRQ_RX);
+	if (! (VALUE(uart_mode[unit]) & PIC32_UMODE_ON) ||
+	    ! (VALUE(uart_sta[unit]) & PIC32_USTA_URXEN)) {
+	    /* UART or receiver disabled. */
 	    continue;
 	}
+	uart_receive (unit);
+	uart_rx_start (unit);
 
-	if (! (VALUE(uart_sta[unit]) & PIC32_USTA_UTXEN)) {
-	    /* Transmitter disabled. */
-            uart_oactive[unit] = 0;
-            continue;
-        }
-	if (uart_oactive[unit]) {
-	    /* Activate transmit interrupt. */
-	    if (++uart_odelay[unit] > OUTPUT_DELAY) {
-//printf("uart%u: raise tx irq %u\n", unit, uart_irq[unit] + UART_IRQ_TX);
-                irq_raise (uart_irq[unit] + UART_IRQ_TX);
-                VALUE(uart_sta[unit]) &= ~PIC32_USTA_UTXBF;
-                uart_oactive[unit] = 0;
-            }
-	}
+	/* Interrupt condition persists while data is in FIFO. */
+	if (uart_rxfifo_count[unit] > 0)
+	    uart_rx_irq (unit);
     }
 }
 
@@ -184,9 +435,11 @@ int uart_active()
     int unit;
 
     for (unit=0; unit<NUM_UART; unit++) {
-    	if (uart_oactive[unit])
+    	if (uart_txfifo_count[unit] > 0)
 	    return 1;
-    	if (vtty_is_char_avail (unit))
+    	if (uart_rxq_count[unit] > 0 || uart_rxfifo_count[unit] > 0)
+	    return 1;
+    	if (! replay_enabled && vtty_is_char_avail (unit))
 	    return 1;
     }
     return 0;
@@ -194,6 +447,12 @@ int uart_active()
 
 void uart_reset()
 {
+    int unit;
+
+    for (unit=0; unit<NUM_UART; unit++) {
+        uart_rx_stop (unit);
+        uart_tx_stop (unit);
+    }
     VALUE(U1MODE)  = 0;
     VALUE(U1STA)   = PIC32_USTA_RIDLE | PIC32_USTA_TRMT;
     VALUE(U1TXREG) = 0;
@@ -26,6 +26,7 @@
  * arising out of or in connection with the use or performance of
  * this software.
  */
+#define _GNU_SOURCE                 /* for posix_openpt() and friends */
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -33,6 +34,9 @@
 #include <errno.h>
 #include <termios.h>
 #include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <arpa/telnet.h>
 #include "globals.h"
@@ -46,7 +50,25 @@
 #define VTTY_BUFFER_SIZE    4096
 
 /*
- * VTTY connection states (for TCP)
+ * Output is queued by the simulation, and written to the backend
+ * by the vtty thread, so that a slow peer never stalls the CPU
+ */
+#define VTTY_OUTPUT_SIZE    65536
+
+/*
+ * VTTY backend types
+ */
+enum {
+    VTTY_TYPE_TERM,             /* controlling terminal */
+    VTTY_TYPE_TCP,              /* telnet connection on TCP port */
+    VTTY_TYPE_UNIX,             /* connection on UNIX socket */
+    VTTY_TYPE_PTY,              /* pseudo terminal */
+    VTTY_TYPE_FILE,             /* output to file */
+    VTTY_TYPE_NONE,             /* no connection, for scripts */
+};
+
+/*
+ * VTTY connection states (for TCP and UNIX sockets)
  */
 enum {
     VTTY_STATE_TCP_INVALID,     /* connection is not working */
@@ -76,15 +98,19 @@ enum {
 typedef struct virtual_tty vtty_t;
 struct virtual_tty {
     char *name;
+    int type;
     int state;
     int tcp_port;
+    const char *path;
     int terminal_support;
     int input_state;
     int telnet_cmd, telnet_opt, telnet_qual;
     int fd, accept_fd, *select_fd;
-    FILE *fstream;
     u_char buffer[VTTY_BUFFER_SIZE];
     u_int read_ptr, write_ptr;
+    u_char output[VTTY_OUTPUT_SIZE];
+    u_int output_head, output_tail;     /* queue of output bytes */
+    u_int output_lost;                  /* bytes dropped on overflow */
     pthread_mutex_t lock;
 };
 
@@ -95,6 +121,14 @@ static pthread_t vtty_thread;
 #define VTTY_UNLOCK(tty)    pthread_mutex_unlock(&(tty)->lock);
 
 static struct termios tios, tios_orig;
+static int tios_fd = -1;
+
+/* Serializes writes by the vtty thread and the final flush at exit */
+static pthread_mutex_t vtty_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Pipe to wake up the vtty thread on new output */
+static int wakeup_fd[2] = { -1, -1 };
+static int wakeup_pending;
 
 /*
  * Send Telnet command: WILL TELOPT_ECHO
@@ -141,7 +175,7 @@ static void vtty_telnet_do_ttype (vtty_t * vtty)
  */
 static void vtty_term_reset (void)
 {
-    tcsetattr (STDIN_FILENO, TCSANOW, &tios_orig);
+    tcsetattr (tios_fd, TCSANOW, &tios_orig);
 }
 
 /*
@@ -158,6 +192,7 @@ static int vtty_term_init (void)
     tcgetattr (fd, &tios);
 
     memcpy (&tios_orig, &tios, sizeof (struct termios));
+    tios_fd = fd;
     atexit (vtty_term_reset);
 
     tios.c_cc[VTIME] = 0;
@@ -174,9 +209,56 @@ static int vtty_term_init (void)
     tcsetattr (fd, TCSANOW, &tios);
     tcflush (fd, TCIFLUSH);
 
+    /* Keep the terminal blocking: it's read only when select()
+     * reports input, and written only by the vtty thread. */
     return fd;
 }
 
+/*
+ * Create a pseudo terminal, and print the name of slave device
+ */
+static int vtty_pty_init (vtty_t * vtty)
+{
+    struct termios t;
+    int slave;
+
+    vtty->fd = posix_openpt (O_RDWR | O_NOCTTY);
+    if (vtty->fd < 0 || grantpt (vtty->fd) < 0 || unlockpt (vtty->fd) < 0) {
+        perror ("vtty_pty_init: posix_openpt");
+        return (-1);
+    }
+
+    /* Keep the slave side open, so the master never gets EIO
+     * when no client is attached.  Put it into raw mode. */
+    slave = open (ptsname (vtty->fd), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        perror (ptsname (vtty->fd));
+        return (-1);
+    }
+    tcgetattr (slave, &t);
+    cfmakeraw (&t);
+    tcsetattr (slave, TCSANOW, &t);
+
+    fcntl (vtty->fd, F_SETFL, O_NONBLOCK);
+    fprintf (stderr, "%s: pseudo terminal %s\n", vtty->name, ptsname (vtty->fd));
+    vtty->select_fd = &vtty->fd;
+    return (0);
+}
+
+/*
+ * Open a file for output
+ */
+static int vtty_file_init (vtty_t * vtty)
+{
+    vtty->fd = open (vtty->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (vtty->fd < 0) {
+        perror (vtty->path);
+        return (-1);
+    }
+    fprintf (stderr, "%s: output to file %s\n", vtty->name, vtty->path);
+    return (0);
+}
+
 /*
  * Wait for a TCP connection
  */
@@ -228,16 +310,194 @@ error:
 }
 
 /*
- * Accept a TCP connection
+ * Wait for a connection on UNIX socket
+ */
+static int vtty_unix_conn_wait (vtty_t * vtty)
+{
+    struct sockaddr_un serv;
+
+    vtty->state = VTTY_STATE_TCP_INVALID;
+
+    if (strlen (vtty->path) >= sizeof (serv.sun_path)) {
+        fprintf (stderr, "%s: socket path too long\n", vtty->path);
+        return (-1);
+    }
+
+    if ((vtty->accept_fd = socket (PF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror ("vtty_unix_waitcon: socket");
+        return (-1);
+    }
+
+    memset (&serv, 0, sizeof (serv));
+    serv.sun_family = AF_UNIX;
+    strcpy (serv.sun_path, vtty->path);
+    unlink (vtty->path);
+
+    if (bind (vtty->accept_fd, (struct sockaddr *) &serv, sizeof (serv)) < 0) {
+        perror (vtty->path);
+        goto error;
+    }
+
+    if (listen (vtty->accept_fd, 1) < 0) {
+        perror ("vtty_unix_waitcon: listen");
+        goto error;
+    }
+
+    fprintf (stderr, "%s: waiting connection on socket %s (FD %d)\n", vtty->name,
+        vtty->path, vtty->accept_fd);
+
+    vtty->select_fd = &vtty->accept_fd;
+    vtty->state = VTTY_STATE_TCP_WAITING;
+    return (0);
+
+error:
+    close (vtty->accept_fd);
+    vtty->accept_fd = -1;
+    vtty->select_fd = NULL;
+    return (-1);
+}
+
+/*
+ * Write data to the backend.  Non-blocking backends accept only
+ * as much as fits; with wait flag, give the peer up to 100 msec
+ * to drain the output.  Return the number of bytes consumed.
+ */
+static u_int vtty_write (vtty_t * vtty, const u_char *data, u_int len, int wait)
+{
+    struct pollfd pfd;
+    u_int done = 0;
+    int n;
+
+    while (done < len) {
+        n = write (vtty->fd, data + done, len - done);
+        if (n > 0) {
+            done += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno != EAGAIN) {
+            /* Broken backend: discard the data. */
+            return len;
+        }
+        if (! wait)
+            break;
+
+        /* Output is blocked: give the peer a chance to drain it. */
+        pfd.fd = vtty->fd;
+        pfd.events = POLLOUT;
+        if (poll (&pfd, 1, 100) <= 0)
+            break;
+    }
+    return done;
+}
+
+/*
+ * Write queued output to the backend.  Called by the vtty thread,
+ * and at exit with wait flag.  The lock is not held while writing.
+ */
+static void vtty_drain (vtty_t * vtty, int wait)
+{
+    u_int head, tail, len, lost, n;
+    int ready;
+
+    pthread_mutex_lock (&vtty_drain_lock);
+    for (;;) {
+        VTTY_LOCK (vtty);
+        head = vtty->output_head;
+        tail = vtty->output_tail;
+        lost = vtty->output_lost;
+        vtty->output_lost = 0;
+        ready = vtty->fd >= 0 && (vtty->state == VTTY_STATE_TCP_RUNNING ||
+            (vtty->type != VTTY_TYPE_TCP && vtty->type != VTTY_TYPE_UNIX));
+        if (! ready)
+            vtty->output_tail = head;
+        VTTY_UNLOCK (vtty);
+
+        if (lost > 0)
+            fprintf (stderr, "%s: output overflow, %u bytes lost\n",
+                vtty->name, lost);
+        if (! ready || head == tail)
+            break;
+
+        /* Write a contiguous part of the queue. */
+        len = (head > tail ? head : VTTY_OUTPUT_SIZE) - tail;
+        n = vtty_write (vtty, vtty->output + tail, len, wait);
+
+        VTTY_LOCK (vtty);
+        if (wait && n < len) {
+            fprintf (stderr, "%s: output blocked, %u bytes lost\n", vtty->name,
+                (vtty->output_head - tail + VTTY_OUTPUT_SIZE) % VTTY_OUTPUT_SIZE - n);
+            n = (vtty->output_head - tail + VTTY_OUTPUT_SIZE) % VTTY_OUTPUT_SIZE;
+        }
+        vtty->output_tail = (tail + n) % VTTY_OUTPUT_SIZE;
+        VTTY_UNLOCK (vtty);
+        if (n < len)
+            break;
+    }
+    pthread_mutex_unlock (&vtty_drain_lock);
+}
+
+/*
+ * Wake up the vtty thread to write the output.
+ * Only one wakeup byte is kept in the pipe.
+ */
+static void vtty_wakeup (void)
+{
+    char c = 0;
+
+    if (wakeup_fd[1] < 0 ||
+        __atomic_exchange_n (&wakeup_pending, 1, __ATOMIC_ACQ_REL))
+        return;
+    if (write (wakeup_fd[1], &c, 1) < 0 && errno != EAGAIN)
+        perror ("vtty: wakeup");
+}
+
+/*
+ * Append data to the output queue.  When the queue is full,
+ * file output is written by the caller, so nothing is lost;
+ * for other backends the data are dropped, and reported by
+ * the vtty thread, as a stalled peer must not stop the simulation.
  */
-static int vtty_tcp_conn_accept (vtty_t * vtty)
+static void vtty_output (vtty_t * vtty, const char *data, u_int len)
 {
+    u_int next;
+
+    VTTY_LOCK (vtty);
+    while (len > 0) {
+        next = (vtty->output_head + 1) % VTTY_OUTPUT_SIZE;
+        if (next == vtty->output_tail) {
+            if (vtty->type == VTTY_TYPE_FILE) {
+                VTTY_UNLOCK (vtty);
+                vtty_drain (vtty, 1);
+                VTTY_LOCK (vtty);
+                continue;
+            }
+            vtty->output_lost += len;
+            break;
+        }
+        vtty->output[vtty->output_head] = *data++;
+        vtty->output_head = next;
+        len--;
+    }
+    VTTY_UNLOCK (vtty);
+    vtty_wakeup();
+}
+
+/*
+ * Accept a TCP or UNIX socket connection
+ */
+static int vtty_conn_accept (vtty_t * vtty)
+{
+    char msg [80];
+
     if ((vtty->fd = accept (vtty->accept_fd, NULL, NULL)) < 0) {
         fprintf (stderr,
-            "vtty_tcp_conn_accept: accept on port %d failed %s\n",
-            vtty->tcp_port, strerror (errno));
+            "vtty_conn_accept: accept on %s failed %s\n",
+            vtty->name, strerror (errno));
         return (-1);
     }
+    fcntl (vtty->fd, F_SETFL, O_NONBLOCK);
 
     fprintf (stderr, "%s is now connected (accept_fd=%d, conn_fd=%d)\n",
         vtty->name, vtty->accept_fd, vtty->fd);
@@ -251,24 +511,27 @@ static int vtty_tcp_conn_accept (vtty_t * vtty)
         vtty->input_state = VTTY_INPUT_TELNET;
     }
 
-    vtty->fstream = fdopen (vtty->fd, "wb");
-    if (! vtty->fstream) {
-        close (vtty->fd);
-        vtty->fd = -1;
-        return (-1);
-    }
-
-    fprintf (vtty->fstream, "Connected to pic32sim - %s\r\n\r\n", vtty->name);
-
     vtty->select_fd = &vtty->fd;
     vtty->state = VTTY_STATE_TCP_RUNNING;
+
+    if (vtty->type == VTTY_TYPE_TCP) {
+        sprintf (msg, "Connected to pic32sim - %s\r\n\r\n", vtty->name);
+        vtty_output (vtty, msg, strlen (msg));
+    }
     return (0);
 }
 
 /*
- * Create a virtual tty
+ * Create a virtual tty.
+ * Backend is one of:
+ *      stdio           - controlling terminal
+ *      tcp:port        - telnet connection on TCP port (or just a port number)
+ *      unix:path       - connection on UNIX socket
+ *      pty             - pseudo terminal
+ *      file:path       - write output to file
+ *      none            - discard output, input from script only
  */
-void vtty_create (unsigned unit, char *name, int tcp_port)
+void vtty_create (unsigned unit, char *name, const char *backend)
 {
     vtty_t *vtty = unittab + unit;
 
@@ -281,19 +544,50 @@ void vtty_create (unsigned unit, char *name, int tcp_port)
     memset (vtty, 0, sizeof (*vtty));
     vtty->name = name;
     vtty->fd = -1;
-    vtty->fstream = NULL;
     vtty->accept_fd = -1;
     pthread_mutex_init (&vtty->lock, NULL);
     vtty->input_state = VTTY_INPUT_TEXT;
 
-    if (tcp_port == 0) {
+    if (! backend || strcmp (backend, "stdio") == 0) {
+        vtty->type = VTTY_TYPE_TERM;
         vtty->fd = vtty_term_init();
         vtty->select_fd = &vtty->fd;
-        vtty->fstream = stdout;
-    } else {
+
+    } else if (strncmp (backend, "tcp:", 4) == 0 ||
+               (*backend >= '0' && *backend <= '9')) {
+        vtty->type = VTTY_TYPE_TCP;
         vtty->terminal_support = 1;
-        vtty->tcp_port = tcp_port;
-        vtty_tcp_conn_wait (vtty);
+        vtty->tcp_port = atoi (backend + (*backend == 't' ? 4 : 0));
+        if (vtty->tcp_port <= 0) {
+            fprintf (stderr, "%s: bad tcp port '%s'\n", name, backend);
+            exit(1);
+        }
+        if (vtty_tcp_conn_wait (vtty) < 0)
+            exit(1);
+
+    } else if (strncmp (backend, "unix:", 5) == 0) {
+        vtty->type = VTTY_TYPE_UNIX;
+        vtty->path = backend + 5;
+        if (vtty_unix_conn_wait (vtty) < 0)
+            exit(1);
+
+    } else if (strcmp (backend, "pty") == 0) {
+        vtty->type = VTTY_TYPE_PTY;
+        if (vtty_pty_init (vtty) < 0)
+            exit(1);
+
+    } else if (strncmp (backend, "file:", 5) == 0) {
+        vtty->type = VTTY_TYPE_FILE;
+        vtty->path = backend + 5;
+        if (vtty_file_init (vtty) < 0)
+            exit(1);
+
+    } else if (strcmp (backend, "none") == 0) {
+        vtty->type = VTTY_TYPE_NONE;
+
+    } else {
+        fprintf (stderr, "%s: unknown backend '%s'\n", name, backend);
+        exit(1);
     }
 }
 
@@ -304,12 +598,9 @@ void vtty_delete (unsigned unit)
 {
     vtty_t *vtty = unittab + unit;
 
-    if (unit < VTTY_NUNITS && (vtty->fstream || vtty->tcp_port)) {
+    if (unit < VTTY_NUNITS && vtty->name) {
 
-        if (vtty->fstream && vtty->fstream != stdout) {
-            fclose (vtty->fstream);
-        }
-        vtty->fstream = 0;
+        vtty_drain (vtty, 1);
 
         /* We don't close FD 0 since it is stdin */
         if (vtty->fd > 0) {
@@ -324,7 +615,11 @@ void vtty_delete (unsigned unit)
             close (vtty->accept_fd);
             vtty->accept_fd = -1;
         }
+        if (vtty->type == VTTY_TYPE_UNIX)
+            unlink (vtty->path);
+        vtty->select_fd = NULL;
         vtty->tcp_port = 0;
+        vtty->name = 0;
     }
 }
 
@@ -352,44 +647,50 @@ static int vtty_store (vtty_t * vtty, u_char c)
 }
 
 /*
- * Read a character from the terminal.
+ * Read available data from the terminal or pseudo terminal.
  */
-static int vtty_term_read (vtty_t * vtty)
+static int vtty_term_read (vtty_t * vtty, u_char *buf, int len)
 {
-    u_char c;
+    int n;
 
-    if (read (vtty->fd, &c, 1) == 1)
-        return (c);
+    n = read (vtty->fd, buf, len);
+    if (n > 0)
+        return (n);
 
-    perror ("read from vtty failed");
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+        perror ("read from vtty failed");
     return (-1);
 }
 
 /*
- * Read a character from the TCP connection.
+ * Read available data from the TCP or UNIX socket connection.
  */
-static int vtty_tcp_read (vtty_t * vtty)
+static int vtty_tcp_read (vtty_t * vtty, u_char *buf, int len)
 {
-    u_char c;
+    int n;
 
     switch (vtty->state) {
     case VTTY_STATE_TCP_RUNNING:
-        if (read (vtty->fd, &c, 1) == 1)
-            return (c);
+        n = read (vtty->fd, buf, len);
+        if (n > 0)
+            return (n);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            return (-1);
 
         /* Problem with the connection: Re-enter wait mode */
+        VTTY_LOCK (vtty);
         shutdown (vtty->fd, 2);
-        fclose (vtty->fstream);
         close (vtty->fd);
-        vtty->fstream = NULL;
         vtty->fd = -1;
+        vtty->output_tail = vtty->output_head;
         vtty->select_fd = &vtty->accept_fd;
         vtty->state = VTTY_STATE_TCP_WAITING;
+        VTTY_UNLOCK (vtty);
         return (-1);
 
     case VTTY_STATE_TCP_WAITING:
         /* A new connection has arrived */
-        vtty_tcp_conn_accept (vtty);
+        vtty_conn_accept (vtty);
         return (-1);
     }
 
@@ -398,31 +699,29 @@ static int vtty_tcp_read (vtty_t * vtty)
 }
 
 /*
- * Read a character from the virtual TTY.
+ * Read available data from the virtual TTY.
  *
- * If the VTTY is a TCP connection, restart it in case of error.
+ * If the VTTY is a socket connection, restart it in case of error.
  */
-static int vtty_read (vtty_t * vtty)
+static int vtty_read (vtty_t * vtty, u_char *buf, int len)
 {
-    if (vtty->tcp_port)
-        return vtty_tcp_read (vtty);
-    return vtty_term_read (vtty);
+    switch (vtty->type) {
+    case VTTY_TYPE_TCP:
+    case VTTY_TYPE_UNIX:
+        return vtty_tcp_read (vtty, buf, len);
+    case VTTY_TYPE_FILE:
+    case VTTY_TYPE_NONE:
+        return (-1);
+    }
+    return vtty_term_read (vtty, buf, len);
 }
 
 /*
- * Read a character (until one is available) and store it in buffer
+ * Process one input character and store it in buffer
  */
-static void vtty_read_and_store (int unit)
+static void vtty_input_char (int unit, int c)
 {
     vtty_t *vtty = unittab + unit;
-    int c;
-
-    /* wait until we get a character input */
-    c = vtty_read (vtty);
-
-    /* if read error, do nothing */
-    if (c < 0)
-        return;
 
     if (! vtty->terminal_support) {
         vtty_store (vtty, c);
@@ -562,6 +861,22 @@ static void vtty_read_and_store (int unit)
     }
 }
 
+/*
+ * Read all available input and store it in buffer
+ */
+static void vtty_read_and_store (int unit)
+{
+    vtty_t *vtty = unittab + unit;
+    u_char buf [256];
+    int n, i;
+
+    n = vtty_read (vtty, buf, sizeof (buf));
+
+    /* if read error, do nothing */
+    for (i=0; i<n; i++)
+        vtty_input_char (unit, buf[i]);
+}
+
 int vtty_is_full (unsigned unit)
 {
     vtty_t *vtty = unittab + unit;
@@ -587,6 +902,7 @@ int vtty_get_char (unsigned unit)
     }
 
     c = vtty->buffer[vtty->read_ptr++];
+    stat_vtty_in++;
 
     if (vtty->read_ptr == VTTY_BUFFER_SIZE)
         vtty->read_ptr = 0;
@@ -612,7 +928,8 @@ int vtty_is_char_avail (unsigned unit)
 }
 
 /*
- * Put char to vtty
+ * Put char to vtty.
+ * Output is buffered, and written by the vtty thread.
  */
 void vtty_put_char (unsigned unit, char ch)
 {
@@ -620,25 +937,67 @@ void vtty_put_char (unsigned unit, char ch)
 
     if (unit >= VTTY_NUNITS)
         return;
-    if (vtty->tcp_port) {
-        if (vtty->state == VTTY_STATE_TCP_RUNNING &&
-            fwrite (&ch, 1, 1, vtty->fstream) != 1)
-        {
-            fprintf (stderr, "%s: put char %#x failed (%s)\n",
-                vtty->name, (unsigned char) ch, strerror (errno));
-        }
-    } else if (vtty->fstream) {
-        if (write (vtty->fd, &ch, 1) != 1)
-            perror ("write");
-    } else {
+
+    /* Scripts and patterns see output of all ports,
+     * with or without a backend. */
+    if (script_enabled)
+        script_output (unit, (u_char) ch);
+    if (! vtty->name) {
         fprintf (stderr, "uart%u: not configured\n", unit+1);
+        return;
     }
+    stat_vtty_out++;
+    vtty_output (vtty, &ch, 1);
+}
+
+/*
+ * Send data to vtty input, as if typed by user.
+ */
+void vtty_send (unsigned unit, const char *data, unsigned len)
+{
+    vtty_t *vtty = unittab + unit;
+
+    if (unit >= VTTY_NUNITS || ! vtty->name) {
+        fprintf (stderr, "uart%u: not configured\n", unit+1);
+        return;
+    }
+    while (len-- > 0) {
+        if (vtty_store (vtty, *data++) < 0) {
+            fprintf (stderr, "%s: input buffer overflow\n", vtty->name);
+            break;
+        }
+    }
+}
+
+/*
+ * Write pending output of all ports
+ */
+static void vtty_drain_all (int wait)
+{
+    vtty_t *vtty;
+    int unit;
+
+    for (unit=0; unit<VTTY_NUNITS; unit++) {
+        vtty = unittab + unit;
+        if (! vtty->name || vtty->output_head == vtty->output_tail)
+            continue;
+        vtty_drain (vtty, wait);
+    }
+}
+
+/*
+ * Flush all output at exit
+ */
+static void vtty_flush_all (void)
+{
+    vtty_drain_all (1);
 }
 
 /*
  * Wait for input and return a bitmask of file descriptors.
+ * With wakeup flag, also wait for new output.
  */
-int vtty_wait (fd_set *rfdp)
+static int vtty_select (fd_set *rfdp, int wakeup)
 {
     vtty_t *vtty;
     struct timeval tv;
@@ -647,6 +1006,10 @@ int vtty_wait (fd_set *rfdp)
     /* Build the FD set */
     FD_ZERO (rfdp);
     fd_max = -1;
+    if (wakeup) {
+        fd_max = wakeup_fd[0];
+        FD_SET (fd_max, rfdp);
+    }
     for (unit=0; unit<VTTY_NUNITS; unit++) {
 	vtty = unittab + unit;
 	if (! vtty->select_fd)
@@ -661,7 +1024,7 @@ int vtty_wait (fd_set *rfdp)
 	FD_SET (fd, rfdp);
     }
     if (fd_max < 0) {
-	/* No vttys created yet. */
+	/* No vttys with input. */
 	usleep (200000);
 	return 0;
     }
@@ -685,6 +1048,11 @@ int vtty_wait (fd_set *rfdp)
     return 1;
 }
 
+int vtty_wait (fd_set *rfdp)
+{
+    return vtty_select (rfdp, 0);
+}
+
 /*
  * VTTY thread
  */
@@ -695,8 +1063,18 @@ static void *vtty_thread_main (void *arg)
     fd_set rfds;
 
     for (;;) {
-	if (! vtty_wait (&rfds))
+	if (! vtty_select (&rfds, 1)) {
+            vtty_drain_all (0);
 	    continue;
+        }
+
+        if (FD_ISSET (wakeup_fd[0], &rfds)) {
+            char buf[16];
+
+            while (read (wakeup_fd[0], buf, sizeof(buf)) > 0)
+                continue;
+            __atomic_store_n (&wakeup_pending, 0, __ATOMIC_RELEASE);
+        }
 
         /* Examine active FDs and call user handlers */
         for (unit=0; unit<VTTY_NUNITS; unit++) {
@@ -711,11 +1089,10 @@ static void *vtty_thread_main (void *arg)
             if (FD_ISSET (fd, &rfds)) {
                 vtty_read_and_store (unit);
             }
-
-            /* Flush any pending output */
-            if (vtty->fstream)
-                fflush (vtty->fstream);
         }
+
+        /* Write any pending output */
+        vtty_drain_all (0);
     }
     return NULL;
 }
@@ -725,6 +1102,13 @@ static void *vtty_thread_main (void *arg)
  */
 void vtty_init (void)
 {
+    atexit (vtty_flush_all);
+    if (pipe (wakeup_fd) < 0) {
+        perror ("vtty: pipe");
+        exit (1);
+    }
+    fcntl (wakeup_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl (wakeup_fd[1], F_SETFL, O_NONBLOCK);
     if (pthread_create (&vtty_thread, NULL, vtty_thread_main, NULL)) {
         perror ("vtty: pthread_create");
         exit (1);